@@ -0,0 +1,1224 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "nng.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Like perf.c, this uses private nni_ interfaces, because the whole point
+// is to measure the core data structures in isolation.  Don't copy this!
+#include "core/nng_impl.h"
+
+// bench runs microbenchmarks against the core primitives: messages,
+// message queues, mutexes, sockets, the ID hash, lists, and the clocks.
+// Each benchmark is run with 1, 2, 4, ... up to the maximum number of
+// threads.  Each thread runs the operation in batches, and the time for
+// each batch (divided by the batch size) gives one sample, in nanoseconds
+// per operation.  Batching is needed because the clock only has
+// microsecond resolution.
+//
+// Usage: bench [-n ops] [-b batch] [-w warmup] [-r runs] [-t threads]
+//              [-f text|csv|json] [name ...]
+//
+// Each configuration is run once untimed to warm up (caches, allocator),
+// then "runs" times for real.  All samples from all runs and threads are
+// pooled for the percentiles.  Throughput is the aggregate across all
+// threads, using the median run.  Context switches (voluntary and not,
+// across the whole process, including any helper threads the benchmark
+// starts) are reported per operation, over all the timed runs.
+
+typedef struct bench		bench;
+typedef struct bench_worker	bench_worker;
+typedef struct bench_run	bench_run;
+
+struct bench {
+	const char *	name;
+	const char *	desc;
+
+	// Optional; called once per run, to set up state shared by the
+	// workers (run->shared).
+	int		(*setup)(bench_run *);
+	void		(*teardown)(bench_run *);
+
+	// Optional; called by each worker before and after it runs, to set
+	// up thread-private state (w->state).
+	int		(*init)(bench_worker *);
+	void		(*fini)(bench_worker *);
+
+	// Performs n operations.
+	void		(*op)(bench_worker *, int);
+};
+
+struct bench_worker {
+	bench_run *	run;
+	nni_thr		thr;
+	void *		state;
+	double *	samples;
+	int		nsamples;
+	int		failed;
+};
+
+struct bench_run {
+	const bench *	b;
+	void *		shared;
+	int		nthreads;
+	int		ops;            // per thread
+	int		batch;
+	int		timed;
+
+	// Start gate, so that all the workers begin together.
+	nni_mtx		mx;
+	nni_cv		cv;
+	int		ready;
+	int		go;
+	nni_time	start;
+	nni_time	end;
+};
+
+static int opt_ops = 200000;
+static int opt_batch = 1000;
+static int opt_warmup = 1;
+static int opt_runs = 5;
+static int opt_threads = 4;
+static const char *opt_format = "text";
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+
+static int
+parse_int(const char *arg, const char *what)
+{
+	long val;
+	char *eptr;
+
+	val = strtol(arg, &eptr, 10);
+	if ((val < 1) || (val > (1<<30)) || (*eptr != 0) || (eptr == arg)) {
+		die("Invalid %s", what);
+	}
+	return ((int) val);
+}
+
+
+// Message allocation and free.
+
+static void
+bench_msg_alloc_op(bench_worker *w, int n)
+{
+	nni_msg *msg;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nni_msg_alloc(&msg, 64) != 0) {
+			w->failed = 1;
+			return;
+		}
+		nni_msg_free(msg);
+	}
+}
+
+
+// Message duplication.
+
+static int
+bench_msg_dup_init(bench_worker *w)
+{
+	nni_msg *msg;
+	int rv;
+
+	if ((rv = nni_msg_alloc(&msg, 256)) != 0) {
+		return (rv);
+	}
+	w->state = msg;
+	return (0);
+}
+
+
+static void
+bench_msg_dup_fini(bench_worker *w)
+{
+	nni_msg_free(w->state);
+}
+
+
+static void
+bench_msg_dup_op(bench_worker *w, int n)
+{
+	nni_msg *dup;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nni_msg_dup(&dup, w->state) != 0) {
+			w->failed = 1;
+			return;
+		}
+		nni_msg_free(dup);
+	}
+}
+
+
+// Prepending to the header (the backtrace path), and trimming it back.
+
+static void
+bench_msg_prepend_op(bench_worker *w, int n)
+{
+	uint8_t hdr[4] = { 0x80, 0, 0, 1 };
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nni_msg_prepend_header(w->state, hdr, sizeof (hdr)) != 0) {
+			w->failed = 1;
+			return;
+		}
+		(void) nni_msg_trim_header(w->state, sizeof (hdr));
+	}
+}
+
+
+// Message queue put and get.  All threads share the same queue, so this
+// measures the queue under contention.
+
+static int
+bench_msgq_setup(bench_run *run)
+{
+	nni_msgq *mq;
+	int rv;
+
+	if ((rv = nni_msgq_init(&mq, 64 * run->nthreads)) != 0) {
+		return (rv);
+	}
+	run->shared = mq;
+	return (0);
+}
+
+
+static void
+bench_msgq_teardown(bench_run *run)
+{
+	nni_msgq_fini(run->shared);
+}
+
+
+static void
+bench_msgq_op(bench_worker *w, int n)
+{
+	nni_msgq *mq = w->run->shared;
+	nni_msg *msg = w->state;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if ((nni_msgq_put(mq, msg) != 0) ||
+		    (nni_msgq_get(mq, &msg) != 0)) {
+			w->failed = 1;
+			return;
+		}
+	}
+	// We might have got someone else's message, but they are all the
+	// same, and each thread frees exactly one.
+	w->state = msg;
+}
+
+
+// ID hash insert, find and remove.  The hash has no locking of its own,
+// so each thread has its own table.
+
+static int
+bench_idhash_init(bench_worker *w)
+{
+	nni_idhash *h;
+	int rv;
+	uint32_t i;
+
+	if ((rv = nni_idhash_create(&h)) != 0) {
+		return (rv);
+	}
+	// Give the table some population, so that probing is realistic.
+	for (i = 1; i <= 256; i++) {
+		if ((rv = nni_idhash_insert(h, i * 7919, w)) != 0) {
+			nni_idhash_destroy(h);
+			return (rv);
+		}
+	}
+	w->state = h;
+	return (0);
+}
+
+
+static void
+bench_idhash_fini(bench_worker *w)
+{
+	nni_idhash_destroy(w->state);
+}
+
+
+static void
+bench_idhash_op(bench_worker *w, int n)
+{
+	nni_idhash *h = w->state;
+	void *val;
+	uint32_t id;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		id = 0x80000000u | (uint32_t) i;
+		if ((nni_idhash_insert(h, id, w) != 0) ||
+		    (nni_idhash_find(h, id, &val) != 0) ||
+		    (nni_idhash_remove(h, id) != 0)) {
+			w->failed = 1;
+			return;
+		}
+	}
+}
+
+
+// List append and remove.
+
+typedef struct {
+	nni_list_node	node;
+} bench_item;
+
+typedef struct {
+	nni_list	list;
+	bench_item	items[64];
+} bench_list;
+
+static int
+bench_list_init(bench_worker *w)
+{
+	bench_list *bl;
+	int i;
+
+	if ((bl = NNI_ALLOC_STRUCT(bl)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	NNI_LIST_INIT(&bl->list, bench_item, node);
+	for (i = 0; i < 64; i++) {
+		NNI_LIST_NODE_INIT(&bl->items[i].node);
+	}
+	w->state = bl;
+	return (0);
+}
+
+
+static void
+bench_list_fini(bench_worker *w)
+{
+	bench_list *bl = w->state;
+
+	NNI_FREE_STRUCT(bl);
+}
+
+
+static void
+bench_list_op(bench_worker *w, int n)
+{
+	bench_list *bl = w->state;
+	bench_item *item;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		item = &bl->items[i % 64];
+		nni_list_append(&bl->list, item);
+		if ((i % 64) == 63) {
+			while ((item = nni_list_first(&bl->list)) != NULL) {
+				nni_list_remove(&bl->list, item);
+			}
+		}
+	}
+	while ((item = nni_list_first(&bl->list)) != NULL) {
+		nni_list_remove(&bl->list, item);
+	}
+}
+
+
+// Thundering herd: producers put messages on a queue that a crowd of
+// consumer threads are all blocked reading.  Each message can only go to
+// one consumer, so ideally each costs one wakeup; watch csw/op.
+
+#define BENCH_HERD	8
+
+typedef struct {
+	nni_msgq *	mq;
+	nni_thr		thrs[BENCH_HERD];
+} bench_herd;
+
+static void
+bench_herd_consumer(void *arg)
+{
+	nni_msgq *mq = arg;
+	nni_msg *msg;
+
+	while (nni_msgq_get(mq, &msg) == 0) {
+		nni_msg_free(msg);
+	}
+}
+
+
+static int
+bench_herd_setup(bench_run *run)
+{
+	bench_herd *bh;
+	int rv;
+	int i;
+
+	if ((bh = NNI_ALLOC_STRUCT(bh)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_msgq_init(&bh->mq, 64)) != 0) {
+		NNI_FREE_STRUCT(bh);
+		return (rv);
+	}
+	for (i = 0; i < BENCH_HERD; i++) {
+		rv = nni_thr_init(&bh->thrs[i], bench_herd_consumer, bh->mq);
+		if (rv != 0) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+		nni_thr_run(&bh->thrs[i]);
+	}
+	run->shared = bh;
+	return (0);
+}
+
+
+static void
+bench_herd_teardown(bench_run *run)
+{
+	bench_herd *bh = run->shared;
+	int i;
+
+	nni_msgq_close(bh->mq);
+	for (i = 0; i < BENCH_HERD; i++) {
+		nni_thr_fini(&bh->thrs[i]);
+	}
+	nni_msgq_fini(bh->mq);
+	NNI_FREE_STRUCT(bh);
+}
+
+
+static void
+bench_herd_op(bench_worker *w, int n)
+{
+	bench_herd *bh = w->run->shared;
+	nni_msg *msg;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if ((nni_msg_alloc(&msg, 0) != 0) ||
+		    (nni_msgq_put(bh->mq, msg) != 0)) {
+			w->failed = 1;
+			return;
+		}
+	}
+}
+
+
+// Mutex lock and unlock, with a short critical section, on one mutex
+// shared by all threads.  This is the pattern of the socket and message
+// queue locks, and compares the pthread and futex (NNG_ENABLE_FUTEX)
+// implementations under contention.
+
+typedef struct {
+	nni_mtx		mx;
+	uint64_t	count;
+} bench_mtx;
+
+static int
+bench_mtx_setup(bench_run *run)
+{
+	bench_mtx *bm;
+	int rv;
+
+	if ((bm = NNI_ALLOC_STRUCT(bm)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_mtx_init(&bm->mx)) != 0) {
+		NNI_FREE_STRUCT(bm);
+		return (rv);
+	}
+	run->shared = bm;
+	return (0);
+}
+
+
+static void
+bench_mtx_teardown(bench_run *run)
+{
+	bench_mtx *bm = run->shared;
+
+	nni_mtx_fini(&bm->mx);
+	NNI_FREE_STRUCT(bm);
+}
+
+
+static void
+bench_mtx_op(bench_worker *w, int n)
+{
+	bench_mtx *bm = w->run->shared;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		nni_mtx_lock(&bm->mx);
+		bm->count++;
+		nni_mtx_unlock(&bm->mx);
+	}
+}
+
+
+// Send and receive through a connected pair of PAIR sockets, over inproc,
+// with every thread using the same two sockets.  This exercises the
+// socket send and receive paths, and shows whether concurrent senders
+// and receivers on one socket serialize on its lock.
+
+typedef struct {
+	nng_socket *	s1;
+	nng_socket *	s2;
+} bench_sock;
+
+static int
+bench_sock_setup(bench_run *run)
+{
+	bench_sock *bs;
+	int depth = 64 * run->nthreads;
+	int rv;
+
+	if ((bs = NNI_ALLOC_STRUCT(bs)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nng_open(&bs->s1, NNG_PROTO_PAIR)) != 0) {
+		NNI_FREE_STRUCT(bs);
+		return (rv);
+	}
+	if ((rv = nng_open(&bs->s2, NNG_PROTO_PAIR)) != 0) {
+		nng_close(bs->s1);
+		NNI_FREE_STRUCT(bs);
+		return (rv);
+	}
+	if (((rv = nng_setopt(bs->s1, NNG_OPT_SNDBUF, &depth,
+	    sizeof (depth))) != 0) ||
+	    ((rv = nng_setopt(bs->s2, NNG_OPT_RCVBUF, &depth,
+	    sizeof (depth))) != 0) ||
+	    ((rv = nng_listen(bs->s2, "inproc://bench", NULL,
+	    NNG_FLAG_SYNCH)) != 0) ||
+	    ((rv = nng_dial(bs->s1, "inproc://bench", NULL,
+	    NNG_FLAG_SYNCH)) != 0)) {
+		nng_close(bs->s1);
+		nng_close(bs->s2);
+		NNI_FREE_STRUCT(bs);
+		return (rv);
+	}
+	run->shared = bs;
+	return (0);
+}
+
+
+static void
+bench_sock_teardown(bench_run *run)
+{
+	bench_sock *bs = run->shared;
+
+	nng_close(bs->s1);
+	nng_close(bs->s2);
+	NNI_FREE_STRUCT(bs);
+}
+
+
+static void
+bench_sock_op(bench_worker *w, int n)
+{
+	bench_sock *bs = w->run->shared;
+	nng_msg *msg;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nng_msg_alloc(&msg, 0) != 0) {
+			w->failed = 1;
+			return;
+		}
+		if (nng_sendmsg(bs->s1, msg, 0) != 0) {
+			nng_msg_free(msg);
+			w->failed = 1;
+			return;
+		}
+		if (nng_recvmsg(bs->s2, &msg, 0) != 0) {
+			w->failed = 1;
+			return;
+		}
+		nng_msg_free(msg);
+	}
+}
+
+
+// Sends on a PUSH socket, drained by a PULL peer, with and without a
+// stream of other PULL peers connecting and disconnecting about once a
+// millisecond.  Connections come and go through the locks that guard the
+// socket's pipes, so if those are kept apart from the protocol, the send
+// rate should be much the same either way.
+
+#define BENCH_CHURN_PERIOD	1000    // usec between connections
+
+typedef struct {
+	nng_socket *	push;
+	nng_socket *	pull;
+	nni_thr		drainer;
+	nni_thr		churner;
+	int		churn;
+	volatile int	stop;
+	int		conns;
+	nni_time	start;
+} bench_push;
+
+static void
+bench_push_drainer(void *arg)
+{
+	bench_push *bp = arg;
+	nng_msg *msg;
+
+	while (nng_recvmsg(bp->pull, &msg, 0) == 0) {
+		nng_msg_free(msg);
+	}
+}
+
+
+static void
+bench_push_churner(void *arg)
+{
+	bench_push *bp = arg;
+	nng_socket *sock;
+	nni_time next;
+	nni_time now;
+
+	next = nni_clock();
+	while (!bp->stop) {
+		if (nng_open(&sock, NNG_PROTO_PULL) != 0) {
+			break;
+		}
+		if (nng_dial(sock, "inproc://churn", NULL,
+		    NNG_FLAG_SYNCH) == 0) {
+			bp->conns++;
+		}
+		nng_close(sock);
+
+		next += BENCH_CHURN_PERIOD;
+		if ((now = nni_clock()) < next) {
+			nni_usleep(next - now);
+		}
+	}
+}
+
+
+static int
+bench_push_start(bench_run *run, int churn)
+{
+	bench_push *bp;
+	int rv;
+
+	if ((bp = NNI_ALLOC_STRUCT(bp)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	bp->churn = churn;
+	if ((rv = nng_open(&bp->push, NNG_PROTO_PUSH)) != 0) {
+		NNI_FREE_STRUCT(bp);
+		return (rv);
+	}
+	if ((rv = nng_open(&bp->pull, NNG_PROTO_PULL)) != 0) {
+		nng_close(bp->push);
+		NNI_FREE_STRUCT(bp);
+		return (rv);
+	}
+	if (((rv = nng_listen(bp->push, "inproc://churn", NULL,
+	    NNG_FLAG_SYNCH)) != 0) ||
+	    ((rv = nng_dial(bp->pull, "inproc://churn", NULL,
+	    NNG_FLAG_SYNCH)) != 0) ||
+	    ((rv = nni_thr_init(&bp->drainer, bench_push_drainer, bp)) != 0) ||
+	    ((rv = nni_thr_init(&bp->churner,
+	    churn ? bench_push_churner : NULL, bp)) != 0)) {
+		die("Cannot set up sockets: %s", nng_strerror(rv));
+	}
+	nni_thr_run(&bp->drainer);
+	nni_thr_run(&bp->churner);
+	bp->start = nni_clock();
+	run->shared = bp;
+	return (0);
+}
+
+
+static int
+bench_push_setup(bench_run *run)
+{
+	return (bench_push_start(run, 0));
+}
+
+
+static int
+bench_churn_setup(bench_run *run)
+{
+	return (bench_push_start(run, 1));
+}
+
+
+static void
+bench_push_teardown(bench_run *run)
+{
+	bench_push *bp = run->shared;
+	nni_time elapsed;
+
+	bp->stop = 1;
+	nni_thr_fini(&bp->churner);
+	elapsed = nni_clock() - bp->start;
+	if (bp->churn && run->timed && (elapsed > 0)) {
+		fprintf(stderr, "%s: %d threads, %.0f connections/s\n",
+		    run->b->name, run->nthreads,
+		    bp->conns * 1000000.0 / elapsed);
+	}
+	nng_close(bp->push);
+	nng_close(bp->pull);
+	nni_thr_fini(&bp->drainer);
+	NNI_FREE_STRUCT(bp);
+}
+
+
+static void
+bench_push_op(bench_worker *w, int n)
+{
+	bench_push *bp = w->run->shared;
+	nng_msg *msg;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nng_msg_alloc(&msg, 0) != 0) {
+			w->failed = 1;
+			return;
+		}
+		if (nng_sendmsg(bp->push, msg, 0) != 0) {
+			nng_msg_free(msg);
+			w->failed = 1;
+			return;
+		}
+	}
+}
+
+
+// Opening and closing a socket that is never used.  REQ is used, since it
+// has both protocol state and a worker thread of its own.
+
+static void
+bench_sock_open_op(bench_worker *w, int n)
+{
+	nng_socket *sock;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nng_open(&sock, NNG_PROTO_REQ) != 0) {
+			w->failed = 1;
+			return;
+		}
+		nng_close(sock);
+	}
+}
+
+
+// Clock reads.  The sum keeps the calls from being optimized away.
+
+static volatile nni_time bench_clock_sink;
+
+static void
+bench_clock_op(bench_worker *w, int n)
+{
+	nni_time sum = 0;
+	int i;
+
+	NNI_ARG_UNUSED(w);
+	for (i = 0; i < n; i++) {
+		sum += nni_clock();
+	}
+	bench_clock_sink = sum;
+}
+
+
+static void
+bench_clock_coarse_op(bench_worker *w, int n)
+{
+	nni_time sum = 0;
+	int i;
+
+	NNI_ARG_UNUSED(w);
+	for (i = 0; i < n; i++) {
+		sum += nni_clock_coarse();
+	}
+	bench_clock_sink = sum;
+}
+
+
+// Random numbers, as drawn for pipe and request IDs.
+
+static volatile uint32_t bench_random_sink;
+
+static void
+bench_random_op(bench_worker *w, int n)
+{
+	uint32_t sum = 0;
+	int i;
+
+	NNI_ARG_UNUSED(w);
+	for (i = 0; i < n; i++) {
+		sum += nni_random();
+	}
+	bench_random_sink = sum;
+}
+
+
+static const bench benches[] = {
+	{
+		.name = "msg_alloc",
+		.desc = "nni_msg_alloc + nni_msg_free (64 bytes)",
+		.op = bench_msg_alloc_op,
+	},
+	{
+		.name = "msg_dup",
+		.desc = "nni_msg_dup + nni_msg_free (256 bytes)",
+		.init = bench_msg_dup_init,
+		.fini = bench_msg_dup_fini,
+		.op = bench_msg_dup_op,
+	},
+	{
+		.name = "msg_prepend",
+		.desc = "nni_msg_prepend_header + nni_msg_trim_header",
+		.init = bench_msg_dup_init,
+		.fini = bench_msg_dup_fini,
+		.op = bench_msg_prepend_op,
+	},
+	{
+		.name = "msgq_putget",
+		.desc = "nni_msgq_put + nni_msgq_get (shared queue)",
+		.setup = bench_msgq_setup,
+		.teardown = bench_msgq_teardown,
+		.init = bench_msg_dup_init,
+		.fini = bench_msg_dup_fini,
+		.op = bench_msgq_op,
+	},
+	{
+		.name = "msgq_herd",
+		.desc = "nni_msgq_put to 8 blocked readers",
+		.setup = bench_herd_setup,
+		.teardown = bench_herd_teardown,
+		.op = bench_herd_op,
+	},
+	{
+		.name = "mutex",
+		.desc = "nni_mtx_lock + nni_mtx_unlock (shared mutex)",
+		.setup = bench_mtx_setup,
+		.teardown = bench_mtx_teardown,
+		.op = bench_mtx_op,
+	},
+	{
+		.name = "sock_pair",
+		.desc = "nng_sendmsg + nng_recvmsg (shared PAIR sockets)",
+		.setup = bench_sock_setup,
+		.teardown = bench_sock_teardown,
+		.op = bench_sock_op,
+	},
+	{
+		.name = "sock_push",
+		.desc = "nng_sendmsg on PUSH (one PULL peer)",
+		.setup = bench_push_setup,
+		.teardown = bench_push_teardown,
+		.op = bench_push_op,
+	},
+	{
+		.name = "sock_churn",
+		.desc = "nng_sendmsg on PUSH (with ~1000 connections/s)",
+		.setup = bench_churn_setup,
+		.teardown = bench_push_teardown,
+		.op = bench_push_op,
+	},
+	{
+		.name = "sock_open",
+		.desc = "nng_open + nng_close (REQ)",
+		.op = bench_sock_open_op,
+	},
+	{
+		.name = "idhash",
+		.desc = "nni_idhash insert + find + remove",
+		.init = bench_idhash_init,
+		.fini = bench_idhash_fini,
+		.op = bench_idhash_op,
+	},
+	{
+		.name = "list",
+		.desc = "nni_list_append + nni_list_remove",
+		.init = bench_list_init,
+		.fini = bench_list_fini,
+		.op = bench_list_op,
+	},
+	{
+		.name = "clock",
+		.desc = "nni_clock",
+		.op = bench_clock_op,
+	},
+	{
+		.name = "clock_coarse",
+		.desc = "nni_clock_coarse",
+		.op = bench_clock_coarse_op,
+	},
+	{
+		.name = "random",
+		.desc = "nni_random",
+		.op = bench_random_op,
+	},
+	{
+		.name = NULL,
+	},
+};
+
+static void
+bench_worker_main(void *arg)
+{
+	bench_worker *w = arg;
+	bench_run *run = w->run;
+	const bench *b = run->b;
+	nni_time t0, t1;
+	int left;
+	int n;
+
+	if ((b->init != NULL) && (b->init(w) != 0)) {
+		w->failed = 1;
+	}
+
+	nni_mtx_lock(&run->mx);
+	run->ready++;
+	nni_cv_wake(&run->cv);
+	while (!run->go) {
+		nni_cv_wait(&run->cv);
+	}
+	nni_mtx_unlock(&run->mx);
+
+	left = run->ops;
+	while ((left > 0) && (!w->failed)) {
+		n = left < run->batch ? left : run->batch;
+		t0 = nni_clock();
+		b->op(w, n);
+		t1 = nni_clock();
+		left -= n;
+		if (run->timed) {
+			w->samples[w->nsamples++] =
+			    ((double) (t1 - t0) * 1000.0) / n;
+		}
+	}
+
+	nni_mtx_lock(&run->mx);
+	run->ready--;
+	if (run->ready == 0) {
+		run->end = nni_clock();
+	}
+	nni_cv_wake(&run->cv);
+	nni_mtx_unlock(&run->mx);
+
+	if ((b->fini != NULL) && (w->state != NULL)) {
+		b->fini(w);
+	}
+}
+
+
+// bench_once runs the benchmark once on nthreads threads.  The samples
+// are appended to the pool, and the wall time in usec is returned.
+static uint64_t bench_csw;      // context switches in timed runs
+
+static uint64_t
+bench_ncsw(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0) {
+		return (0);
+	}
+	return ((uint64_t) ru.ru_nvcsw + (uint64_t) ru.ru_nivcsw);
+}
+
+
+static nni_duration
+bench_once(const bench *b, int nthreads, int timed, double *pool, int *npool)
+{
+	bench_run run;
+	bench_worker *workers;
+	uint64_t csw;
+	int nbatch;
+	int rv;
+	int i;
+	int j;
+
+	memset(&run, 0, sizeof (run));
+	run.b = b;
+	run.nthreads = nthreads;
+	run.ops = opt_ops;
+	run.batch = opt_batch;
+	run.timed = timed;
+	nbatch = (opt_ops + opt_batch - 1) / opt_batch;
+
+	if ((nni_mtx_init(&run.mx) != 0) ||
+	    (nni_cv_init(&run.cv, &run.mx) != 0)) {
+		die("Cannot create mutex");
+	}
+	if ((b->setup != NULL) && ((rv = b->setup(&run)) != 0)) {
+		die("%s: setup: %s", b->name, nng_strerror(rv));
+	}
+	if ((workers = calloc(nthreads, sizeof (*workers))) == NULL) {
+		die("Out of memory");
+	}
+	for (i = 0; i < nthreads; i++) {
+		workers[i].run = &run;
+		if ((workers[i].samples = calloc(nbatch, sizeof (double))) ==
+		    NULL) {
+			die("Out of memory");
+		}
+		rv = nni_thr_init(&workers[i].thr, bench_worker_main,
+		    &workers[i]);
+		if (rv != 0) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+		nni_thr_run(&workers[i].thr);
+	}
+
+	nni_mtx_lock(&run.mx);
+	while (run.ready < nthreads) {
+		nni_cv_wait(&run.cv);
+	}
+	csw = bench_ncsw();
+	run.start = nni_clock();
+	run.go = 1;
+	nni_cv_wake(&run.cv);
+	nni_mtx_unlock(&run.mx);
+
+	for (i = 0; i < nthreads; i++) {
+		nni_thr_fini(&workers[i].thr);
+		if (workers[i].failed) {
+			die("%s: operation failed", b->name);
+		}
+		for (j = 0; j < workers[i].nsamples; j++) {
+			pool[(*npool)++] = workers[i].samples[j];
+		}
+		free(workers[i].samples);
+	}
+	free(workers);
+	if (timed) {
+		bench_csw += bench_ncsw() - csw;
+	}
+
+	if (b->teardown != NULL) {
+		b->teardown(&run);
+	}
+	nni_cv_fini(&run.cv);
+	nni_mtx_fini(&run.mx);
+	return (run.end - run.start);
+}
+
+
+static int
+bench_cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+
+static int
+bench_cmp_dur(const void *a, const void *b)
+{
+	nni_duration x = *(const nni_duration *) a;
+	nni_duration y = *(const nni_duration *) b;
+
+	return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+
+static double
+bench_pct(double *sorted, int n, double pct)
+{
+	int idx;
+
+	idx = (int) ((pct / 100.0) * (n - 1) + 0.5);
+	return (sorted[idx]);
+}
+
+
+static int bench_first = 1;
+
+static void
+bench_report(const bench *b, int nthreads, double *pool, int npool,
+    nni_duration *walls)
+{
+	double p50, p90, p99, max, mean, mops, csw;
+	nni_duration wall;
+	int i;
+
+	qsort(pool, npool, sizeof (double), bench_cmp_double);
+	qsort(walls, opt_runs, sizeof (nni_duration), bench_cmp_dur);
+	p50 = bench_pct(pool, npool, 50.0);
+	p90 = bench_pct(pool, npool, 90.0);
+	p99 = bench_pct(pool, npool, 99.0);
+	max = pool[npool - 1];
+	for (mean = 0, i = 0; i < npool; i++) {
+		mean += pool[i];
+	}
+	mean /= npool;
+	wall = walls[opt_runs / 2];
+	if (wall < 1) {
+		wall = 1;
+	}
+	mops = ((double) opt_ops * nthreads) / (double) wall;
+	csw = (double) bench_csw / ((double) opt_ops * nthreads * opt_runs);
+
+	if (strcmp(opt_format, "csv") == 0) {
+		if (bench_first) {
+			printf("name,threads,ops,mean_ns,p50_ns,p90_ns,p99_ns,"
+			    "max_ns,mops,csw_per_op\n");
+		}
+		printf("%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.3f,%.4f\n",
+		    b->name, nthreads, opt_ops, mean, p50, p90, p99, max, mops,
+		    csw);
+	} else if (strcmp(opt_format, "json") == 0) {
+		printf("%s\n  {\"name\": \"%s\", \"threads\": %d, \"ops\": %d, "
+		    "\"mean_ns\": %.2f, \"p50_ns\": %.2f, \"p90_ns\": %.2f, "
+		    "\"p99_ns\": %.2f, \"max_ns\": %.2f, \"mops\": %.3f, "
+		    "\"csw_per_op\": %.4f}",
+		    bench_first ? "[" : ",", b->name, nthreads, opt_ops, mean,
+		    p50, p90, p99, max, mops, csw);
+	} else {
+		if (bench_first) {
+			printf("%-12s %4s %9s %9s %9s %9s %9s %9s %8s\n",
+			    "name", "thr", "mean(ns)", "p50(ns)", "p90(ns)",
+			    "p99(ns)", "max(ns)", "Mop/s", "csw/op");
+		}
+		printf("%-12s %4d %9.1f %9.1f %9.1f %9.1f %9.1f %9.3f %8.4f\n",
+		    b->name, nthreads, mean, p50, p90, p99, max, mops, csw);
+	}
+	bench_first = 0;
+}
+
+
+static int
+bench_selected(const bench *b, int argc, char **argv)
+{
+	int i;
+
+	if (argc == 0) {
+		return (1);
+	}
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], b->name) == 0) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	const bench *b;
+	double *pool;
+	nni_duration *walls;
+	int npool;
+	int nthreads;
+	int nbatch;
+	int i;
+
+	argc--;
+	argv++;
+	while ((argc > 0) && (argv[0][0] == '-')) {
+		if (strcmp(argv[0], "-l") == 0) {
+			for (b = benches; b->name != NULL; b++) {
+				printf("%-12s %s\n", b->name, b->desc);
+			}
+			return (0);
+		}
+		if (argc < 2) {
+			die("Usage: bench [-l] [-n ops] [-b batch] [-w warmup] "
+			    "[-r runs] [-t threads] [-f text|csv|json] "
+			    "[name ...]");
+		}
+		if (strcmp(argv[0], "-n") == 0) {
+			opt_ops = parse_int(argv[1], "operation count");
+		} else if (strcmp(argv[0], "-b") == 0) {
+			opt_batch = parse_int(argv[1], "batch size");
+		} else if (strcmp(argv[0], "-w") == 0) {
+			opt_warmup = atoi(argv[1]);
+		} else if (strcmp(argv[0], "-r") == 0) {
+			opt_runs = parse_int(argv[1], "run count");
+		} else if (strcmp(argv[0], "-t") == 0) {
+			opt_threads = parse_int(argv[1], "thread count");
+		} else if (strcmp(argv[0], "-f") == 0) {
+			opt_format = argv[1];
+		} else {
+			die("Unknown option %s", argv[0]);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	nni_init();
+
+	for (b = benches; b->name != NULL; b++) {
+		if (!bench_selected(b, argc, argv)) {
+			continue;
+		}
+		for (nthreads = 1;;) {
+			nbatch = (opt_ops + opt_batch - 1) / opt_batch;
+			pool = calloc((size_t) nbatch * nthreads * opt_runs,
+			    sizeof (double));
+			walls = calloc(opt_runs, sizeof (nni_duration));
+			if ((pool == NULL) || (walls == NULL)) {
+				die("Out of memory");
+			}
+			npool = 0;
+			bench_csw = 0;
+			for (i = 0; i < opt_warmup; i++) {
+				(void) bench_once(b, nthreads, 0, pool, &npool);
+			}
+			for (i = 0; i < opt_runs; i++) {
+				walls[i] = bench_once(b, nthreads, 1, pool,
+				    &npool);
+			}
+			bench_report(b, nthreads, pool, npool, walls);
+			free(pool);
+			free(walls);
+
+			// Double each time, but always finish with the
+			// maximum, even if it is not a power of two.
+			if (nthreads == opt_threads) {
+				break;
+			}
+			nthreads *= 2;
+			if (nthreads > opt_threads) {
+				nthreads = opt_threads;
+			}
+		}
+	}
+	if ((strcmp(opt_format, "json") == 0) && (!bench_first)) {
+		printf("\n]\n");
+	}
+	return (0);
+}
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <math.h>
 
 // We steal access to the clock and thread functions so that we can
 // work on Windows too.  These functions are *not* part of nng's public
@@ -21,6 +22,8 @@
 // change without notice, and not part of the stable API or ABI.
 #include "core/nng_impl.h"
 
+typedef struct histogram histogram;
+
 static void latency_client(const char *, int, int);
 static void latency_server(const char *, int, int);
 static void throughput_client(const char *, int, int);
@@ -31,6 +34,7 @@ static void do_remote_thr(int argc, char **argv);
 static void do_local_thr(int argc, char **argv);
 static void do_inproc_thr(int argc, char **argv);
 static void do_inproc_lat(int argc, char **argv);
+static void do_loadgen(int argc, char **argv);
 static void die(const char *, ...);
 
 // perf implements the same performance tests found in the standard
@@ -46,8 +50,40 @@ static void die(const char *, ...);
 // - remote_thr - remote throughput side
 // - inproc_lat - inproc latency
 // - inproc_thr - inproc throughput
+// - loadgen    - multi-connection, multi-threaded load generator
+//
+// The latency clients (remote_lat, inproc_lat) accept some extra options
+// ahead of the usual arguments:
+//
+// -r <rate>	send requests at a fixed rate (per second), rather than
+//		back to back, and also report latencies corrected for
+//		coordinated omission (measured from the intended send time)
+// -d <file>	dump the raw histogram to the file ("-" for stdout)
+// -b <usec>	busy-poll for up to this long on receive before sleeping
+//		(local_lat accepts this one too)
 //
 
+// Latency histogram.  This is in the style of HdrHistogram: values are
+// bucketed by power of two, and each power of two is split into linear
+// sub-buckets, so the relative error is bounded (about 3% here) over the
+// whole range, with a fixed amount of memory.  Values are in usec.
+#define HIST_SUBBITS	5
+#define HIST_SUB	(1 << HIST_SUBBITS)
+#define HIST_NBUCKETS	((64 - HIST_SUBBITS + 1) * (HIST_SUB / 2) + HIST_SUB)
+
+struct histogram {
+	uint64_t	counts[HIST_NBUCKETS];
+	uint64_t	total;
+	uint64_t	min;
+	uint64_t	max;
+	double		sum;
+	double		sumsq;
+};
+
+static int lat_rate = 0;                // requests/sec, 0 = closed loop
+static const char *lat_dump = NULL;     // file for the raw histogram
+static int lat_busypoll = 0;            // receive busy-poll usec, 0 = off
+
 int
 main(int argc, char **argv)
 {
@@ -55,7 +91,7 @@ main(int argc, char **argv)
 
 	// Allow -m <remote_late> or whatever to override argv[0].
 	if ((argc >= 3) && (strcmp(argv[1], "-m") == 0)) {
-		prog = argv[1];
+		prog = argv[2];
 		argv += 3;
 		argc -= 3;
 	} else {
@@ -85,6 +121,8 @@ main(int argc, char **argv)
 		do_inproc_thr(argc, argv);
 	} else if ((strcmp(prog, "inproc_lat") == 0)) {
 		do_inproc_lat(argc, argv);
+	} else if ((strcmp(prog, "loadgen") == 0)) {
+		do_loadgen(argc, argv);
 	} else {
 		die("Unknown program mode? Use -m <mode>.");
 	}
@@ -119,14 +157,194 @@ parse_int(const char *arg, const char *what)
 }
 
 
+static int
+hist_index(uint64_t v)
+{
+	int shift = 0;
+
+	if (v < HIST_SUB) {
+		return ((int) v);
+	}
+	while ((v >> shift) >= HIST_SUB) {
+		shift++;
+	}
+	return ((shift * (HIST_SUB / 2)) + (int) (v >> shift));
+}
+
+
+// hist_value returns the highest value that maps to the bucket.
+static uint64_t
+hist_value(int idx)
+{
+	int shift;
+	uint64_t sub;
+
+	if (idx < HIST_SUB) {
+		return ((uint64_t) idx);
+	}
+	shift = (idx - HIST_SUB) / (HIST_SUB / 2) + 1;
+	sub = (uint64_t) (idx - (shift * (HIST_SUB / 2)));
+	return (((sub + 1) << shift) - 1);
+}
+
+
+static void
+hist_init(histogram *h)
+{
+	memset(h, 0, sizeof (*h));
+	h->min = UINT64_MAX;
+}
+
+
+static void
+hist_record(histogram *h, uint64_t v)
+{
+	h->counts[hist_index(v)]++;
+	h->total++;
+	h->sum += (double) v;
+	h->sumsq += (double) v * (double) v;
+	if (v < h->min) {
+		h->min = v;
+	}
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+
+static uint64_t
+hist_percentile(histogram *h, double pct)
+{
+	uint64_t want;
+	uint64_t seen = 0;
+	uint64_t v;
+	int i;
+
+	want = (uint64_t) ((pct / 100.0) * (double) h->total + 0.5);
+	if (want < 1) {
+		want = 1;
+	}
+	for (i = 0; i < HIST_NBUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= want) {
+			v = hist_value(i);
+			return (v > h->max ? h->max : v);
+		}
+	}
+	return (h->max);
+}
+
+
+static void
+hist_report(histogram *h, const char *what)
+{
+	double mean;
+	double stddev;
+
+	if (h->total == 0) {
+		return;
+	}
+	mean = h->sum / h->total;
+	stddev = (h->sumsq / h->total) - (mean * mean);
+	stddev = stddev > 0 ? sqrt(stddev) : 0;
+	printf("%s latency [us]: min %llu  mean %.1f  stddev %.1f\n", what,
+	    (unsigned long long) h->min, mean, stddev);
+	printf("  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  p99.99 %llu"
+	    "  max %llu\n",
+	    (unsigned long long) hist_percentile(h, 50.0),
+	    (unsigned long long) hist_percentile(h, 90.0),
+	    (unsigned long long) hist_percentile(h, 99.0),
+	    (unsigned long long) hist_percentile(h, 99.9),
+	    (unsigned long long) hist_percentile(h, 99.99),
+	    (unsigned long long) h->max);
+}
+
+
+static void
+hist_merge(histogram *h, const histogram *from)
+{
+	int i;
+
+	for (i = 0; i < HIST_NBUCKETS; i++) {
+		h->counts[i] += from->counts[i];
+	}
+	h->total += from->total;
+	h->sum += from->sum;
+	h->sumsq += from->sumsq;
+	if (from->min < h->min) {
+		h->min = from->min;
+	}
+	if (from->max > h->max) {
+		h->max = from->max;
+	}
+}
+
+
+// hist_dump writes the non-empty buckets, one per line, as the bucket's
+// upper value (usec), the count, and the cumulative fraction.
+static void
+hist_dump(histogram *h, const char *what, const char *path)
+{
+	FILE *f;
+	uint64_t seen = 0;
+	int i;
+
+	if (strcmp(path, "-") == 0) {
+		f = stdout;
+	} else if ((f = fopen(path, "a")) == NULL) {
+		die("Cannot open %s", path);
+	}
+	fprintf(f, "# %s: value_us count cumulative\n", what);
+	for (i = 0; i < HIST_NBUCKETS; i++) {
+		if (h->counts[i] == 0) {
+			continue;
+		}
+		seen += h->counts[i];
+		fprintf(f, "%llu %llu %.6f\n", (unsigned long long) hist_value(i),
+		    (unsigned long long) h->counts[i],
+		    (double) seen / (double) h->total);
+	}
+	if (f != stdout) {
+		fclose(f);
+	}
+}
+
+
+// parse_lat_opts consumes the latency client options, if any.
+static void
+parse_lat_opts(int *argcp, char ***argvp)
+{
+	int argc = *argcp;
+	char **argv = *argvp;
+
+	while ((argc >= 2) && (argv[0][0] == '-') && (argv[0][1] != '\0')) {
+		if (strcmp(argv[0], "-r") == 0) {
+			lat_rate = parse_int(argv[1], "rate");
+		} else if (strcmp(argv[0], "-d") == 0) {
+			lat_dump = argv[1];
+		} else if (strcmp(argv[0], "-b") == 0) {
+			lat_busypoll = parse_int(argv[1], "busy-poll time");
+		} else {
+			die("Unknown option %s", argv[0]);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	*argcp = argc;
+	*argvp = argv;
+}
+
+
 void
 do_local_lat(int argc, char **argv)
 {
 	long int msgsize;
 	long int trips;
 
+	parse_lat_opts(&argc, &argv);
 	if (argc != 3) {
-		die("Usage: local_lat <listen-addr> <msg-size> <roundtrips>");
+		die("Usage: local_lat [-b usec] <listen-addr> <msg-size> "
+		    "<roundtrips>");
 	}
 
 	msgsize = parse_int(argv[1], "message size");
@@ -142,8 +360,10 @@ do_remote_lat(int argc, char **argv)
 	int msgsize;
 	int trips;
 
+	parse_lat_opts(&argc, &argv);
 	if (argc != 3) {
-		die("Usage: remote_lat <connect-to> <msg-size> <roundtrips>");
+		die("Usage: remote_lat [-r rate] [-d file] [-b usec] <connect-to> "
+		    "<msg-size> <roundtrips>");
 	}
 
 	msgsize = parse_int(argv[1], "message size");
@@ -211,8 +431,10 @@ do_inproc_lat(int argc, char **argv)
 	int rv;
 
 	nni_init();
+	parse_lat_opts(&argc, &argv);
 	if (argc != 2) {
-		die("Usage: inproc_lat <msg-size> <count>");
+		die("Usage: inproc_lat [-r rate] [-d file] [-b usec] "
+		    "<msg-size> <count>");
 	}
 
 	ia.addr = "inproc://latency_test";
@@ -257,17 +479,73 @@ do_inproc_thr(int argc, char **argv)
 }
 
 
+// lat_endpoint creates an endpoint for the latency tests, dialing or
+// listening on it, with busy-polling set up first if it was asked for.
+static void
+lat_endpoint(nng_socket *s, const char *addr, int dial)
+{
+	nng_endpoint *ep;
+	int64_t spin = lat_busypoll;
+	int rv;
+	int i;
+
+	if (lat_busypoll > 0) {
+		rv = nng_setopt(s, NNG_OPT_BUSYPOLL, &spin, sizeof (spin));
+		if (rv != 0) {
+			die("nng_setopt(busypoll): %s", nng_strerror(rv));
+		}
+	}
+	if ((rv = nng_endpoint_create(&ep, s, addr)) != 0) {
+		die("nng_endpoint_create: %s", nng_strerror(rv));
+	}
+	if (lat_busypoll > 0) {
+		// Not every transport can do this; the socket still spins.
+		rv = nng_endpoint_setopt(ep, NNG_OPT_BUSYPOLL, &spin,
+		    sizeof (spin));
+		if ((rv != 0) && (rv != NNG_ENOTSUP)) {
+			die("nng_endpoint_setopt: %s", nng_strerror(rv));
+		}
+	}
+	if (dial) {
+		// The server may still be starting up (inproc_lat starts
+		// it in another thread), so give it a moment.
+		for (i = 0; i < 100; i++) {
+			rv = nng_endpoint_dial(ep, NNG_FLAG_SYNCH);
+			if (rv != NNG_ECONNREFUSED) {
+				break;
+			}
+			nni_usleep(10000);
+		}
+		if (rv != 0) {
+			die("nng_dial: %s", nng_strerror(rv));
+		}
+	} else if ((rv = nng_endpoint_listen(ep, NNG_FLAG_SYNCH)) != 0) {
+		die("nng_listen: %s", nng_strerror(rv));
+	}
+}
+
+
 void
 latency_client(const char *addr, int msgsize, int trips)
 {
 	nng_socket *s;
 	nng_msg *msg;
 	nni_time start, end;
+	nni_time sent, intended, now;
+	histogram *hist;
+	histogram *cohist;
 	int rv;
 	int i;
 	float total;
 	float latency;
 
+	if (((hist = malloc(sizeof (*hist))) == NULL) ||
+	    ((cohist = malloc(sizeof (*cohist))) == NULL)) {
+		die("Out of memory");
+	}
+	hist_init(hist);
+	hist_init(cohist);
+
 	if ((rv = nng_open(&s, NNG_PROTO_PAIR)) != 0) {
 		die("nng_socket: %s", nng_strerror(rv));
 	}
@@ -275,9 +553,7 @@ latency_client(const char *addr, int msgsize, int trips)
 	// XXX: set no delay
 	// XXX: other options (TLS in the future?, Linger?)
 
-	if ((rv = nng_dial(s, addr, NULL, NNG_FLAG_SYNCH)) != 0) {
-		die("nng_dial: %s", nng_strerror(rv));
-	}
+	lat_endpoint(s, addr, 1);
 
 	if (nng_msg_alloc(&msg, msgsize) != 0) {
 		die("nng_msg_alloc: %s", nng_strerror(rv));
@@ -285,6 +561,23 @@ latency_client(const char *addr, int msgsize, int trips)
 
 	start = nni_clock();
 	for (i = 0; i < trips; i++) {
+		// In fixed rate mode, wait for the intended send time.  If we
+		// are behind, we send immediately, but the time we were late
+		// by still counts against the corrected latency; that is the
+		// delay a real client sending at this rate would have seen.
+		intended = 0;
+		if (lat_rate > 0) {
+			intended = start + ((nni_time) i * 1000000) / lat_rate;
+			// Sleeping overshoots, so sleep only for the bulk
+			// of the wait and spin for the rest.
+			if ((now = nni_clock()) + 1000 < intended) {
+				nni_usleep(intended - now - 1000);
+			}
+			while (nni_clock() < intended) {
+				continue;
+			}
+		}
+		sent = nni_clock();
 		if ((rv = nng_sendmsg(s, msg, 0)) != 0) {
 			die("nng_sendmsg: %s", nng_strerror(rv));
 		}
@@ -292,6 +585,11 @@ latency_client(const char *addr, int msgsize, int trips)
 		if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
 			die("nng_recvmsg: %s", nng_strerror(rv));
 		}
+		now = nni_clock();
+		hist_record(hist, now - sent);
+		if (lat_rate > 0) {
+			hist_record(cohist, now - intended);
+		}
 	}
 	end = nni_clock();
 
@@ -304,6 +602,19 @@ latency_client(const char *addr, int msgsize, int trips)
 	printf("message size: %d [B]\n", msgsize);
 	printf("round trip count: %d\n", trips);
 	printf("average latency: %.3f [us]\n", latency);
+	hist_report(hist, "round trip");
+	if (lat_rate > 0) {
+		printf("request rate: %d [/s]\n", lat_rate);
+		hist_report(cohist, "corrected round trip");
+	}
+	if (lat_dump != NULL) {
+		hist_dump(hist, "round trip", lat_dump);
+		if (lat_rate > 0) {
+			hist_dump(cohist, "corrected round trip", lat_dump);
+		}
+	}
+	free(hist);
+	free(cohist);
 }
 
 
@@ -322,9 +633,7 @@ latency_server(const char *addr, int msgsize, int trips)
 	// XXX: set no delay
 	// XXX: other options (TLS in the future?, Linger?)
 
-	if ((rv = nng_listen(s, addr, NULL, NNG_FLAG_SYNCH)) != 0) {
-		die("nng_listen: %s", nng_strerror(rv));
-	}
+	lat_endpoint(s, addr, 0);
 
 	for (i = 0; i < trips; i++) {
 		if ((rv = nng_recvmsg(s, &msg, 0)) != 0) {
@@ -458,3 +767,449 @@ throughput_client(const char *addr, int msgsize, int count)
 	nni_usleep(100000);
 	nng_close(s);
 }
+
+
+// The load generator runs both sides in this process.  A single "server"
+// socket listens, and N client sockets (connections) dial it; the clients
+// are spread over T sender threads, and T receiver threads service the
+// server socket.  The clients are always the sending side:
+//
+// reqrep	REQ clients, raw REP server that echoes (round trip latency)
+// pubsub	PUB clients, SUB server
+// pipeline	PUSH clients, PULL server
+// bus		BUS clients, BUS server
+//
+// Each message carries the time it was (meant to be) sent, and the
+// index of the connection it was sent on, so that the receivers can
+// account latency and per-connection throughput.  For the one-way
+// patterns the clock is shared, as everything is in one process.
+//
+// With a rate (-r, total messages per second), each sender paces its
+// connections to a fixed schedule and latency is measured from the
+// intended send time, so that stalls are not hidden (open-loop).  Without
+// it, the senders go as fast as backpressure allows (closed-loop).
+
+#define LG_HDRSIZE	12
+
+typedef struct lg_conn {
+	nng_socket *	sock;
+	uint64_t	sent;
+	uint64_t	recvd;
+} lg_conn;
+
+typedef struct loadgen {
+	const char *	proto;
+	const char *	addr;
+	int		nconns;
+	int		nthreads;
+	int		msgsize;
+	int		rate;
+	int		secs;
+	int		verbose;
+	int		reqrep;
+	nng_socket *	server;
+	lg_conn *	conns;
+	nni_time	start;
+	nni_time	stop;
+} loadgen;
+
+typedef struct lg_thread {
+	loadgen *	lg;
+	int		id;
+	nni_thr		thr;
+	histogram *	hist;
+	uint64_t *	counts;         // per connection, receivers only
+} lg_thread;
+
+static void
+lg_sender(void *arg)
+{
+	lg_thread *t = arg;
+	loadgen *lg = t->lg;
+	nng_msg *msg;
+	nni_time now, intended, interval = 0;
+	uint64_t seq = 0;
+	uint64_t ts;
+	uint32_t idx;
+	int mine;
+	int rv;
+	int c;
+
+	mine = 0;
+	for (c = t->id; c < lg->nconns; c += lg->nthreads) {
+		mine++;
+	}
+	if ((mine == 0) || (lg->rate == 0)) {
+		interval = 0;
+	} else {
+		// This thread's share of the total rate.
+		interval = ((nni_time) 1000000 * lg->nconns) /
+		    ((nni_time) lg->rate * mine);
+	}
+
+	while ((now = nni_clock()) < lg->stop) {
+		for (c = t->id; c < lg->nconns; c += lg->nthreads) {
+			if (interval != 0) {
+				intended = lg->start + seq * interval;
+				if ((now = nni_clock()) + 1000 < intended) {
+					nni_usleep(intended - now - 1000);
+				}
+				while ((now = nni_clock()) < intended) {
+					continue;
+				}
+				ts = intended;
+			} else {
+				ts = nni_clock();
+			}
+			seq++;
+			if ((rv = nng_msg_alloc(&msg, lg->msgsize)) != 0) {
+				die("nng_msg_alloc: %s", nng_strerror(rv));
+			}
+			idx = (uint32_t) c;
+			memcpy(nng_msg_body(msg), &ts, sizeof (ts));
+			memcpy((char *) nng_msg_body(msg) + 8, &idx, sizeof (idx));
+			if ((rv = nng_sendmsg(lg->conns[c].sock, msg, 0)) != 0) {
+				// Timed out (backpressure); try again later.
+				nng_msg_free(msg);
+				continue;
+			}
+			lg->conns[c].sent++;
+		}
+		if (!lg->reqrep) {
+			continue;
+		}
+		for (c = t->id; c < lg->nconns; c += lg->nthreads) {
+			if (nng_recvmsg(lg->conns[c].sock, &msg, 0) != 0) {
+				continue;
+			}
+			now = nni_clock();
+			if (nng_msg_len(msg) >= LG_HDRSIZE) {
+				memcpy(&ts, nng_msg_body(msg), sizeof (ts));
+				hist_record(t->hist, now - ts);
+				lg->conns[c].recvd++;
+			}
+			nng_msg_free(msg);
+		}
+	}
+}
+
+
+static void
+lg_receiver(void *arg)
+{
+	lg_thread *t = arg;
+	loadgen *lg = t->lg;
+	nng_msg *msg;
+	nni_time now;
+	uint64_t ts;
+	uint32_t idx;
+	int rv;
+
+	// Keep going a little past the end, so that messages that are in
+	// flight are counted.
+	while (nni_clock() < (lg->stop + 200000)) {
+		if ((rv = nng_recvmsg(lg->server, &msg, 0)) != 0) {
+			if (rv == NNG_ETIMEDOUT) {
+				continue;
+			}
+			break;
+		}
+		if (lg->reqrep) {
+			// Raw REP; the backtrace is in the header.
+			if (nng_sendmsg(lg->server, msg, 0) != 0) {
+				nng_msg_free(msg);
+			}
+			continue;
+		}
+		now = nni_clock();
+		if (nng_msg_len(msg) >= LG_HDRSIZE) {
+			memcpy(&ts, nng_msg_body(msg), sizeof (ts));
+			memcpy(&idx, (char *) nng_msg_body(msg) + 8, sizeof (idx));
+			hist_record(t->hist, now > ts ? now - ts : 0);
+			if (idx < (uint32_t) lg->nconns) {
+				t->counts[idx]++;
+			}
+		}
+		nng_msg_free(msg);
+	}
+}
+
+
+static void
+lg_setup(loadgen *lg)
+{
+	uint16_t sproto, cproto;
+	uint64_t tmo;
+	int raw = 1;
+	int rv;
+	int c;
+
+	if (strcmp(lg->proto, "reqrep") == 0) {
+		sproto = NNG_PROTO_REP;
+		cproto = NNG_PROTO_REQ;
+		lg->reqrep = 1;
+	} else if (strcmp(lg->proto, "pubsub") == 0) {
+		sproto = NNG_PROTO_SUB;
+		cproto = NNG_PROTO_PUB;
+	} else if (strcmp(lg->proto, "pipeline") == 0) {
+		sproto = NNG_PROTO_PULL;
+		cproto = NNG_PROTO_PUSH;
+	} else if (strcmp(lg->proto, "bus") == 0) {
+		sproto = NNG_PROTO_BUS;
+		cproto = NNG_PROTO_BUS;
+	} else {
+		die("Unknown protocol %s", lg->proto);
+	}
+
+	if ((rv = nng_open(&lg->server, sproto)) != 0) {
+		die("nng_open: %s", nng_strerror(rv));
+	}
+	tmo = 100000;
+	if (((rv = nng_setopt(lg->server, NNG_OPT_RCVTIMEO, &tmo,
+	    sizeof (tmo))) != 0) ||
+	    ((rv = nng_setopt(lg->server, NNG_OPT_SNDTIMEO, &tmo,
+	    sizeof (tmo))) != 0)) {
+		die("nng_setopt: %s", nng_strerror(rv));
+	}
+	if (lg->reqrep) {
+		// Raw mode, so that many requests can be serviced at once.
+		rv = nng_setopt(lg->server, NNG_OPT_RAW, &raw, sizeof (raw));
+		if (rv != 0) {
+			die("nng_setopt(NNG_OPT_RAW): %s", nng_strerror(rv));
+		}
+	}
+	if (sproto == NNG_PROTO_SUB) {
+		rv = nng_setopt(lg->server, NNG_OPT_SUBSCRIBE, "", 0);
+		if (rv != 0) {
+			die("nng_setopt(NNG_OPT_SUBSCRIBE): %s",
+			    nng_strerror(rv));
+		}
+	}
+	if ((rv = nng_listen(lg->server, lg->addr, NULL, NNG_FLAG_SYNCH)) != 0) {
+		die("nng_listen: %s", nng_strerror(rv));
+	}
+
+	if ((lg->conns = calloc(lg->nconns, sizeof (lg_conn))) == NULL) {
+		die("Out of memory");
+	}
+	for (c = 0; c < lg->nconns; c++) {
+		nng_socket *s;
+
+		if ((rv = nng_open(&s, cproto)) != 0) {
+			die("nng_open: %s", nng_strerror(rv));
+		}
+		tmo = 100000;
+		(void) nng_setopt(s, NNG_OPT_SNDTIMEO, &tmo, sizeof (tmo));
+		tmo = 1000000;
+		(void) nng_setopt(s, NNG_OPT_RCVTIMEO, &tmo, sizeof (tmo));
+		if ((rv = nng_dial(s, lg->addr, NULL, NNG_FLAG_SYNCH)) != 0) {
+			die("nng_dial: %s", nng_strerror(rv));
+		}
+		lg->conns[c].sock = s;
+	}
+}
+
+
+static void
+lg_report(loadgen *lg, histogram *hist, uint64_t *counts, nni_duration wall)
+{
+	uint64_t sent = 0;
+	uint64_t recvd = 0;
+	double secs = wall / 1000000.0;
+	double rate, minrate = 0, maxrate = 0;
+	int c;
+
+	for (c = 0; c < lg->nconns; c++) {
+		sent += lg->conns[c].sent;
+		recvd += counts[c];
+		rate = counts[c] / secs;
+		if ((c == 0) || (rate < minrate)) {
+			minrate = rate;
+		}
+		if ((c == 0) || (rate > maxrate)) {
+			maxrate = rate;
+		}
+	}
+	printf("protocol: %s\n", lg->proto);
+	printf("address: %s\n", lg->addr);
+	printf("connections: %d  threads: %d\n", lg->nconns, lg->nthreads);
+	printf("message size: %d [B]\n", lg->msgsize);
+	if (lg->rate > 0) {
+		printf("offered rate: %d [msg/s] (open loop)\n", lg->rate);
+	} else {
+		printf("offered rate: unlimited (closed loop)\n");
+	}
+	printf("duration: %.3f [s]\n", secs);
+	printf("sent: %llu [msg]  %.f [msg/s]\n", (unsigned long long) sent,
+	    sent / secs);
+	printf("received: %llu [msg]  %.f [msg/s]  %.3f [Mb/s]\n",
+	    (unsigned long long) recvd, recvd / secs,
+	    (recvd * 8.0 * lg->msgsize) / (secs * 1000000.0));
+	printf("per connection: min %.f  mean %.f  max %.f [msg/s]\n",
+	    minrate, (recvd / secs) / lg->nconns, maxrate);
+	hist_report(hist, lg->reqrep ? "round trip" : "one way");
+	if (lg->verbose) {
+		for (c = 0; c < lg->nconns; c++) {
+			printf("  conn %d: sent %llu  received %llu  "
+			    "%.f [msg/s]\n", c,
+			    (unsigned long long) lg->conns[c].sent,
+			    (unsigned long long) counts[c], counts[c] / secs);
+		}
+	}
+}
+
+
+void
+do_loadgen(int argc, char **argv)
+{
+	loadgen lg;
+	lg_thread *senders;
+	lg_thread *receivers;
+	histogram *hist;
+	uint64_t *counts;
+	nni_time end;
+	int rv;
+	int i;
+	int c;
+
+	memset(&lg, 0, sizeof (lg));
+	lg.proto = "pipeline";
+	lg.addr = "inproc://loadgen";
+	lg.nconns = 16;
+	lg.nthreads = 4;
+	lg.msgsize = 64;
+	lg.secs = 5;
+
+	while ((argc > 0) && (argv[0][0] == '-')) {
+		if (strcmp(argv[0], "-v") == 0) {
+			lg.verbose = 1;
+			argc--;
+			argv++;
+			continue;
+		}
+		if (argc < 2) {
+			break;
+		}
+		if (strcmp(argv[0], "-p") == 0) {
+			lg.proto = argv[1];
+		} else if (strcmp(argv[0], "-c") == 0) {
+			lg.nconns = parse_int(argv[1], "connection count");
+		} else if (strcmp(argv[0], "-t") == 0) {
+			lg.nthreads = parse_int(argv[1], "thread count");
+		} else if (strcmp(argv[0], "-s") == 0) {
+			lg.msgsize = parse_int(argv[1], "message size");
+		} else if (strcmp(argv[0], "-r") == 0) {
+			lg.rate = parse_int(argv[1], "rate");
+		} else if (strcmp(argv[0], "-d") == 0) {
+			lg.secs = parse_int(argv[1], "duration");
+		} else {
+			die("Unknown option %s", argv[0]);
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc == 1) {
+		lg.addr = argv[0];
+	} else if (argc != 0) {
+		die("Usage: loadgen [-p reqrep|pubsub|pipeline|bus] [-c conns] "
+		    "[-t threads] [-s msg-size] [-r rate] [-d secs] [-v] "
+		    "[<addr>]");
+	}
+	if ((lg.nconns < 1) || (lg.nthreads < 1) || (lg.secs < 1)) {
+		die("Invalid arguments");
+	}
+	if (lg.nthreads > lg.nconns) {
+		lg.nthreads = lg.nconns;
+	}
+	if (lg.msgsize < LG_HDRSIZE) {
+		lg.msgsize = LG_HDRSIZE;
+	}
+
+	nni_init();
+	lg_setup(&lg);
+
+	senders = calloc(lg.nthreads, sizeof (lg_thread));
+	receivers = calloc(lg.nthreads, sizeof (lg_thread));
+	if ((senders == NULL) || (receivers == NULL)) {
+		die("Out of memory");
+	}
+
+	lg.start = nni_clock();
+	lg.stop = lg.start + ((nni_time) lg.secs * 1000000);
+	for (i = 0; i < lg.nthreads; i++) {
+		lg_thread *t;
+
+		t = &senders[i];
+		t->lg = &lg;
+		t->id = i;
+		if ((t->hist = malloc(sizeof (histogram))) == NULL) {
+			die("Out of memory");
+		}
+		hist_init(t->hist);
+		if ((rv = nni_thr_init(&t->thr, lg_sender, t)) != 0) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+
+		t = &receivers[i];
+		t->lg = &lg;
+		t->id = i;
+		if (((t->hist = malloc(sizeof (histogram))) == NULL) ||
+		    ((t->counts = calloc(lg.nconns, sizeof (uint64_t))) ==
+		    NULL)) {
+			die("Out of memory");
+		}
+		hist_init(t->hist);
+		if ((rv = nni_thr_init(&t->thr, lg_receiver, t)) != 0) {
+			die("Cannot create thread: %s", nng_strerror(rv));
+		}
+	}
+	for (i = 0; i < lg.nthreads; i++) {
+		nni_thr_run(&receivers[i].thr);
+		nni_thr_run(&senders[i].thr);
+	}
+	for (i = 0; i < lg.nthreads; i++) {
+		nni_thr_fini(&senders[i].thr);
+	}
+	end = nni_clock();
+	for (i = 0; i < lg.nthreads; i++) {
+		nni_thr_fini(&receivers[i].thr);
+	}
+
+	if (((hist = malloc(sizeof (*hist))) == NULL) ||
+	    ((counts = calloc(lg.nconns, sizeof (uint64_t))) == NULL)) {
+		die("Out of memory");
+	}
+	hist_init(hist);
+	for (i = 0; i < lg.nthreads; i++) {
+		if (lg.reqrep) {
+			hist_merge(hist, senders[i].hist);
+		} else {
+			hist_merge(hist, receivers[i].hist);
+			for (c = 0; c < lg.nconns; c++) {
+				counts[c] += receivers[i].counts[c];
+			}
+		}
+	}
+	if (lg.reqrep) {
+		for (c = 0; c < lg.nconns; c++) {
+			counts[c] = lg.conns[c].recvd;
+		}
+	}
+
+	lg_report(&lg, hist, counts, end - lg.start);
+
+	for (c = 0; c < lg.nconns; c++) {
+		nng_close(lg.conns[c].sock);
+	}
+	nng_close(lg.server);
+	for (i = 0; i < lg.nthreads; i++) {
+		free(senders[i].hist);
+		free(receivers[i].hist);
+		free(receivers[i].counts);
+	}
+	free(senders);
+	free(receivers);
+	free(lg.conns);
+	free(hist);
+	free(counts);
+}
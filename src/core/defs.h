@@ -57,6 +57,9 @@ typedef struct {
 // Maximum number of socket or pipe worker threads.
 #define NNI_MAXWORKERS    4
 
+// Maximum number of CPUs that can be named in an affinity mask.
+#define NNI_MAXCPUS       1024
+
 #define NNI_PUT16(ptr, u)				      \
 	do {						      \
 		(ptr)[0] = (uint8_t) (((uint16_t) (u)) >> 8); \
@@ -108,5 +111,6 @@ typedef struct {
 
 // A few assorted other items.
 #define NNI_FLAG_IPV4ONLY    1
+#define NNI_FLAG_REUSEPORT   2
 
 #endif  // CORE_DEFS_H
@@ -44,7 +44,7 @@ nni_ep_create(nni_ep **epp, nni_sock *sock, const char *addr)
 	ep->ep_ops = *tran->tran_ep;
 	NNI_LIST_NODE_INIT(&ep->ep_node);
 
-	if ((rv = nni_cv_init(&ep->ep_cv, &ep->ep_sock->s_mx)) != 0) {
+	if ((rv = nni_cv_init(&ep->ep_cv, &ep->ep_sock->s_ep_mx)) != 0) {
 		NNI_FREE_STRUCT(ep);
 		return (NNG_ENOMEM);
 	}
@@ -64,16 +64,18 @@ nni_ep_create(nni_ep **epp, nni_sock *sock, const char *addr)
 }
 
 
-void
-nni_ep_close(nni_ep *ep)
+// nni_ep_shutdown stops the endpoint and releases its transport state.
+// It returns 0 if the endpoint was already closed.
+static int
+nni_ep_shutdown(nni_ep *ep)
 {
 	nni_pipe *pipe;
-	nni_mtx *mx = &ep->ep_sock->s_mx;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
 
 	nni_mtx_lock(mx);
 	if (ep->ep_close) {
 		nni_mtx_unlock(mx);
-		return;
+		return (0);
 	}
 	ep->ep_close = 1;
 	ep->ep_ops.ep_close(ep->ep_data);
@@ -90,7 +92,33 @@ nni_ep_close(nni_ep *ep)
 	}
 
 	ep->ep_ops.ep_fini(ep->ep_data);
+	return (1);
+}
 
+
+void
+nni_ep_close(nni_ep *ep)
+{
+	if (!nni_ep_shutdown(ep)) {
+		return;
+	}
+
+	// The application may still hold the endpoint, and use it, so it
+	// is only freed along with the socket; until then, it just
+	// reports that it is closed.
+	nni_mtx_lock(&ep->ep_sock->s_ep_mx);
+	nni_list_append(&ep->ep_sock->s_eps_closed, ep);
+	nni_mtx_unlock(&ep->ep_sock->s_ep_mx);
+}
+
+
+// nni_ep_destroy closes and frees an endpoint.  This is only safe when
+// nobody else can hold it: on the socket's own failure paths, before
+// the endpoint is handed out, or as the socket itself is being closed.
+void
+nni_ep_destroy(nni_ep *ep)
+{
+	(void) nni_ep_shutdown(ep);
 	nni_cv_fini(&ep->ep_cv);
 	NNI_FREE_STRUCT(ep);
 }
@@ -110,8 +138,10 @@ nni_ep_connect(nni_ep *ep, nni_pipe **pp)
 		nni_pipe_destroy(pipe);
 		return (rv);
 	}
+	nni_mtx_lock(&ep->ep_sock->s_ep_mx);
 	ep->ep_pipe = pipe;
 	pipe->p_ep = ep;
+	nni_mtx_unlock(&ep->ep_sock->s_ep_mx);
 	*pp = pipe;
 	return (0);
 }
@@ -142,7 +172,7 @@ nni_dialer(void *arg)
 	nni_pipe *pipe;
 	int rv;
 	nni_time cooldown;
-	nni_mtx *mx = &ep->ep_sock->s_mx;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
 
 	for (;;) {
 		nni_mtx_lock(mx);
@@ -193,7 +223,7 @@ int
 nni_ep_dial(nni_ep *ep, int flags)
 {
 	int rv = 0;
-	nni_mtx *mx = &ep->ep_sock->s_mx;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
 
 	nni_mtx_lock(mx);
 	if (ep->ep_mode != NNI_EP_MODE_IDLE) {
@@ -222,6 +252,9 @@ nni_ep_dial(nni_ep *ep, int flags)
 		nni_mtx_lock(mx);
 	}
 
+	nni_mtx_lock(nni_sock_mtx(ep->ep_sock));
+	nni_sock_bindthr(ep->ep_sock, &ep->ep_thr);
+	nni_mtx_unlock(nni_sock_mtx(ep->ep_sock));
 	nni_thr_run(&ep->ep_thr);
 	nni_mtx_unlock(mx);
 
@@ -257,7 +290,7 @@ nni_listener(void *arg)
 	nni_ep *ep = arg;
 	nni_pipe *pipe;
 	int rv;
-	nni_mtx *mx = &ep->ep_sock->s_mx;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
 
 	for (;;) {
 		nni_time cooldown;
@@ -325,7 +358,7 @@ int
 nni_ep_listen(nni_ep *ep, int flags)
 {
 	int rv = 0;
-	nni_mtx *mx = &ep->ep_sock->s_mx;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
 
 	nni_mtx_lock(mx);
 	if (ep->ep_mode != NNI_EP_MODE_IDLE) {
@@ -357,8 +390,55 @@ nni_ep_listen(nni_ep *ep, int flags)
 		ep->ep_bound = 1;
 	}
 
+	nni_mtx_lock(nni_sock_mtx(ep->ep_sock));
+	nni_sock_bindthr(ep->ep_sock, &ep->ep_thr);
+	nni_mtx_unlock(nni_sock_mtx(ep->ep_sock));
 	nni_thr_run(&ep->ep_thr);
 	nni_mtx_unlock(mx);
 
 	return (0);
 }
+
+
+// nni_ep_setopt sets a transport specific option.  Options may only be
+// changed before the endpoint is started.
+int
+nni_ep_setopt(nni_ep *ep, int opt, const void *val, size_t sz)
+{
+	int rv;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
+
+	if (ep->ep_ops.ep_setopt == NULL) {
+		return (NNG_ENOTSUP);
+	}
+	nni_mtx_lock(mx);
+	if (ep->ep_close) {
+		rv = NNG_ECLOSED;
+	} else if (ep->ep_mode != NNI_EP_MODE_IDLE) {
+		rv = NNG_EBUSY;
+	} else {
+		rv = ep->ep_ops.ep_setopt(ep->ep_data, opt, val, sz);
+	}
+	nni_mtx_unlock(mx);
+	return (rv);
+}
+
+
+int
+nni_ep_getopt(nni_ep *ep, int opt, void *val, size_t *szp)
+{
+	int rv;
+	nni_mtx *mx = &ep->ep_sock->s_ep_mx;
+
+	if (ep->ep_ops.ep_getopt == NULL) {
+		return (NNG_ENOTSUP);
+	}
+	nni_mtx_lock(mx);
+	if (ep->ep_close) {
+		rv = NNG_ECLOSED;
+	} else {
+		rv = ep->ep_ops.ep_getopt(ep->ep_data, opt, val, szp);
+	}
+	nni_mtx_unlock(mx);
+	return (rv);
+}
@@ -37,7 +37,10 @@ struct nng_endpoint {
 extern int nni_ep_create(nni_ep **, nni_sock *, const char *);
 extern int nni_ep_accept(nni_ep *, nni_pipe **);
 extern void nni_ep_close(nni_ep *);
+extern void nni_ep_destroy(nni_ep *);
 extern int nni_ep_dial(nni_ep *, int);
 extern int nni_ep_listen(nni_ep *, int);
+extern int nni_ep_setopt(nni_ep *, int, const void *, size_t);
+extern int nni_ep_getopt(nni_ep *, int, void *, size_t *);
 
 #endif // CORE_ENDPT_H
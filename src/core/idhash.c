@@ -11,26 +11,56 @@
 
 #include <string.h>
 
+// Lookups are guarded by a sequence lock.  A writer makes ih_seq odd
+// while it moves entries around, and even again when it is done; a
+// reader that saw it odd, or saw it change, looks again.
+//
+// When the table is replaced by a larger or smaller one, the old one may
+// only be freed once no reader is looking at it.  Each replacement bumps
+// ih_gen, and readers count themselves in the ih_readers slot for the
+// generation they are reading.  So the writer only waits for readers that
+// were already in the old table, which are brief and never block; readers
+// that come later are counted in the other slot, and cannot hold it up.
+//
+// Without atomic operations, none of this is safe, so lookups take a
+// lock of the table's own instead, which every change also takes.
+
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+#define NNI_IDHASH_BARRIER()	__sync_synchronize()
+#define NNI_IDHASH_ENTER(h, g)	\
+	(void) __sync_add_and_fetch(&(h)->ih_readers[(g) & 1], 1)
+#define NNI_IDHASH_LEAVE(h, g)	\
+	(void) __sync_sub_and_fetch(&(h)->ih_readers[(g) & 1], 1)
+#endif
+
 typedef struct {
 	uint32_t	ihe_key;
-	uint32_t	ihe_skips;
-	void *		ihe_val;
+	uint32_t	ihe_dist;       // distance from home slot
+	void *		ihe_val;        // NULL if the slot is empty
 } nni_idhash_entry;
 
 struct nni_idhash {
 	uint32_t		ih_cap;
 	uint32_t		ih_count;
-	uint32_t		ih_load;
-	uint32_t		ih_minload; // considers placeholders
+	uint32_t		ih_minload;
 	uint32_t		ih_maxload;
-	uint32_t		ih_walkers;
 	nni_idhash_entry *	ih_entries;
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	volatile uint32_t	ih_seq;
+	volatile uint32_t	ih_gen;
+	volatile uint32_t	ih_readers[2];
+#else
+	nni_mtx			ih_mx;
+#endif
 };
 
 int
 nni_idhash_create(nni_idhash **hp)
 {
 	nni_idhash *h;
+#ifndef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	int rv;
+#endif
 
 	if ((h = NNI_ALLOC_STRUCT(h)) == NULL) {
 		return (NNG_ENOMEM);
@@ -40,13 +70,24 @@ nni_idhash_create(nni_idhash **hp)
 		NNI_FREE_STRUCT(h);
 		return (NNG_ENOMEM);
 	}
+#ifndef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	if ((rv = nni_mtx_init(&h->ih_mx)) != 0) {
+		nni_free(h->ih_entries, 8 * sizeof (nni_idhash_entry));
+		NNI_FREE_STRUCT(h);
+		return (rv);
+	}
+#endif
 	(void) memset(h->ih_entries, 0, (8 * sizeof (nni_idhash_entry)));
 	h->ih_count = 0;
-	h->ih_load = 0;
 	h->ih_cap = 8;
-	h->ih_maxload = 5;
+	h->ih_maxload = 6;
 	h->ih_minload = 0; // never shrink below this
-	h->ih_walkers = 0;
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	h->ih_seq = 0;
+	h->ih_gen = 0;
+	h->ih_readers[0] = 0;
+	h->ih_readers[1] = 0;
+#endif
 	*hp = h;
 	return (0);
 }
@@ -55,31 +96,150 @@ nni_idhash_create(nni_idhash **hp)
 void
 nni_idhash_destroy(nni_idhash *h)
 {
+#ifndef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	nni_mtx_fini(&h->ih_mx);
+#endif
 	nni_free(h->ih_entries, h->ih_cap * sizeof (nni_idhash_entry));
 	NNI_FREE_STRUCT(h);
 }
 
 
-// Inspired by Python dict implementation.  This probe will visit every
-// cell.  We always hash consecutively assigned IDs.
-#define NNI_IDHASH_NEXTPROBE(h, j) \
-	((((j) * 5) + 1) & (h->ih_cap - 1))
+#define NNI_IDHASH_HOME(cap, id)	((id) & ((cap) - 1))
+#define NNI_IDHASH_NEXT(cap, j)		(((j) + 1) & ((cap) - 1))
+
+// nni_idhash_begin and nni_idhash_end bracket any change that a
+// concurrent lookup might otherwise see half done.
+static void
+nni_idhash_begin(nni_idhash *h)
+{
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	h->ih_seq++;
+	NNI_IDHASH_BARRIER();
+#else
+	nni_mtx_lock(&h->ih_mx);
+#endif
+}
+
+
+static void
+nni_idhash_end(nni_idhash *h)
+{
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	NNI_IDHASH_BARRIER();
+	h->ih_seq++;
+#else
+	nni_mtx_unlock(&h->ih_mx);
+#endif
+}
+
+
+// nni_idhash_index returns the slot holding id, or -1.  Because entries
+// are kept in order of their distance from home, the search can stop as
+// soon as it meets an entry closer to home than it is itself.
+static int
+nni_idhash_index(nni_idhash_entry *ents, uint32_t cap, uint32_t id)
+{
+	uint32_t index = NNI_IDHASH_HOME(cap, id);
+	uint32_t dist;
+
+	for (dist = 0; dist < cap; dist++) {
+		nni_idhash_entry *ent = &ents[index];
+
+		if ((ent->ihe_val == NULL) || (ent->ihe_dist < dist)) {
+			break;
+		}
+		if (ent->ihe_key == id) {
+			return ((int) index);
+		}
+		index = NNI_IDHASH_NEXT(cap, index);
+	}
+	return (-1);
+}
+
 
 int
 nni_idhash_find(nni_idhash *h, uint32_t id, void **valp)
 {
-	uint32_t index = id & (h->ih_cap - 1);
+	void *val;
+	int index;
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	nni_idhash_entry *ents;
+	uint32_t cap;
+	uint32_t seq;
+	uint32_t gen;
 
 	for (;;) {
-		if ((h->ih_entries[index].ihe_val == NULL) &&
-		    (h->ih_entries[index].ihe_skips == 0)) {
-			return (NNG_ENOENT);
+		if ((seq = h->ih_seq) & 1) {
+			continue;
+		}
+		NNI_IDHASH_BARRIER();
+		gen = h->ih_gen;
+		NNI_IDHASH_ENTER(h, gen);
+		ents = h->ih_entries;
+		cap = h->ih_cap;
+
+		// The table and its size must belong together, and to the
+		// generation we are counted in, before we dare to index it.
+		NNI_IDHASH_BARRIER();
+		if ((h->ih_seq != seq) || (h->ih_gen != gen)) {
+			NNI_IDHASH_LEAVE(h, gen);
+			continue;
+		}
+		val = NULL;
+		if ((index = nni_idhash_index(ents, cap, id)) >= 0) {
+			val = ents[index].ihe_val;
 		}
-		if (h->ih_entries[index].ihe_key == id) {
-			*valp = h->ih_entries[index].ihe_val;
-			return (0);
+		NNI_IDHASH_BARRIER();
+		NNI_IDHASH_LEAVE(h, gen);
+		if (h->ih_seq == seq) {
+			break;
 		}
-		index = NNI_IDHASH_NEXTPROBE(h, index);
+	}
+#else
+	nni_mtx_lock(&h->ih_mx);
+	val = NULL;
+	if ((index = nni_idhash_index(h->ih_entries, h->ih_cap, id)) >= 0) {
+		val = h->ih_entries[index].ihe_val;
+	}
+	nni_mtx_unlock(&h->ih_mx);
+#endif
+
+	if (val == NULL) {
+		return (NNG_ENOENT);
+	}
+	*valp = val;
+	return (0);
+}
+
+
+// nni_idhash_place puts an entry known not to be present into the table,
+// using robin hood insertion: whenever the entry being placed is further
+// from home than the one occupying a slot, they trade places.
+static void
+nni_idhash_place(nni_idhash_entry *ents, uint32_t cap, uint32_t id,
+    void *val)
+{
+	nni_idhash_entry ent;
+	nni_idhash_entry tmp;
+	uint32_t index;
+
+	ent.ihe_key = id;
+	ent.ihe_val = val;
+	ent.ihe_dist = 0;
+	index = NNI_IDHASH_HOME(cap, id);
+
+	for (;;) {
+		if (ents[index].ihe_val == NULL) {
+			ents[index] = ent;
+			return;
+		}
+		if (ents[index].ihe_dist < ent.ihe_dist) {
+			tmp = ents[index];
+			ents[index] = ent;
+			ent = tmp;
+		}
+		ent.ihe_dist++;
+		index = NNI_IDHASH_NEXT(cap, index);
 	}
 }
 
@@ -91,25 +251,24 @@ nni_hash_resize(nni_idhash *h)
 	uint32_t oldsize;
 	nni_idhash_entry *newents;
 	nni_idhash_entry *oldents;
-	int i;
+	uint32_t i;
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	uint32_t gen;
+#endif
 
-	if ((h->ih_load < h->ih_maxload) && (h->ih_load >= h->ih_minload)) {
+	if ((h->ih_count < h->ih_maxload) && (h->ih_count >= h->ih_minload)) {
 		// No resize needed.
 		return (0);
 	}
-	if (h->ih_walkers && (h->ih_load < (h->ih_cap-1))) {
-		// Don't resize when walkers are running.  This way
-		// walk functions can remove hash nodes.
-		return (0);
-	}
 
 	oldsize = h->ih_cap;
-	newsize = h->ih_cap;
-
 	newsize = 8;
 	while (newsize < (h->ih_count * 2)) {
 		newsize *= 2;
 	}
+	if (newsize == oldsize) {
+		return (0);
+	}
 
 	oldents = h->ih_entries;
 	newents = nni_alloc(sizeof (nni_idhash_entry) * newsize);
@@ -117,33 +276,38 @@ nni_hash_resize(nni_idhash *h)
 		return (NNG_ENOMEM);
 	}
 	memset(newents, 0, sizeof (nni_idhash_entry) * newsize);
+	for (i = 0; i < oldsize; i++) {
+		if (oldents[i].ihe_val != NULL) {
+			nni_idhash_place(newents, newsize, oldents[i].ihe_key,
+			    oldents[i].ihe_val);
+		}
+	}
 
+	nni_idhash_begin(h);
 	h->ih_entries = newents;
 	h->ih_cap = newsize;
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	gen = h->ih_gen++;
+#endif
+	nni_idhash_end(h);
+
 	if (newsize > 8) {
 		h->ih_minload = newsize / 8;
-		h->ih_maxload = newsize * 2 / 3;
+		h->ih_maxload = newsize * 3 / 4;
 	} else {
 		h->ih_minload = 0;
-		h->ih_maxload = 5;
+		h->ih_maxload = 6;
 	}
-	for (i = 0; i < oldsize; i++) {
-		uint32_t index;
-		if (oldents[i].ihe_val == NULL) {
-			continue;
-		}
-		index = oldents[i].ihe_key & (newsize - 1);
-		for (;;) {
-			if (newents[index].ihe_val == NULL) {
-				h->ih_load++;
-				newents[index].ihe_val = oldents[i].ihe_val;
-				newents[index].ihe_key = oldents[i].ihe_key;
-				break;
-			}
-			newents[index].ihe_skips++;
-			index = NNI_IDHASH_NEXTPROBE(h, index);
-		}
+
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+	// Lookups that started before the switch may still be reading the
+	// old table.  They are brief, and never block, and no new ones
+	// can join them, so just wait them out.
+	NNI_IDHASH_BARRIER();
+	while (h->ih_readers[gen & 1] != 0) {
+		nni_usleep(0);
 	}
+#endif
 	nni_free(oldents, sizeof (nni_idhash_entry) * oldsize);
 	return (0);
 }
@@ -152,38 +316,34 @@ nni_hash_resize(nni_idhash *h)
 int
 nni_idhash_remove(nni_idhash *h, uint32_t id)
 {
-	int rv;
-	void *val;
+	nni_idhash_entry *ents = h->ih_entries;
+	uint32_t cap = h->ih_cap;
 	uint32_t index;
+	uint32_t next;
+	int i;
 
-	// First check that it is in the table.  This may double the
-	// lookup time, but it means that if we get past this then we KNOW
-	// we are going to delete an element.
-	if ((rv = nni_idhash_find(h, id, &val)) != 0) {
-		return (rv);
+	if ((i = nni_idhash_index(ents, cap, id)) < 0) {
+		return (NNG_ENOENT);
 	}
+	index = (uint32_t) i;
 
-	index = id & (h->ih_cap - 1);
-
+	// Shift the entries that follow back by one, until we reach one
+	// that is already home, or an empty slot.
+	nni_idhash_begin(h);
 	for (;;) {
-		nni_idhash_entry *ent = &h->ih_entries[index];
-		if (ent->ihe_key == id) {
-			ent->ihe_val = NULL;
-			if (ent->ihe_skips == 0) {
-				h->ih_load--;
-			}
-			h->ih_count--;
+		next = NNI_IDHASH_NEXT(cap, index);
+		if ((ents[next].ihe_val == NULL) ||
+		    (ents[next].ihe_dist == 0)) {
 			break;
 		}
-		if (ent->ihe_skips < 1) {
-			nni_panic("Skips should be nonzero!");
-		}
-		ent->ihe_skips--;
-		if ((ent->ihe_skips == 0) && (ent->ihe_val == NULL)) {
-			h->ih_load--;
-		}
-		index = NNI_IDHASH_NEXTPROBE(h, index);
+		ents[index] = ents[next];
+		ents[index].ihe_dist--;
+		index = next;
 	}
+	ents[index].ihe_val = NULL;
+	ents[index].ihe_dist = 0;
+	nni_idhash_end(h);
+	h->ih_count--;
 
 	// Shrink -- but it's ok if we can't.
 	(void) nni_hash_resize(h);
@@ -195,28 +355,25 @@ nni_idhash_remove(nni_idhash *h, uint32_t id)
 int
 nni_idhash_insert(nni_idhash *h, uint32_t id, void *val)
 {
-	uint32_t index;
+	int index;
+
+	if ((index = nni_idhash_index(h->ih_entries, h->ih_cap, id)) >= 0) {
+		nni_idhash_begin(h);
+		h->ih_entries[index].ihe_val = val;
+		nni_idhash_end(h);
+		return (0);
+	}
 
 	// Try to resize.  If we can't, but we still have room, go ahead
 	// and store it.
 	if ((nni_hash_resize(h) != 0) && (h->ih_count >= (h->ih_cap - 1))) {
 		return (NNG_ENOMEM);
 	}
-	index = id & (h->ih_cap - 1);
-	for (;;) {
-		nni_idhash_entry *ent = &h->ih_entries[index];
-		if ((ent->ihe_val == NULL) || (ent->ihe_key == id)) {
-			if (ent->ihe_val == NULL) {
-				h->ih_count++;
-				h->ih_load++;
-			}
-			ent->ihe_key = id;
-			ent->ihe_val = val;
-			return (0);
-		}
-		ent->ihe_skips++;
-		index = NNI_IDHASH_NEXTPROBE(h, index);
-	}
+	nni_idhash_begin(h);
+	nni_idhash_place(h->ih_entries, h->ih_cap, id, val);
+	nni_idhash_end(h);
+	h->ih_count++;
+	return (0);
 }
 
 
@@ -231,7 +388,8 @@ nni_idhash_count(nni_idhash *h, uint32_t *countp)
 int
 nni_idhash_walk(nni_idhash *h, nni_idhash_walkfn fn, void *arg)
 {
-	int i, rv;
+	uint32_t i;
+	int rv;
 
 	for (i = 0; i < h->ih_cap; i++) {
 		nni_idhash_entry *ent = &h->ih_entries[i];
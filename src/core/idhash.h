@@ -16,12 +16,23 @@
 // numeric ID, which is generally monotonically increasing.  This is
 // most often a pipe ID.  To help keep collections of these things
 // indexed by their ID (which might start from a very large value),
-// we offer a hash table.  The hash table uses open addressing, but
-// we use a better probe (taken from Python) to avoid hitting the same
-// positions.  Our hash algorithm is just the low order bits, and we
-// use table sizes that are powers of two.  Note that hash items
-// must be non-NULL.  The caller is responsible for providing any
-// locking required.
+// we offer a hash table.  The hash table uses open addressing with
+// linear probing, and robin hood insertion, so that no entry is ever
+// much further from its home slot than any other.  Removal shifts the
+// entries that follow back into place, so there are no tombstones,
+// and churn does not make the probes any longer.  Our hash algorithm
+// is just the low order bits, and we use table sizes that are powers
+// of two.  Note that hash items must be non-NULL.
+//
+// The caller is responsible for providing any locking required for
+// insert, remove, and walk; only one of those may run at a time.
+// nni_idhash_find may however be called without that lock, concurrently
+// with a modification, in which case it retries until it gets a
+// consistent view.  (The caller must still make sure that what it finds
+// is not destroyed out from under it.)  Without atomic operations on
+// the platform, nni_idhash_find takes a lock of the table's own, which
+// changes also take, so it is still safe to call unlocked, but it may
+// then wait for a change to finish.
 
 typedef struct nni_idhash   nni_idhash;
 
@@ -30,6 +41,7 @@ typedef struct nni_idhash   nni_idhash;
 // process and return that return value.  The function takes the generic
 // opaque value for the walk as its first argument, and the next two
 // arguments are the hash key and the opaque value stored with it.
+// The walk function must not insert or remove entries.
 typedef int (*nni_idhash_walkfn)(void *, uint32_t, void *);
 extern int nni_idhash_create(nni_idhash **);
 extern void nni_idhash_destroy(nni_idhash *);
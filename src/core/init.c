@@ -19,6 +19,21 @@ nni_init_helper(void)
 	if ((rv = nni_random_init()) != 0) {
 		return (rv);
 	}
+	if ((rv = nni_trace_init()) != 0) {
+		nni_random_fini();
+		return (rv);
+	}
+	if ((rv = nni_resolv_init()) != 0) {
+		nni_trace_fini();
+		nni_random_fini();
+		return (rv);
+	}
+	if ((rv = nni_reap_init()) != 0) {
+		nni_resolv_fini();
+		nni_trace_fini();
+		nni_random_fini();
+		return (rv);
+	}
 	nni_tran_init();
 	return (0);
 }
@@ -35,6 +50,9 @@ void
 nni_fini(void)
 {
 	nni_tran_fini();
+	nni_reap_fini();
+	nni_resolv_fini();
+	nni_trace_fini();
 	nni_random_fini();
 	nni_plat_fini();
 }
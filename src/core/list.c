@@ -149,3 +149,14 @@ nni_list_remove(nni_list *list, void *item)
 	node->ln_next = NULL;
 	node->ln_prev = NULL;
 }
+
+
+// nni_list_active returns non-zero if the item is on a list.  (The list
+// given need not be the one it is on.)
+int
+nni_list_active(nni_list *list, void *item)
+{
+	nni_list_node *node = NODE(list, item);
+
+	return (node->ln_next != NULL);
+}
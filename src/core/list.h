@@ -41,6 +41,7 @@ extern void nni_list_insert_after(nni_list *, void *, void *);
 extern void *nni_list_next(const nni_list *, void *);
 extern void *nni_list_prev(const nni_list *, void *);
 extern void nni_list_remove(nni_list *, void *);
+extern int nni_list_active(nni_list *, void *);
 
 #define NNI_LIST_FOREACH(l, it)	\
 	for (it = nni_list_first(l); it != NULL; it = nni_list_next(l, it))
@@ -29,6 +29,7 @@ struct nng_msg {
 	nni_chunk	m_body;
 	nni_time	m_expire;       // usec
 	nni_list	m_options;
+	uint64_t	m_trace;        // trace id, 0 if not sampled
 };
 
 typedef struct {
@@ -352,6 +353,7 @@ nni_msg_dup(nni_msg **dup, const nni_msg *src)
 		memcpy(newmo->mo_val, mo->mo_val, mo->mo_sz);
 		nni_list_append(&m->m_options, newmo);
 	}
+	m->m_trace = src->m_trace;
 
 	*dup = m;
 	return (0);
@@ -406,6 +408,20 @@ nni_msg_setopt(nni_msg *m, int opt, const void *val, size_t sz)
 }
 
 
+uint64_t
+nni_msg_trace(nni_msg *m)
+{
+	return (m->m_trace);
+}
+
+
+void
+nni_msg_set_trace(nni_msg *m, uint64_t id)
+{
+	m->m_trace = id;
+}
+
+
 int
 nni_msg_getopt(nni_msg *m, int opt, void *val, size_t *szp)
 {
@@ -413,13 +429,13 @@ nni_msg_getopt(nni_msg *m, int opt, void *val, size_t *szp)
 
 	NNI_LIST_FOREACH (&m->m_options, mo) {
 		if (mo->mo_num == opt) {
-			int sz = *szp;
+			size_t sz = *szp;
 			if (sz > mo->mo_sz) {
 				sz = mo->mo_sz;
-				memcpy(val, mo->mo_val, sz);
-				*szp = mo->mo_sz;
-				return (0);
 			}
+			memcpy(val, mo->mo_val, sz);
+			*szp = mo->mo_sz;
+			return (0);
 		}
 	}
 	return (NNG_ENOTSUP);
@@ -514,6 +530,40 @@ nni_msg_prepend_header(nni_msg *m, const void *data, size_t len)
 }
 
 
+// nni_msg_backtrace moves a backtrace from the front of the body to the
+// end of the header.  The backtrace is a run of 32-bit words, the last of
+// which has its high bit set; it is moved in a single copy, rather than a
+// word at a time, so that the number of hops it has been through does not
+// matter much.  The header is grown at most once, leaving the same 32 bytes
+// of slack that nni_msg_alloc does for whoever adds to it next.
+int
+nni_msg_backtrace(nni_msg *m, int maxhops)
+{
+	nni_chunk *hdr = &m->m_header;
+	nni_chunk *body = &m->m_body;
+	size_t len = 0;
+	int hops;
+	int rv;
+
+	for (hops = 0;; hops++) {
+		if ((hops >= maxhops) || ((len + 4) > body->ch_len)) {
+			return (NNG_EINVAL);
+		}
+		len += 4;
+		if (body->ch_ptr[len - 4] & 0x80) {
+			break;
+		}
+	}
+	if ((rv = nni_chunk_grow(hdr, hdr->ch_len + len + 32, 0)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_chunk_append(hdr, body->ch_ptr, len)) != 0) {
+		return (rv);
+	}
+	return (nni_chunk_trim(body, len));
+}
+
+
 int
 nni_msg_trim_header(nni_msg *m, size_t len)
 {
@@ -32,4 +32,15 @@ extern int nni_msg_setopt(nni_msg *, int, const void *, size_t);
 extern int nni_msg_getopt(nni_msg *, int, void *, size_t *);
 extern void nni_msg_dump(const char *, const nni_msg *);
 
+// nni_msg_backtrace moves the backtrace (routing words up to and including
+// the first with the high bit set) from the body to the end of the header.
+// It fails with NNG_EINVAL if there is no such word within the given
+// number of hops.
+extern int nni_msg_backtrace(nni_msg *, int);
+
+// nni_msg_trace returns the message's trace id, or zero if the message is
+// not being traced.  Duplicates share the id of the original.
+extern uint64_t nni_msg_trace(nni_msg *);
+extern void nni_msg_set_trace(nni_msg *, uint64_t);
+
 #endif  // CORE_SOCKET_H
@@ -13,11 +13,35 @@
 // but as we have access to the internals, we have made some fundamental
 // differences and improvements.  For example, these can grow, and either
 // side can close, and they may be closed more than once.
+//
+// Blocked readers and writers each wait on their own condition variable,
+// queued in arrival order.  A message put wakes just one reader, and only
+// if the readers already woken are too few to take all the messages; the
+// same goes for writers and free slots.  Waking everybody would just have
+// most of them find nothing to do and go back to sleep, at the cost of a
+// context switch each.  Changes that affect everybody (close, errors,
+// signals, resizing) still wake everybody.
+//
+// When a reader is asleep and the queue is empty, a message put is handed
+// straight to that reader, without passing through the queue, so the
+// reader need not look at the queue again when it wakes.
+
+typedef struct nni_msgq_waiter {
+	nni_list_node	w_node;
+	nni_cv		w_cv;
+	int		w_woken;
+	nni_msg *	w_msg;          // handed over directly, or NULL
+} nni_msgq_waiter;
+
+typedef struct nni_msgq_waitq {
+	nni_list	wq_list;        // sleeping waiters, FIFO
+	int		wq_pending;     // woken, but not yet running
+} nni_msgq_waitq;
 
 struct nni_msgq {
 	nni_mtx		mq_lock;
-	nni_cv		mq_readable;
-	nni_cv		mq_writeable;
+	nni_msgq_waitq	mq_readers;
+	nni_msgq_waitq	mq_writers;
 	nni_cv		mq_drained;
 	int		mq_cap;
 	int		mq_alloc;       // alloc is cap + 2...
@@ -29,9 +53,17 @@ struct nni_msgq {
 	int		mq_geterr;
 	int		mq_rwait;       // readers waiting (unbuffered)
 	int		mq_wwait;
+	size_t		mq_bytes;       // bytes of messages queued
+	size_t		mq_maxbytes;    // byte limit, 0 for none
+	int		mq_puttrace;    // trace point on put, or 0
+	int		mq_gettrace;    // trace point on get, or 0
+	nni_duration	mq_spin;        // busy-poll time before sleeping
 	nni_msg **	mq_msgs;
 };
 
+#define NNI_MSGQ_MSGSIZE(msg) \
+	(nni_msg_len(msg) + nni_msg_header_len(msg))
+
 int
 nni_msgq_init(nni_msgq **mqp, int cap)
 {
@@ -57,29 +89,21 @@ nni_msgq_init(nni_msgq **mqp, int cap)
 		nni_free(mq, sizeof (*mq));
 		return (rv);
 	}
-	if ((rv = nni_cv_init(&mq->mq_readable, &mq->mq_lock)) != 0) {
-		nni_mtx_fini(&mq->mq_lock);
-		nni_free(mq, sizeof (*mq));
-		return (NNG_ENOMEM);
-	}
-	if ((rv = nni_cv_init(&mq->mq_writeable, &mq->mq_lock)) != 0) {
-		nni_cv_fini(&mq->mq_readable);
-		nni_mtx_fini(&mq->mq_lock);
-		return (NNG_ENOMEM);
-	}
 	if ((rv = nni_cv_init(&mq->mq_drained, &mq->mq_lock)) != 0) {
-		nni_cv_fini(&mq->mq_writeable);
-		nni_cv_fini(&mq->mq_readable);
 		nni_mtx_fini(&mq->mq_lock);
+		nni_free(mq, sizeof (*mq));
 		return (NNG_ENOMEM);
 	}
 	if ((mq->mq_msgs = nni_alloc(sizeof (nng_msg *) * alloc)) == NULL) {
 		nni_cv_fini(&mq->mq_drained);
-		nni_cv_fini(&mq->mq_writeable);
-		nni_cv_fini(&mq->mq_readable);
 		nni_mtx_fini(&mq->mq_lock);
+		nni_free(mq, sizeof (*mq));
 		return (NNG_ENOMEM);
 	}
+	NNI_LIST_INIT(&mq->mq_readers.wq_list, nni_msgq_waiter, w_node);
+	NNI_LIST_INIT(&mq->mq_writers.wq_list, nni_msgq_waiter, w_node);
+	mq->mq_readers.wq_pending = 0;
+	mq->mq_writers.wq_pending = 0;
 
 	mq->mq_cap = cap;
 	mq->mq_alloc = alloc;
@@ -91,6 +115,11 @@ nni_msgq_init(nni_msgq **mqp, int cap)
 	mq->mq_geterr = 0;
 	mq->mq_wwait = 0;
 	mq->mq_rwait = 0;
+	mq->mq_bytes = 0;
+	mq->mq_maxbytes = 0;
+	mq->mq_puttrace = 0;
+	mq->mq_gettrace = 0;
+	mq->mq_spin = 0;
 	*mqp = mq;
 
 	return (0);
@@ -106,15 +135,13 @@ nni_msgq_fini(nni_msgq *mq)
 		return;
 	}
 	nni_cv_fini(&mq->mq_drained);
-	nni_cv_fini(&mq->mq_writeable);
-	nni_cv_fini(&mq->mq_readable);
 	nni_mtx_fini(&mq->mq_lock);
 
 	/* Free any orphaned messages. */
 	while (mq->mq_len > 0) {
 		msg = mq->mq_msgs[mq->mq_get];
 		mq->mq_get++;
-		if (mq->mq_get > mq->mq_alloc) {
+		if (mq->mq_get == mq->mq_alloc) {
 			mq->mq_get = 0;
 		}
 		mq->mq_len--;
@@ -126,13 +153,75 @@ nni_msgq_fini(nni_msgq *mq)
 }
 
 
+// nni_msgq_wait queues the caller, and sleeps until it is woken, or the
+// time expires.  It returns NNG_ETIMEDOUT only if it was not woken; a
+// waiter that is woken is obliged to look at the queue again, so that the
+// wakeup is not lost, unless it was handed a message (readers only, and
+// only if msgp is not NULL).  The lock must be held.
+static int
+nni_msgq_wait(nni_msgq *mq, nni_msgq_waitq *wq, nni_time expire,
+    nni_msg **msgp)
+{
+	nni_msgq_waiter w;
+	int rv;
+
+	if ((rv = nni_cv_init(&w.w_cv, &mq->mq_lock)) != 0) {
+		return (rv);
+	}
+	NNI_LIST_NODE_INIT(&w.w_node);
+	w.w_woken = 0;
+	w.w_msg = NULL;
+	nni_list_append(&wq->wq_list, &w);
+	while (!w.w_woken) {
+		if (nni_cv_until(&w.w_cv, expire) == NNG_ETIMEDOUT) {
+			break;
+		}
+	}
+	if (w.w_msg != NULL) {
+		*msgp = w.w_msg;
+	} else if (w.w_woken) {
+		wq->wq_pending--;
+	} else {
+		nni_list_remove(&wq->wq_list, &w);
+		rv = NNG_ETIMEDOUT;
+	}
+	nni_cv_fini(&w.w_cv);
+	return (rv);
+}
+
+
+// nni_msgq_wake1 wakes the longest waiting waiter, if any.
+static void
+nni_msgq_wake1(nni_msgq_waitq *wq)
+{
+	nni_msgq_waiter *w;
+
+	if ((w = nni_list_first(&wq->wq_list)) != NULL) {
+		nni_list_remove(&wq->wq_list, w);
+		w->w_woken = 1;
+		wq->wq_pending++;
+		nni_cv_wake(&w->w_cv);
+	}
+}
+
+
+// nni_msgq_wakeall wakes every waiter.
+static void
+nni_msgq_wakeall(nni_msgq_waitq *wq)
+{
+	while (nni_list_first(&wq->wq_list) != NULL) {
+		nni_msgq_wake1(wq);
+	}
+}
+
+
 void
 nni_msgq_set_put_error(nni_msgq *mq, int error)
 {
 	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_puterr = error;
 	if (error) {
-		nni_cv_wake(&mq->mq_writeable);
+		nni_msgq_wakeall(&mq->mq_writers);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 }
@@ -144,7 +233,7 @@ nni_msgq_set_get_error(nni_msgq *mq, int error)
 	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_geterr = error;
 	if (error) {
-		nni_cv_wake(&mq->mq_readable);
+		nni_msgq_wakeall(&mq->mq_readers);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 }
@@ -157,8 +246,8 @@ nni_msgq_set_error(nni_msgq *mq, int error)
 	mq->mq_geterr = error;
 	mq->mq_puterr = error;
 	if (error) {
-		nni_cv_wake(&mq->mq_readable);
-		nni_cv_wake(&mq->mq_writeable);
+		nni_msgq_wakeall(&mq->mq_readers);
+		nni_msgq_wakeall(&mq->mq_writers);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 }
@@ -174,8 +263,8 @@ nni_msgq_signal(nni_msgq *mq, int *signal)
 	*signal = 1;
 
 	// We have to wake everyone.
-	nni_cv_wake(&mq->mq_readable);
-	nni_cv_wake(&mq->mq_writeable);
+	nni_msgq_wakeall(&mq->mq_readers);
+	nni_msgq_wakeall(&mq->mq_writers);
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -183,6 +272,7 @@ nni_msgq_signal(nni_msgq *mq, int *signal)
 int
 nni_msgq_put_(nni_msgq *mq, nni_msg *msg, nni_time expire, nni_signal *sig)
 {
+	nni_msgq_waiter *w;
 	int rv;
 
 	nni_mtx_lock(&mq->mq_lock);
@@ -199,8 +289,26 @@ nni_msgq_put_(nni_msgq *mq, nni_msg *msg, nni_time expire, nni_signal *sig)
 			return (rv);
 		}
 
-		// room in the queue?
-		if (mq->mq_len < mq->mq_cap) {
+		// A reader asleep, and nothing ahead of us?  Hand it over.
+		if ((mq->mq_len == 0) &&
+		    ((w = nni_list_first(&mq->mq_readers.wq_list)) != NULL)) {
+			nni_list_remove(&mq->mq_readers.wq_list, w);
+			if (mq->mq_puttrace != 0) {
+				NNI_TRACE(msg, mq->mq_puttrace);
+			}
+			w->w_msg = msg;
+			w->w_woken = 1;
+			nni_cv_wake(&w->w_cv);
+			nni_mtx_unlock(&mq->mq_lock);
+			return (0);
+		}
+
+		// room in the queue?  An empty queue always accepts a
+		// message, even one larger than the byte limit.
+		if ((mq->mq_len < mq->mq_cap) &&
+		    ((mq->mq_maxbytes == 0) || (mq->mq_len == 0) ||
+		    (mq->mq_bytes + NNI_MSGQ_MSGSIZE(msg) <=
+		    mq->mq_maxbytes))) {
 			break;
 		}
 
@@ -225,11 +333,11 @@ nni_msgq_put_(nni_msgq *mq, nni_msg *msg, nni_time expire, nni_signal *sig)
 
 		// not writeable, so wait until something changes
 		mq->mq_wwait++;
-		rv = nni_cv_until(&mq->mq_writeable, expire);
+		rv = nni_msgq_wait(mq, &mq->mq_writers, expire, NULL);
 		mq->mq_wwait--;
-		if (rv == NNG_ETIMEDOUT) {
+		if (rv != 0) {
 			nni_mtx_unlock(&mq->mq_lock);
-			return (NNG_ETIMEDOUT);
+			return (rv);
 		}
 	}
 
@@ -240,8 +348,12 @@ nni_msgq_put_(nni_msgq *mq, nni_msg *msg, nni_time expire, nni_signal *sig)
 		mq->mq_put = 0;
 	}
 	mq->mq_len++;
-	if (mq->mq_rwait) {
-		nni_cv_wake(&mq->mq_readable);
+	mq->mq_bytes += NNI_MSGQ_MSGSIZE(msg);
+	if (mq->mq_puttrace != 0) {
+		NNI_TRACE(msg, mq->mq_puttrace);
+	}
+	if (mq->mq_len > mq->mq_readers.wq_pending) {
+		nni_msgq_wake1(&mq->mq_readers);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 	return (0);
@@ -269,24 +381,55 @@ nni_msgq_putback(nni_msgq *mq, nni_msg *msg)
 	}
 
 	// Subtract one from the get index, possibly wrapping.
-	mq->mq_get--;
 	if (mq->mq_get == 0) {
-		mq->mq_get = mq->mq_cap;
+		mq->mq_get = mq->mq_alloc;
 	}
+	mq->mq_get--;
 	mq->mq_msgs[mq->mq_get] = msg;
 	mq->mq_len++;
-	if (mq->mq_rwait) {
-		nni_cv_wake(&mq->mq_readable);
+	mq->mq_bytes += NNI_MSGQ_MSGSIZE(msg);
+	if (mq->mq_len > mq->mq_readers.wq_pending) {
+		nni_msgq_wake1(&mq->mq_readers);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 	return (0);
 }
 
 
+// nni_msgq_spin busy-polls, without the lock, for a message to arrive.
+// It gives up at the spin limit or the caller's deadline, whichever comes
+// first, or as soon as the queue is closed, an error is posted, or the
+// caller is signaled.  It is only used with more than one CPU.  The
+// caller is counted as a waiting reader while it spins, so that
+// unbuffered writers will hand it a message.
+static void
+nni_msgq_spin(nni_msgq *mq, nni_time expire, nni_signal *sig)
+{
+	volatile int *lenp = &mq->mq_len;
+	volatile int *closedp = &mq->mq_closed;
+	volatile int *errp = &mq->mq_geterr;
+	volatile nni_signal *sigp = sig;
+	nni_time until;
+
+	until = nni_clock() + mq->mq_spin;
+	if (until > expire) {
+		until = expire;
+	}
+	nni_mtx_unlock(&mq->mq_lock);
+	while ((*lenp == 0) && (*closedp == 0) && (*errp == 0) &&
+	    (*sigp == 0) && (nni_clock() < until)) {
+		continue;
+	}
+	nni_mtx_lock(&mq->mq_lock);
+}
+
+
 static int
 nni_msgq_get_(nni_msgq *mq, nni_msg **msgp, nni_time expire, nni_signal *sig)
 {
+	nni_msg *msg = NULL;
 	int rv;
+	int spun = 0;
 
 	nni_mtx_lock(&mq->mq_lock);
 
@@ -311,16 +454,37 @@ nni_msgq_get_(nni_msgq *mq, nni_msg **msgp, nni_time expire, nni_signal *sig)
 			nni_mtx_unlock(&mq->mq_lock);
 			return (NNG_EINTR);
 		}
-		if ((mq->mq_cap == 0) & (mq->mq_wwait)) {
-			// let a write waiter know we are ready
-			nni_cv_wake(&mq->mq_writeable);
-		}
+		// Let a write waiter know we are ready, unless enough have
+		// been woken already for all of the readers waiting, us
+		// included.  A woken writer serves only one reader.
 		mq->mq_rwait++;
-		rv = nni_cv_until(&mq->mq_readable, expire);
+		if ((mq->mq_cap == 0) &&
+		    (mq->mq_rwait > mq->mq_writers.wq_pending)) {
+			nni_msgq_wake1(&mq->mq_writers);
+		}
+		if ((mq->mq_spin > 0) && !spun && (nni_plat_ncpu() > 1)) {
+			// Spin once per call; if nothing turned up in that
+			// time, the sender is not keeping up, and sleeping
+			// costs little more than the wakeup we tried to save.
+			spun = 1;
+			nni_msgq_spin(mq, expire, sig);
+			mq->mq_rwait--;
+			continue;
+		}
+		rv = nni_msgq_wait(mq, &mq->mq_readers, expire, &msg);
 		mq->mq_rwait--;
-		if (rv == NNG_ETIMEDOUT) {
+		if (rv != 0) {
 			nni_mtx_unlock(&mq->mq_lock);
-			return (NNG_ETIMEDOUT);
+			return (rv);
+		}
+		if (msg != NULL) {
+			// Handed to us directly; it never used a slot.
+			if (mq->mq_gettrace != 0) {
+				NNI_TRACE(msg, mq->mq_gettrace);
+			}
+			nni_mtx_unlock(&mq->mq_lock);
+			*msgp = msg;
+			return (0);
 		}
 	}
 
@@ -328,12 +492,20 @@ nni_msgq_get_(nni_msgq *mq, nni_msg **msgp, nni_time expire, nni_signal *sig)
 
 	*msgp = mq->mq_msgs[mq->mq_get];
 	mq->mq_len--;
+	mq->mq_bytes -= NNI_MSGQ_MSGSIZE(*msgp);
 	mq->mq_get++;
 	if (mq->mq_get == mq->mq_alloc) {
 		mq->mq_get = 0;
 	}
-	if (mq->mq_wwait) {
-		nni_cv_wake(&mq->mq_writeable);
+	if (mq->mq_gettrace != 0) {
+		NNI_TRACE(*msgp, mq->mq_gettrace);
+	}
+	if ((mq->mq_cap - mq->mq_len) > mq->mq_writers.wq_pending) {
+		nni_msgq_wake1(&mq->mq_writers);
+	}
+	if (mq->mq_closed && (mq->mq_len == 0)) {
+		// A drain (linger) is waiting for this.
+		nni_cv_wake(&mq->mq_drained);
 	}
 	nni_mtx_unlock(&mq->mq_lock);
 	return (0);
@@ -404,8 +576,8 @@ nni_msgq_drain(nni_msgq *mq, nni_time expire)
 {
 	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_closed = 1;
-	nni_cv_wake(&mq->mq_writeable);
-	nni_cv_wake(&mq->mq_readable);
+	nni_msgq_wakeall(&mq->mq_writers);
+	nni_msgq_wakeall(&mq->mq_readers);
 	while (mq->mq_len > 0) {
 		if (nni_cv_until(&mq->mq_drained, expire) == NNG_ETIMEDOUT) {
 			break;
@@ -414,12 +586,13 @@ nni_msgq_drain(nni_msgq *mq, nni_time expire)
 	// If we timedout, free any remaining messages in the queue.
 	while (mq->mq_len > 0) {
 		nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get > mq->mq_alloc) {
+		if (mq->mq_get == mq->mq_alloc) {
 			mq->mq_get = 0;
 		}
 		mq->mq_len--;
 		nni_msg_free(msg);
 	}
+	mq->mq_bytes = 0;
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -429,18 +602,48 @@ nni_msgq_close(nni_msgq *mq)
 {
 	nni_mtx_lock(&mq->mq_lock);
 	mq->mq_closed = 1;
-	nni_cv_wake(&mq->mq_writeable);
-	nni_cv_wake(&mq->mq_readable);
+	nni_msgq_wakeall(&mq->mq_writers);
+	nni_msgq_wakeall(&mq->mq_readers);
 
 	// Free the messages orphaned in the queue.
 	while (mq->mq_len > 0) {
 		nni_msg *msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get > mq->mq_alloc) {
+		if (mq->mq_get == mq->mq_alloc) {
 			mq->mq_get = 0;
 		}
 		mq->mq_len--;
 		nni_msg_free(msg);
 	}
+	mq->mq_bytes = 0;
+	nni_mtx_unlock(&mq->mq_lock);
+}
+
+
+void
+nni_msgq_set_maxbytes(nni_msgq *mq, size_t maxbytes)
+{
+	nni_mtx_lock(&mq->mq_lock);
+	mq->mq_maxbytes = maxbytes;
+	nni_msgq_wakeall(&mq->mq_writers);
+	nni_mtx_unlock(&mq->mq_lock);
+}
+
+
+void
+nni_msgq_set_spin(nni_msgq *mq, nni_duration spin)
+{
+	nni_mtx_lock(&mq->mq_lock);
+	mq->mq_spin = spin;
+	nni_mtx_unlock(&mq->mq_lock);
+}
+
+
+void
+nni_msgq_set_trace(nni_msgq *mq, int putpoint, int getpoint)
+{
+	nni_mtx_lock(&mq->mq_lock);
+	mq->mq_puttrace = putpoint;
+	mq->mq_gettrace = getpoint;
 	nni_mtx_unlock(&mq->mq_lock);
 }
 
@@ -457,6 +660,20 @@ nni_msgq_len(nni_msgq *mq)
 }
 
 
+int
+nni_msgq_canput(nni_msgq *mq)
+{
+	int rv;
+
+	nni_mtx_lock(&mq->mq_lock);
+	rv = (!mq->mq_closed) && (mq->mq_puterr == 0) &&
+	    ((mq->mq_len < mq->mq_cap) ||
+	    ((mq->mq_cap == 0) && (mq->mq_len == 0) && (mq->mq_rwait != 0)));
+	nni_mtx_unlock(&mq->mq_lock);
+	return (rv);
+}
+
+
 int
 nni_msgq_cap(nni_msgq *mq)
 {
@@ -498,10 +715,11 @@ nni_msgq_resize(nni_msgq *mq, int cap)
 		// the case of pushback or cap == 0.
 		// we delete the oldest messages first
 		msg = mq->mq_msgs[mq->mq_get++];
-		if (mq->mq_get > mq->mq_alloc) {
+		if (mq->mq_get == mq->mq_alloc) {
 			mq->mq_get = 0;
 		}
 		mq->mq_len--;
+		mq->mq_bytes -= NNI_MSGQ_MSGSIZE(msg);
 		nni_msg_free(msg);
 	}
 	if (newq == NULL) {
@@ -537,8 +755,8 @@ nni_msgq_resize(nni_msgq *mq, int cap)
 
 out:
 	// Wake everyone up -- we changed everything.
-	nni_cv_wake(&mq->mq_readable);
-	nni_cv_wake(&mq->mq_writeable);
+	nni_msgq_wakeall(&mq->mq_readers);
+	nni_msgq_wakeall(&mq->mq_writers);
 	nni_cv_wake(&mq->mq_drained);
 	nni_mtx_unlock(&mq->mq_lock);
 	return (0);
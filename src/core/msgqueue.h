@@ -122,6 +122,22 @@ extern void nni_msgq_drain(nni_msgq *, nni_time);
 // preserved.)
 extern int nni_msgq_resize(nni_msgq *, int);
 
+// nni_msgq_set_maxbytes limits the total size (header and body) of the
+// messages held in the queue, in addition to the limit on their number.
+// A message that would exceed this is not accepted, unless the queue is
+// empty, so that oversized messages can still pass.  Zero means no limit.
+extern void nni_msgq_set_maxbytes(nni_msgq *, size_t);
+
+// nni_msgq_set_trace sets the trace points (NNG_TRACE_xxx) recorded for
+// traced messages as they are put on and taken off the queue.  Zero means
+// nothing is recorded.  This is for the socket's upper queues.
+extern void nni_msgq_set_trace(nni_msgq *, int, int);
+
+// nni_msgq_set_spin sets how long (usec) a reader busy-polls an empty
+// queue before it goes to sleep.  This trades a CPU for lower latency,
+// by avoiding the scheduler wakeup.  Zero, the default, never spins.
+extern void nni_msgq_set_spin(nni_msgq *, nni_duration);
+
 // nni_msgq_cap returns the "capacity" of the message queue.  This does not
 // include the extra room for pushback, nor the extra slot reserved to make
 // zero-length message queues possible.  As a consequence, it is possible
@@ -131,4 +147,10 @@ extern int nni_msgq_cap(nni_msgq *mq);
 // nni_msgq_len returns the number of messages currently in the queue.
 extern int nni_msgq_len(nni_msgq *mq);
 
+// nni_msgq_canput returns non-zero if a put would complete right away,
+// because there is room, or (for an unbuffered queue) a reader waiting.
+// The byte limit is not considered.  This is only a hint, unless the
+// caller is the queue's only writer.
+extern int nni_msgq_canput(nni_msgq *mq);
+
 #endif  // CORE_MSQUEUE_H
@@ -29,10 +29,14 @@
 #include "core/msgqueue.h"
 #include "core/options.h"
 #include "core/panic.h"
+#include "core/pipeset.h"
 #include "core/platform.h"
 #include "core/protocol.h"
 #include "core/random.h"
+#include "core/reap.h"
+#include "core/resolv.h"
 #include "core/thread.h"
+#include "core/trace.h"
 #include "core/transport.h"
 
 // These have to come after the others - particularly transport.h
@@ -78,6 +78,13 @@ nni_getopt_int(int *ptr, void *val, size_t *sizep)
 
 int
 nni_setopt_buf(nni_msgq *mq, const void *val, size_t sz)
+{
+	return (nni_setopt_buf_min(mq, val, sz, 0));
+}
+
+
+int
+nni_setopt_buf_min(nni_msgq *mq, const void *val, size_t sz, int min)
 {
 	int len;
 
@@ -85,7 +92,7 @@ nni_setopt_buf(nni_msgq *mq, const void *val, size_t sz)
 		return (NNG_EINVAL);
 	}
 	memcpy(&len, val, sizeof (len));
-	if (len < 0) {
+	if (len < min) {
 		return (NNG_EINVAL);
 	}
 	if (len > 8192) {
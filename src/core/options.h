@@ -17,6 +17,10 @@
 // nni_setopt_buf sets the queue size for the message queue.
 extern int nni_setopt_buf(nni_msgq *, const void *, size_t);
 
+// nni_setopt_buf_min is like nni_setopt_buf, but refuses sizes below the
+// given minimum with NNG_EINVAL.
+extern int nni_setopt_buf_min(nni_msgq *, const void *, size_t, int);
+
 // nni_getopt_buf gets the queue size for the message queue.
 extern int nni_getopt_buf(nni_msgq *, void *, size_t *);
 
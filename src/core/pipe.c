@@ -25,14 +25,33 @@ nni_pipe_id(nni_pipe *p)
 int
 nni_pipe_send(nni_pipe *p, nng_msg *msg)
 {
+	NNI_TRACE(msg, NNG_TRACE_TXWRITE);
 	return (p->p_tran_ops.pipe_send(p->p_tran_data, msg));
 }
 
 
+// nni_pipe_cansend returns non-zero if the transport expects that sending
+// the message would complete without blocking.  As only one thread should
+// be sending on a pipe at a time, the answer holds until that thread sends.
+int
+nni_pipe_cansend(nni_pipe *p, nni_msg *msg)
+{
+	if (p->p_tran_ops.pipe_cansend == NULL) {
+		return (0);
+	}
+	return (p->p_tran_ops.pipe_cansend(p->p_tran_data, msg));
+}
+
+
 int
 nni_pipe_recv(nni_pipe *p, nng_msg **msgp)
 {
-	return (p->p_tran_ops.pipe_recv(p->p_tran_data, msgp));
+	int rv;
+
+	if ((rv = p->p_tran_ops.pipe_recv(p->p_tran_data, msgp)) == 0) {
+		NNI_TRACE_START(*msgp, NNG_TRACE_TXREAD);
+	}
+	return (rv);
 }
 
 
@@ -48,15 +67,76 @@ nni_pipe_close(nni_pipe *p)
 		p->p_tran_ops.pipe_close(p->p_tran_data);
 	}
 
-	nni_mtx_lock(&sock->s_mx);
+	// Only the pipe lock is needed here, so a pipe going away does not
+	// wait for, or hold up, the protocol.
+	nni_mtx_lock(&sock->s_pipe_mx);
+	nni_pipe_remove(p);
+	nni_mtx_unlock(&sock->s_pipe_mx);
+}
+
+
+void
+nni_pipe_remove(nni_pipe *p)
+{
+	nni_sock *sock = p->p_sock;
+
 	if (!p->p_reap) {
 		// schedule deferred reap/close
 		p->p_reap = 1;
 		nni_list_remove(&sock->s_pipes, p);
 		nni_list_append(&sock->s_reaps, p);
-		nni_cv_wake(&sock->s_cv);
+		sock->s_nreap++;
+		nni_reap(&p->p_reap_item, nni_pipe_reap, p);
+	}
+}
+
+
+// Because we have to call back into the socket, and possibly also the
+// proto, and wait for the pipe's threads to terminate, this is done in
+// a reaper thread.  Several pipes, even of the same socket, may be
+// reaped at once.
+void
+nni_pipe_reap(void *arg)
+{
+	nni_pipe *p = arg;
+	nni_sock *sock = p->p_sock;
+	nni_ep *ep;
+
+	nni_mtx_lock(&sock->s_pipe_mx);
+	if (nni_list_active(&sock->s_reaps, p)) {
+		nni_list_remove(&sock->s_reaps, p);
+	}
+	nni_mtx_unlock(&sock->s_pipe_mx);
+
+	nni_mtx_lock(&sock->s_ep_mx);
+	if (((ep = p->p_ep) != NULL) && (ep->ep_pipe == p)) {
+		ep->ep_pipe = NULL;
+		nni_cv_wake(&ep->ep_cv);
+	}
+	nni_mtx_unlock(&sock->s_ep_mx);
+
+	// Remove the pipe from the protocol.  Protocols may keep lists of
+	// pipes for managing their topologies.  Note that if a protocol has
+	// rejected the pipe, it won't have any data.
+	nni_mtx_lock(&sock->s_mx);
+	if (p->p_active) {
+		sock->s_pipe_ops.pipe_rem(p->p_proto_data);
 	}
 	nni_mtx_unlock(&sock->s_mx);
+
+	// XXX: also publish event...
+
+	// There should be no references left to this pipe.  The various
+	// threads will have shutdown, except the threads that this waits
+	// for.
+	nni_pipe_destroy(p);
+
+	// Once this is done, a closing socket may be freed.
+	nni_mtx_lock(&sock->s_pipe_mx);
+	if (--sock->s_nreap == 0) {
+		nni_cv_wake(&sock->s_pipe_cv);
+	}
+	nni_mtx_unlock(&sock->s_pipe_mx);
 }
 
 
@@ -122,6 +202,7 @@ nni_pipe_create(nni_pipe **pp, nni_ep *ep)
 	p->p_proto_data = NULL;
 	p->p_active = 0;
 	NNI_LIST_NODE_INIT(&p->p_node);
+	nni_reap_item_init(&p->p_reap_item);
 
 	// Make a copy of the transport ops.  We can override entry points
 	// and we avoid an extra dereference on hot code paths.
@@ -184,6 +265,7 @@ nni_pipe_start(nni_pipe *pipe)
 		return (NNG_EPROTO);
 	}
 
+	nni_mtx_lock(&sock->s_pipe_mx);
 	do {
 		// We generate a new pipe ID, but we make sure it does not
 		// collide with any we already have.  This can only normally
@@ -199,6 +281,7 @@ nni_pipe_start(nni_pipe *pipe)
 			}
 		}
 	} while (collide);
+	nni_mtx_unlock(&sock->s_pipe_mx);
 
 	if ((rv = sock->s_pipe_ops.pipe_add(pipe->p_proto_data)) != 0) {
 		nni_pipe_bail(pipe);
@@ -206,9 +289,12 @@ nni_pipe_start(nni_pipe *pipe)
 		return (rv);
 	}
 
+	nni_mtx_lock(&sock->s_pipe_mx);
 	nni_list_append(&sock->s_pipes, pipe);
+	nni_mtx_unlock(&sock->s_pipe_mx);
 
 	for (i = 0; i < NNI_MAXWORKERS; i++) {
+		nni_sock_bindthr(sock, &pipe->p_worker_thr[i]);
 		nni_thr_run(&pipe->p_worker_thr[i]);
 	}
 	pipe->p_active = 1;
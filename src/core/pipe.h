@@ -27,12 +27,14 @@ struct nng_pipe {
 	nni_ep *	p_ep;
 	int		p_reap;
 	int		p_active;
+	nni_reap_item	p_reap_item;
 	nni_thr		p_worker_thr[NNI_MAXWORKERS];
 };
 
 // Pipe operations that protocols use.
 extern int nni_pipe_recv(nni_pipe *, nng_msg **);
 extern int nni_pipe_send(nni_pipe *, nng_msg *);
+extern int nni_pipe_cansend(nni_pipe *, nng_msg *);
 extern uint32_t nni_pipe_id(nni_pipe *);
 extern void nni_pipe_close(nni_pipe *);
 
@@ -42,6 +44,16 @@ extern int nni_pipe_create(nni_pipe **, nni_ep *);
 
 extern void nni_pipe_destroy(nni_pipe *);
 
+// nni_pipe_remove takes the pipe off its socket's list of pipes, and
+// queues it to be reaped.  The caller must hold the socket's pipe lock,
+// and must already have closed the transport.
+extern void nni_pipe_remove(nni_pipe *);
+
+// nni_pipe_reap removes the pipe from the protocol, and destroys it.
+// The reaper calls this, unless the socket is closing and gets there
+// first by taking the pipe back from the reaper.
+extern void nni_pipe_reap(void *);
+
 extern uint16_t nni_pipe_proto(nni_pipe *);
 extern uint16_t nni_pipe_peer(nni_pipe *);
 extern int nni_pipe_start(nni_pipe *);
@@ -0,0 +1,230 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+// The set's own mutex only protects the current snapshot pointer and the
+// reference counts, so it is never held for longer than a few instructions
+// (except by the rare fallback path in nni_pipeset_remove).  The set holds
+// one reference on the current snapshot; retired snapshots are counted in
+// ps_nretired until their last reader lets go.
+
+struct nni_pipeset {
+	nni_mtx			ps_mx;
+	nni_cv			ps_cv;
+	nni_pipeset_snap *	ps_cur;
+	uint64_t		ps_gen;
+	int			ps_nretired;
+	int			ps_editing;
+};
+
+static nni_pipeset_snap *
+nni_pipeset_snap_alloc(int npipes)
+{
+	nni_pipeset_snap *snap;
+	size_t size;
+
+	size = sizeof (*snap) + (npipes * sizeof (void *));
+	if ((snap = nni_alloc(size)) == NULL) {
+		return (NULL);
+	}
+	snap->ps_refcnt = 1;
+	snap->ps_npipes = npipes;
+	snap->ps_size = size;
+	snap->ps_pipes = (void **) (snap + 1);
+	return (snap);
+}
+
+
+static void
+nni_pipeset_snap_free(nni_pipeset_snap *snap)
+{
+	nni_free(snap, snap->ps_size);
+}
+
+
+// nni_pipeset_swap installs a new current snapshot, retiring the old one.
+// Must be called with the lock held.
+static void
+nni_pipeset_swap(nni_pipeset *ps, nni_pipeset_snap *snap)
+{
+	nni_pipeset_snap *old = ps->ps_cur;
+
+	snap->ps_gen = ++ps->ps_gen;
+	ps->ps_cur = snap;
+	if (--old->ps_refcnt == 0) {
+		nni_pipeset_snap_free(old);
+	} else {
+		ps->ps_nretired++;
+	}
+}
+
+
+int
+nni_pipeset_create(nni_pipeset **psp)
+{
+	nni_pipeset *ps;
+	int rv;
+
+	if ((ps = NNI_ALLOC_STRUCT(ps)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	if ((rv = nni_mtx_init(&ps->ps_mx)) != 0) {
+		NNI_FREE_STRUCT(ps);
+		return (rv);
+	}
+	if ((rv = nni_cv_init(&ps->ps_cv, &ps->ps_mx)) != 0) {
+		nni_mtx_fini(&ps->ps_mx);
+		NNI_FREE_STRUCT(ps);
+		return (rv);
+	}
+	if ((ps->ps_cur = nni_pipeset_snap_alloc(0)) == NULL) {
+		nni_cv_fini(&ps->ps_cv);
+		nni_mtx_fini(&ps->ps_mx);
+		NNI_FREE_STRUCT(ps);
+		return (NNG_ENOMEM);
+	}
+	ps->ps_cur->ps_gen = 0;
+	ps->ps_gen = 0;
+	ps->ps_nretired = 0;
+	ps->ps_editing = 0;
+	*psp = ps;
+	return (0);
+}
+
+
+void
+nni_pipeset_destroy(nni_pipeset *ps)
+{
+	nni_pipeset_sync(ps);
+	nni_pipeset_snap_free(ps->ps_cur);
+	nni_cv_fini(&ps->ps_cv);
+	nni_mtx_fini(&ps->ps_mx);
+	NNI_FREE_STRUCT(ps);
+}
+
+
+int
+nni_pipeset_add(nni_pipeset *ps, void *item)
+{
+	nni_pipeset_snap *old;
+	nni_pipeset_snap *snap;
+	int i;
+
+	// Membership changes are serialized by the caller, so the current
+	// snapshot cannot change underneath us while we copy it.
+	old = ps->ps_cur;
+	if ((snap = nni_pipeset_snap_alloc(old->ps_npipes + 1)) == NULL) {
+		return (NNG_ENOMEM);
+	}
+	for (i = 0; i < old->ps_npipes; i++) {
+		snap->ps_pipes[i] = old->ps_pipes[i];
+	}
+	snap->ps_pipes[i] = item;
+
+	nni_mtx_lock(&ps->ps_mx);
+	nni_pipeset_swap(ps, snap);
+	nni_mtx_unlock(&ps->ps_mx);
+	return (0);
+}
+
+
+void
+nni_pipeset_remove(nni_pipeset *ps, void *item)
+{
+	nni_pipeset_snap *old;
+	nni_pipeset_snap *snap;
+	int i;
+	int j;
+
+	old = ps->ps_cur;
+	for (i = 0; i < old->ps_npipes; i++) {
+		if (old->ps_pipes[i] == item) {
+			break;
+		}
+	}
+	if (i == old->ps_npipes) {
+		return;
+	}
+
+	if ((snap = nni_pipeset_snap_alloc(old->ps_npipes - 1)) != NULL) {
+		for (i = 0, j = 0; i < old->ps_npipes; i++) {
+			if (old->ps_pipes[i] != item) {
+				snap->ps_pipes[j++] = old->ps_pipes[i];
+			}
+		}
+		nni_mtx_lock(&ps->ps_mx);
+		nni_pipeset_swap(ps, snap);
+		nni_mtx_unlock(&ps->ps_mx);
+		return;
+	}
+
+	// Out of memory.  Keep new readers out, wait for the existing ones
+	// to finish, and then it is safe to edit the snapshot in place.
+	nni_mtx_lock(&ps->ps_mx);
+	ps->ps_editing = 1;
+	while (old->ps_refcnt > 1) {
+		nni_cv_wait(&ps->ps_cv);
+	}
+	for (i = 0, j = 0; i < old->ps_npipes; i++) {
+		if (old->ps_pipes[i] != item) {
+			old->ps_pipes[j++] = old->ps_pipes[i];
+		}
+	}
+	old->ps_npipes = j;
+	old->ps_gen = ++ps->ps_gen;
+	ps->ps_editing = 0;
+	nni_cv_wake(&ps->ps_cv);
+	nni_mtx_unlock(&ps->ps_mx);
+}
+
+
+nni_pipeset_snap *
+nni_pipeset_hold(nni_pipeset *ps)
+{
+	nni_pipeset_snap *snap;
+
+	nni_mtx_lock(&ps->ps_mx);
+	while (ps->ps_editing) {
+		nni_cv_wait(&ps->ps_cv);
+	}
+	snap = ps->ps_cur;
+	snap->ps_refcnt++;
+	nni_mtx_unlock(&ps->ps_mx);
+	return (snap);
+}
+
+
+void
+nni_pipeset_rele(nni_pipeset *ps, nni_pipeset_snap *snap)
+{
+	nni_mtx_lock(&ps->ps_mx);
+	if (--snap->ps_refcnt == 0) {
+		// Only retired snapshots can reach zero; the set holds
+		// a reference on the current one.
+		nni_pipeset_snap_free(snap);
+		if (--ps->ps_nretired == 0) {
+			nni_cv_wake(&ps->ps_cv);
+		}
+	} else if (ps->ps_editing && (snap->ps_refcnt == 1)) {
+		nni_cv_wake(&ps->ps_cv);
+	}
+	nni_mtx_unlock(&ps->ps_mx);
+}
+
+
+void
+nni_pipeset_sync(nni_pipeset *ps)
+{
+	nni_mtx_lock(&ps->ps_mx);
+	while (ps->ps_nretired != 0) {
+		nni_cv_wait(&ps->ps_cv);
+	}
+	nni_mtx_unlock(&ps->ps_mx);
+}
@@ -0,0 +1,57 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_PIPESET_H
+#define CORE_PIPESET_H
+
+#include "core/nng_impl.h"
+
+// A pipe set is a collection of protocol pipes, intended for protocols
+// that fan a message out to every peer (PUB, BUS).  Readers take a
+// reference on an immutable snapshot of the membership, and may then walk
+// it without holding any locks, and in particular without the socket lock.
+// Adding or removing a member builds a new snapshot (copy-on-write), and
+// the old one is freed when the last reader releases it.
+//
+// Because a reader may still be using a pipe that was just removed, the
+// protocol must call nni_pipeset_sync before freeing the pipe's resources.
+// Membership changes must be serialized by the caller (the socket lock
+// does this for pipe_add and pipe_rem).
+
+typedef struct nni_pipeset	nni_pipeset;
+
+typedef struct nni_pipeset_snap {
+	int		ps_refcnt;
+	int		ps_npipes;
+	uint64_t	ps_gen;         // changes whenever membership does
+	size_t		ps_size;
+	void **		ps_pipes;
+} nni_pipeset_snap;
+
+extern int nni_pipeset_create(nni_pipeset **);
+extern void nni_pipeset_destroy(nni_pipeset *);
+
+// nni_pipeset_add adds the item to the set.  It can fail with NNG_ENOMEM.
+extern int nni_pipeset_add(nni_pipeset *, void *);
+
+// nni_pipeset_remove removes the item from the set.  This never fails;
+// if a new snapshot cannot be allocated, it waits for readers to drain
+// and edits the current snapshot in place instead.
+extern void nni_pipeset_remove(nni_pipeset *, void *);
+
+// nni_pipeset_hold returns the current snapshot, with a reference held.
+// The caller must release it with nni_pipeset_rele.
+extern nni_pipeset_snap *nni_pipeset_hold(nni_pipeset *);
+extern void nni_pipeset_rele(nni_pipeset *, nni_pipeset_snap *);
+
+// nni_pipeset_sync waits until no reader holds a snapshot older than the
+// current one.  After this returns, removed items are no longer in use.
+extern void nni_pipeset_sync(nni_pipeset *);
+
+#endif  // CORE_PIPESET_H
@@ -63,6 +63,7 @@ extern void nni_free(void *, size_t);
 typedef struct nni_plat_mtx		nni_plat_mtx;
 typedef struct nni_plat_cv		nni_plat_cv;
 typedef struct nni_plat_thr		nni_plat_thr;
+typedef struct nni_plat_tls		nni_plat_tls;
 typedef struct nni_plat_tcpsock		nni_plat_tcpsock;
 typedef struct nni_plat_ipcsock		nni_plat_ipcsock;
 
@@ -102,6 +103,12 @@ extern void nni_plat_cv_fini(nni_plat_cv *);
 // called with the lock held.
 extern void nni_plat_cv_wake(nni_plat_cv *);
 
+// nni_plat_cv_wake1 wakes at least one waiter on the condition, if there
+// are any.  This is for when any single waiter can handle the change, and
+// waking the rest would only have them find nothing to do.  This should
+// be called with the lock held.
+extern void nni_plat_cv_wake1(nni_plat_cv *);
+
 // nni_plat_cv_wait waits for a wake up on the condition variable.  The
 // associated lock is atomically released and reacquired upon wake up.
 // Callers can be spuriously woken.  The associated lock must be held.
@@ -123,6 +130,38 @@ extern int nni_plat_thr_init(nni_plat_thr *, void (*)(void *), void *);
 // is an error to reference the thread in any further way.
 extern void nni_plat_thr_fini(nni_plat_thr *);
 
+// nni_plat_thr_affinity restricts the thread to the CPUs in the mask.
+// CPU n is bit (n % 8) of byte (n / 8); an empty mask allows all CPUs.
+// Platforms that cannot bind threads return NNG_ENOTSUP, and a mask that
+// names no usable CPU is NNG_EINVAL.
+extern int nni_plat_thr_affinity(nni_plat_thr *, const uint8_t *, size_t);
+
+// nni_plat_affinity_check returns what nni_plat_thr_affinity would make of
+// the mask, without binding any thread.
+extern int nni_plat_affinity_check(const uint8_t *, size_t);
+
+// nni_plat_ncpu returns the number of CPUs online when the platform was
+// initialized, or 1 if that is unknown.  Spinning is pointless with a
+// single CPU, since whatever we wait for cannot run while we spin.
+extern int nni_plat_ncpu(void);
+
+// nni_plat_tls_init creates a thread local storage key.  Each thread sees
+// its own value for the key, which starts out NULL.  If the destructor is
+// not NULL, it is called with the value when a thread that stored a non-NULL
+// value exits.  This may fail with NNG_ENOMEM.
+extern int nni_plat_tls_init(nni_plat_tls *, void (*)(void *));
+
+// nni_plat_tls_fini releases the key.  Destructors are not run for any
+// values still stored, so the caller must clean those up itself.
+extern void nni_plat_tls_fini(nni_plat_tls *);
+
+// nni_plat_tls_get returns the calling thread's value for the key.  This
+// is used on hot paths, and should be as cheap as the platform allows.
+extern void *nni_plat_tls_get(nni_plat_tls *);
+
+// nni_plat_tls_set sets the calling thread's value for the key.
+extern int nni_plat_tls_set(nni_plat_tls *, void *);
+
 // nn_clock returns a number of microseconds since some arbitrary time
 // in the past.  The values returned by nni_clock must use the same base
 // as the times used in nni_cond_waituntil.  The nni_clock() must return
@@ -131,6 +170,14 @@ extern void nni_plat_thr_fini(nni_plat_thr *);
 // of using negative values for other purposes in the future.)
 extern nni_time nni_clock(void);
 
+// nni_clock_coarse is a cheaper nni_clock, for computing deadlines on hot
+// paths where a tick of slop does not matter.  It uses the same base as
+// nni_clock, but is padded by its resolution so that it is never behind
+// nni_clock; a deadline computed from it may be late, but never early.
+// For that reason it should not be used to check whether a deadline has
+// passed.  Platforms without a cheaper clock can just call nni_clock.
+extern nni_time nni_clock_coarse(void);
+
 // nni_usleep sleeps for the specified number of microseconds (at least).
 extern void nni_usleep(nni_duration);
 
@@ -185,7 +232,13 @@ extern void nni_plat_tcp_shutdown(nni_plat_tcpsock *);
 // nni_plat_tcp_listen creates a TCP socket in listening mode, bound
 // to the specified address.  Note that nni_plat_tcpsock should be defined
 // to whatever your platform uses.  For most systems its just "int".
-extern int nni_plat_tcp_listen(nni_plat_tcpsock *, const nni_sockaddr *);
+// The backlog is the depth of the pending connection queue.  The flags
+// may include NNI_FLAG_REUSEPORT, which requests that several sockets be
+// permitted to bind the same address, with the system distributing inbound
+// connections between them.  Platforms lacking this should return
+// NNG_ENOTSUP if it is requested.
+extern int nni_plat_tcp_listen(nni_plat_tcpsock *, const nni_sockaddr *,
+    int, int);
 
 // nni_plat_tcp_accept does the accept to accept an inbound connection.
 // The tcpsock used for the server will have been set up with the
@@ -199,11 +252,26 @@ extern int nni_plat_tcp_accept(nni_plat_tcpsock *, nni_plat_tcpsock *);
 extern int nni_plat_tcp_connect(nni_plat_tcpsock *, const nni_sockaddr *,
     const nni_sockaddr *);
 
+// nni_plat_tcp_timeout sets a timeout on subsequent sends and receives,
+// after which they fail with NNG_ETIMEDOUT.  A non-positive duration
+// removes the timeout.
+extern int nni_plat_tcp_timeout(nni_plat_tcpsock *, nni_duration);
+
+// nni_plat_tcp_busypoll asks the kernel to busy-poll the device queue for
+// up to the given time (usec) on blocking receives, instead of sleeping
+// until the interrupt.  Platforms without this return NNG_ENOTSUP.
+extern int nni_plat_tcp_busypoll(nni_plat_tcpsock *, nni_duration);
+
 // nni_plat_tcp_send sends data to the remote side.  The platform is
 // responsible for attempting to send all of the data.  The iov count
 // will never be larger than 4.  THe platform may modify the iovs.
 extern int nni_plat_tcp_send(nni_plat_tcpsock *, nni_iov *, int);
 
+// nni_plat_tcp_writable returns non-zero if the kernel has buffer space
+// for the given number of bytes, so that sending them should not have to
+// wait for the peer.  If the platform cannot tell, it returns zero.
+extern int nni_plat_tcp_writable(nni_plat_tcpsock *, size_t);
+
 // nni_plat_tcp_recv recvs data into the buffers provided by the
 // iovs.  The implementation does not return until the iovs are completely
 // full, or an error condition occurs.
@@ -241,6 +309,9 @@ extern int nni_plat_ipc_connect(nni_plat_ipcsock *, const char *);
 // larger than 4.  The platform may modify the iovs.
 extern int nni_plat_ipc_send(nni_plat_ipcsock *, nni_iov *, int);
 
+// nni_plat_ipc_writable is like nni_plat_tcp_writable.
+extern int nni_plat_ipc_writable(nni_plat_ipcsock *, size_t);
+
 // nni_plat_ipc_recv recvs data into the buffers provided by the
 // iovs.  The implementation does not return until the iovs are completely
 // full, or an error condition occurs.
@@ -75,12 +75,25 @@ struct nni_proto_sock_ops {
 	// messages coming into the system are routed here just before being
 	// delivered to the application.  To drop the message, the prtocol
 	// should return NULL, otherwise the message (possibly modified).
+	// Both filters are called with the socket lock held, unless the
+	// protocol has said otherwise with nni_sock_filterlock, and are
+	// not called at all while nni_sock_filterskip is in effect.
 	nni_msg *	(*sock_rfilter)(void *, nni_msg *);
 
 	// Send filter.  This may be NULL, but if it isn't, then messages
 	// here are filtered just after they come from the application.
 	nni_msg *	(*sock_sfilter)(void *, nni_msg *);
 
+	// Direct send.  This may be NULL, but if it isn't, then messages
+	// from the application are handed here, after the send filter,
+	// instead of being placed on the upper write queue.  If a pipe is
+	// idle, the protocol may send the message on the caller's thread;
+	// otherwise it must place the message on the upper write queue
+	// itself, honoring the expiration.  The protocol is responsible for
+	// keeping the two paths in order.  This is called without the
+	// socket lock held.
+	int		(*sock_send)(void *, nni_msg *, nni_time);
+
 	// Worker functions.  If non-NULL, each worker is executed and given
 	// the protocol socket data as an argument.  These will all be started
 	// at about the same time, and all will be started, or none will be
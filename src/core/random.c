@@ -17,6 +17,13 @@
 //
 // Our changes include making this code thread safe/reentrant, and naming
 // and style changes, to fit C99.
+//
+// Pipe IDs, request IDs, and so forth are all drawn from here, so during
+// a storm of new connections a single locked generator would be a point
+// of contention for every socket at once.  Instead each thread gets a
+// generator of its own, seeded from a global one, and only the global
+// one is locked.  When a thread exits its generator is kept, and handed
+// on to the next new thread, by nni_thr_local.
 
 typedef struct {
 	// the rsl is the actual results, and the randcnt is the length
@@ -24,9 +31,6 @@ typedef struct {
 	uint32_t	randrsl[256];
 	uint32_t	randcnt;
 
-	// lock to protect concurrent access
-	nni_mtx		mx;
-
 	// more or less internal state
 	uint32_t	mm[256];
 	uint32_t	aa;
@@ -34,6 +38,11 @@ typedef struct {
 	uint32_t	cc;
 } nni_isaac_ctx;
 
+typedef struct {
+	nni_thr_local_node	r_node;
+	nni_isaac_ctx		r_ctx;
+} nni_random_state;
+
 
 static void
 nni_isaac(nni_isaac_ctx *ctx)
@@ -150,7 +159,39 @@ nni_isaac_randinit(nni_isaac_ctx *ctx, int flag)
 }
 
 
+static uint32_t
+nni_isaac_next(nni_isaac_ctx *ctx)
+{
+	if (ctx->randcnt < 1) {
+		nni_isaac(ctx);
+		ctx->randcnt = 256;
+	}
+	ctx->randcnt--;
+	return (ctx->randrsl[ctx->randcnt]);
+}
+
+
+static nni_mtx nni_random_mx;
 static nni_isaac_ctx nni_random_ctx;
+static nni_thr_local nni_random_states;
+
+// nni_random_state_create seeds a new thread's generator from the global
+// one.
+static int
+nni_random_state_create(void *arg)
+{
+	nni_random_state *r = arg;
+	int i;
+
+	nni_mtx_lock(&nni_random_mx);
+	for (i = 0; i < 256; i++) {
+		r->r_ctx.randrsl[i] = nni_isaac_next(&nni_random_ctx);
+	}
+	nni_mtx_unlock(&nni_random_mx);
+	nni_isaac_randinit(&r->r_ctx, 1);
+	return (0);
+}
+
 
 int
 nni_random_init(void)
@@ -159,7 +200,12 @@ nni_random_init(void)
 	nni_isaac_ctx *ctx = &nni_random_ctx;
 	int rv;
 
-	if ((rv = nni_mtx_init(&ctx->mx)) != 0) {
+	if ((rv = nni_mtx_init(&nni_random_mx)) != 0) {
+		return (rv);
+	}
+	if ((rv = NNI_THR_LOCAL_INIT(&nni_random_states, nni_random_state,
+	    r_node, nni_random_state_create)) != 0) {
+		nni_mtx_fini(&nni_random_mx);
 		return (rv);
 	}
 
@@ -172,18 +218,18 @@ nni_random_init(void)
 uint32_t
 nni_random(void)
 {
+	nni_random_state *r;
 	uint32_t rv;
-	nni_isaac_ctx *ctx = &nni_random_ctx;
 
-	nni_mtx_lock(&ctx->mx);
-	if (ctx->randcnt < 1) {
-		nni_isaac(ctx);
-		ctx->randcnt = 256;
+	// If this thread cannot have a generator of its own, fall back to
+	// the global one.
+	if ((r = nni_thr_local_get(&nni_random_states)) != NULL) {
+		return (nni_isaac_next(&r->r_ctx));
 	}
-	ctx->randcnt--;
-	rv = ctx->randrsl[ctx->randcnt];
-	nni_mtx_unlock(&ctx->mx);
 
+	nni_mtx_lock(&nni_random_mx);
+	rv = nni_isaac_next(&nni_random_ctx);
+	nni_mtx_unlock(&nni_random_mx);
 	return (rv);
 }
 
@@ -191,5 +237,6 @@ nni_random(void)
 void
 nni_random_fini(void)
 {
-	nni_mtx_fini(&nni_random_ctx.mx);
+	nni_thr_local_fini(&nni_random_states);
+	nni_mtx_fini(&nni_random_mx);
 }
@@ -18,9 +18,11 @@ extern int nni_random_init(void);
 extern void nni_random_fini(void);
 
 // nni_random returns a random 32-bit integer.  Note that this routine is
-// thread-safe/reentrant.  The pRNG is very robust, should be of crypto
-// quality.  However, its usefulness for cryptography will be determined
-// by the quality of the seeding material provided by the platform.
+// thread-safe/reentrant, and takes no lock in the common case, as each
+// thread draws from a generator of its own.  The pRNG is very robust,
+// should be of crypto quality.  However, its usefulness for cryptography
+// will be determined by the quality of the seeding material provided by
+// the platform.
 extern uint32_t nni_random(void);
 
 #endif // CORE_RANDOM_H
@@ -0,0 +1,153 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/nng_impl.h"
+
+// Reaper pool.  The lock here is a leaf; nothing else is taken while it
+// is held, and it may be taken while holding any other lock.  At
+// shutdown the workers finish whatever is queued before they exit, so
+// that sockets closed in the background are really closed.
+
+typedef struct nni_reaper {
+	nni_mtx		r_mx;
+	nni_cv		r_cv;
+	nni_list	r_workq;
+	int		r_closing;
+	nni_thr		r_thrs[NNI_REAP_NTHREADS];
+} nni_reaper;
+
+static nni_reaper nni_reapers;
+
+static void
+nni_reap_worker(void *arg)
+{
+	nni_reaper *r = arg;
+	nni_reap_item *item;
+	nni_reap_func func;
+	void *farg;
+
+	nni_mtx_lock(&r->r_mx);
+	for (;;) {
+		if ((item = nni_list_first(&r->r_workq)) == NULL) {
+			if (r->r_closing) {
+				break;
+			}
+			nni_cv_wait(&r->r_cv);
+			continue;
+		}
+		nni_list_remove(&r->r_workq, item);
+		func = item->r_func;
+		farg = item->r_arg;
+		nni_mtx_unlock(&r->r_mx);
+
+		// The item may be gone once this returns.
+		func(farg);
+
+		nni_mtx_lock(&r->r_mx);
+	}
+	nni_mtx_unlock(&r->r_mx);
+}
+
+
+void
+nni_reap_item_init(nni_reap_item *item)
+{
+	NNI_LIST_NODE_INIT(&item->r_node);
+	item->r_func = NULL;
+	item->r_arg = NULL;
+}
+
+
+void
+nni_reap(nni_reap_item *item, nni_reap_func func, void *arg)
+{
+	nni_reaper *r = &nni_reapers;
+
+	nni_mtx_lock(&r->r_mx);
+	item->r_func = func;
+	item->r_arg = arg;
+	nni_list_append(&r->r_workq, item);
+	nni_cv_wake1(&r->r_cv);
+	nni_mtx_unlock(&r->r_mx);
+}
+
+
+int
+nni_reap_cancel(nni_reap_item *item)
+{
+	nni_reaper *r = &nni_reapers;
+	int rv = NNG_ESTATE;
+
+	nni_mtx_lock(&r->r_mx);
+	if (nni_list_active(&r->r_workq, item)) {
+		nni_list_remove(&r->r_workq, item);
+		rv = 0;
+	}
+	nni_mtx_unlock(&r->r_mx);
+	return (rv);
+}
+
+
+int
+nni_reap_init(void)
+{
+	nni_reaper *r = &nni_reapers;
+	int rv;
+	int i;
+
+	if ((rv = nni_mtx_init(&r->r_mx)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_cv_init(&r->r_cv, &r->r_mx)) != 0) {
+		nni_mtx_fini(&r->r_mx);
+		return (rv);
+	}
+	NNI_LIST_INIT(&r->r_workq, nni_reap_item, r_node);
+	r->r_closing = 0;
+
+	for (i = 0; i < NNI_REAP_NTHREADS; i++) {
+		rv = nni_thr_init(&r->r_thrs[i], nni_reap_worker, r);
+		if (rv != 0) {
+			nni_mtx_lock(&r->r_mx);
+			r->r_closing = 1;
+			nni_cv_wake(&r->r_cv);
+			nni_mtx_unlock(&r->r_mx);
+			while (i > 0) {
+				i--;
+				nni_thr_fini(&r->r_thrs[i]);
+			}
+			nni_cv_fini(&r->r_cv);
+			nni_mtx_fini(&r->r_mx);
+			return (rv);
+		}
+	}
+	for (i = 0; i < NNI_REAP_NTHREADS; i++) {
+		nni_thr_run(&r->r_thrs[i]);
+	}
+	return (0);
+}
+
+
+void
+nni_reap_fini(void)
+{
+	nni_reaper *r = &nni_reapers;
+	int i;
+
+	nni_mtx_lock(&r->r_mx);
+	r->r_closing = 1;
+	nni_cv_wake(&r->r_cv);
+	nni_mtx_unlock(&r->r_mx);
+
+	for (i = 0; i < NNI_REAP_NTHREADS; i++) {
+		nni_thr_fini(&r->r_thrs[i]);
+	}
+	nni_cv_fini(&r->r_cv);
+	nni_mtx_fini(&r->r_mx);
+}
@@ -0,0 +1,52 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_REAP_H
+#define CORE_REAP_H
+
+#include "core/nng_impl.h"
+
+// The reaper is a small pool of threads, shared by all sockets, that
+// tears down objects which cannot be destroyed by the thread closing
+// them -- usually because that would mean waiting for the thread itself.
+// Pipes are reaped here once closed, and sockets closed with
+// nng_close_async are shut down and freed here.  Items are run in the
+// order they were queued, but several may be running at once.
+
+// NNI_REAP_NTHREADS is the number of reaper threads in the pool.
+#define NNI_REAP_NTHREADS	4
+
+typedef void (*nni_reap_func)(void *);
+
+typedef struct nni_reap_item {
+	nni_list_node	r_node;
+	nni_reap_func	r_func;
+	void *		r_arg;
+} nni_reap_item;
+
+extern int nni_reap_init(void);
+extern void nni_reap_fini(void);
+
+// nni_reap_item_init prepares an item for use.  It must be called once,
+// before the item is first queued.
+extern void nni_reap_item_init(nni_reap_item *);
+
+// nni_reap queues the item, so that a reaper thread will call func with
+// arg.  The item must not already be queued.  The reaper does not touch
+// the item again once it has called the function, so the function may
+// free it.
+extern void nni_reap(nni_reap_item *, nni_reap_func, void *);
+
+// nni_reap_cancel takes the item back off the queue, if it is still
+// waiting there, and returns zero.  If it is not queued, either because
+// the function has already been called, or because it was never queued,
+// NNG_ESTATE is returned.  The caller must know which case applies.
+extern int nni_reap_cancel(nni_reap_item *);
+
+#endif  // CORE_REAP_H
@@ -0,0 +1,300 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "core/nng_impl.h"
+
+// Name resolution cache.  Entries live on an LRU list (most recently used
+// at the front), and entries that need a lookup are also placed on the
+// work queue, which is serviced by the resolver threads.  A single condition
+// variable is used for all completions; lookups are rare enough that the
+// thundering herd is not a concern.
+
+typedef struct nni_resolv_ent {
+	nni_list_node	re_node;        // LRU linkage
+	nni_list_node	re_qnode;       // work queue linkage
+	char		re_host[NNG_MAXADDRLEN+1];
+	int		re_flags;
+	int		re_valid;       // a result is present
+	int		re_pending;     // a lookup is queued or running
+	int		re_refcnt;      // callers waiting on this entry
+	int		re_rv;          // result of the last lookup
+	nni_sockaddr	re_addr;
+	nni_time	re_expire;
+} nni_resolv_ent;
+
+typedef struct nni_resolv {
+	nni_mtx		r_mx;
+	nni_cv		r_cv;
+	nni_list	r_ents;
+	nni_list	r_workq;
+	int		r_nents;
+	int		r_closing;
+	nni_resolv_func r_lookup;
+	nni_thr		r_thrs[NNI_RESOLV_NTHREADS];
+} nni_resolv;
+
+static nni_resolv nni_resolver;
+
+static void
+nni_resolv_worker(void *arg)
+{
+	nni_resolv *r = arg;
+	nni_resolv_ent *ent;
+	nni_resolv_func fn;
+	nni_sockaddr addr;
+	const char *host;
+	int rv;
+
+	nni_mtx_lock(&r->r_mx);
+	for (;;) {
+		if (r->r_closing) {
+			break;
+		}
+		if ((ent = nni_list_first(&r->r_workq)) == NULL) {
+			nni_cv_wait(&r->r_cv);
+			continue;
+		}
+		nni_list_remove(&r->r_workq, ent);
+		fn = r->r_lookup;
+
+		// The entry cannot be discarded while it is pending, so it
+		// is safe to reference the host without the lock.
+		host = ent->re_host[0] == '\0' ? NULL : ent->re_host;
+		nni_mtx_unlock(&r->r_mx);
+
+		memset(&addr, 0, sizeof (addr));
+		rv = fn(host, &addr, ent->re_flags);
+
+		nni_mtx_lock(&r->r_mx);
+		if ((rv == 0) || (!ent->re_valid) || (ent->re_rv != 0)) {
+			// If a refresh of a good entry fails, keep using
+			// the old address; it is probably still right.
+			ent->re_addr = addr;
+			ent->re_rv = rv;
+		}
+		ent->re_expire = nni_clock() +
+		    (rv == 0 ? NNI_RESOLV_TTL : NNI_RESOLV_NEGTTL);
+		ent->re_valid = 1;
+		ent->re_pending = 0;
+		nni_cv_wake(&r->r_cv);
+	}
+	nni_mtx_unlock(&r->r_mx);
+}
+
+
+static void
+nni_resolv_discard(nni_resolv *r, nni_resolv_ent *ent)
+{
+	nni_list_remove(&r->r_ents, ent);
+	r->r_nents--;
+	NNI_FREE_STRUCT(ent);
+}
+
+
+// nni_resolv_evict trims the cache back down to size.  Entries that are
+// in use (pending or waited on) are skipped.  Must be called with the lock.
+static void
+nni_resolv_evict(nni_resolv *r)
+{
+	nni_resolv_ent *ent;
+	nni_resolv_ent *prev;
+
+	ent = nni_list_last(&r->r_ents);
+	while ((ent != NULL) && (r->r_nents > NNI_RESOLV_MAXENTS)) {
+		prev = nni_list_prev(&r->r_ents, ent);
+		if ((!ent->re_pending) && (ent->re_refcnt == 0)) {
+			nni_resolv_discard(r, ent);
+		}
+		ent = prev;
+	}
+}
+
+
+static void
+nni_resolv_queue(nni_resolv *r, nni_resolv_ent *ent)
+{
+	ent->re_pending = 1;
+	nni_list_append(&r->r_workq, ent);
+	nni_cv_wake(&r->r_cv);
+}
+
+
+int
+nni_resolv_lookup(const char *host, nni_sockaddr *addr, int flags)
+{
+	nni_resolv *r = &nni_resolver;
+	nni_resolv_ent *ent;
+	int rv;
+
+	if (host == NULL) {
+		host = "";
+	}
+	if (strlen(host) > NNG_MAXADDRLEN) {
+		return (NNG_EADDRINVAL);
+	}
+
+	nni_mtx_lock(&r->r_mx);
+	if (r->r_closing) {
+		nni_mtx_unlock(&r->r_mx);
+		return (NNG_ECLOSED);
+	}
+	NNI_LIST_FOREACH (&r->r_ents, ent) {
+		if ((ent->re_flags == flags) &&
+		    (strcmp(ent->re_host, host) == 0)) {
+			break;
+		}
+	}
+	if (ent == NULL) {
+		if ((ent = NNI_ALLOC_STRUCT(ent)) == NULL) {
+			nni_mtx_unlock(&r->r_mx);
+			return (NNG_ENOMEM);
+		}
+		NNI_LIST_NODE_INIT(&ent->re_node);
+		NNI_LIST_NODE_INIT(&ent->re_qnode);
+		(void) strcpy(ent->re_host, host);
+		ent->re_flags = flags;
+		ent->re_valid = 0;
+		ent->re_refcnt = 0;
+		nni_list_prepend(&r->r_ents, ent);
+		r->r_nents++;
+		nni_resolv_queue(r, ent);
+		nni_resolv_evict(r);
+	} else {
+		// Move to the front of the LRU list.
+		nni_list_remove(&r->r_ents, ent);
+		nni_list_prepend(&r->r_ents, ent);
+	}
+
+	if (ent->re_valid && (!ent->re_pending) &&
+	    (nni_clock() >= ent->re_expire)) {
+		nni_resolv_queue(r, ent);
+	}
+
+	// A stale positive entry is good enough to use while the refresh
+	// runs; otherwise we have to wait for the lookup to finish.
+	ent->re_refcnt++;
+	while ((!ent->re_valid) || (ent->re_pending && (ent->re_rv != 0))) {
+		if (r->r_closing) {
+			break;
+		}
+		nni_cv_wait(&r->r_cv);
+	}
+	ent->re_refcnt--;
+
+	if (!ent->re_valid) {
+		rv = NNG_ECLOSED;
+	} else if ((rv = ent->re_rv) == 0) {
+		*addr = ent->re_addr;
+	}
+	nni_mtx_unlock(&r->r_mx);
+	return (rv);
+}
+
+
+void
+nni_resolv_flush(void)
+{
+	nni_resolv *r = &nni_resolver;
+	nni_resolv_ent *ent;
+	nni_resolv_ent *next;
+
+	nni_mtx_lock(&r->r_mx);
+	ent = nni_list_first(&r->r_ents);
+	while (ent != NULL) {
+		next = nni_list_next(&r->r_ents, ent);
+		if ((!ent->re_pending) && (ent->re_refcnt == 0)) {
+			nni_resolv_discard(r, ent);
+		}
+		ent = next;
+	}
+	nni_mtx_unlock(&r->r_mx);
+}
+
+
+void
+nni_resolv_set_lookup(nni_resolv_func fn)
+{
+	nni_resolv *r = &nni_resolver;
+
+	nni_mtx_lock(&r->r_mx);
+	r->r_lookup = fn != NULL ? fn : nni_plat_lookup_host;
+	nni_mtx_unlock(&r->r_mx);
+	nni_resolv_flush();
+}
+
+
+int
+nni_resolv_init(void)
+{
+	nni_resolv *r = &nni_resolver;
+	int rv;
+	int i;
+
+	if ((rv = nni_mtx_init(&r->r_mx)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_cv_init(&r->r_cv, &r->r_mx)) != 0) {
+		nni_mtx_fini(&r->r_mx);
+		return (rv);
+	}
+	NNI_LIST_INIT(&r->r_ents, nni_resolv_ent, re_node);
+	NNI_LIST_INIT(&r->r_workq, nni_resolv_ent, re_qnode);
+	r->r_nents = 0;
+	r->r_closing = 0;
+	r->r_lookup = nni_plat_lookup_host;
+
+	for (i = 0; i < NNI_RESOLV_NTHREADS; i++) {
+		rv = nni_thr_init(&r->r_thrs[i], nni_resolv_worker, r);
+		if (rv != 0) {
+			nni_mtx_lock(&r->r_mx);
+			r->r_closing = 1;
+			nni_cv_wake(&r->r_cv);
+			nni_mtx_unlock(&r->r_mx);
+			while (i > 0) {
+				i--;
+				nni_thr_fini(&r->r_thrs[i]);
+			}
+			nni_cv_fini(&r->r_cv);
+			nni_mtx_fini(&r->r_mx);
+			return (rv);
+		}
+	}
+	for (i = 0; i < NNI_RESOLV_NTHREADS; i++) {
+		nni_thr_run(&r->r_thrs[i]);
+	}
+	return (0);
+}
+
+
+void
+nni_resolv_fini(void)
+{
+	nni_resolv *r = &nni_resolver;
+	nni_resolv_ent *ent;
+	int i;
+
+	nni_mtx_lock(&r->r_mx);
+	r->r_closing = 1;
+	nni_cv_wake(&r->r_cv);
+	nni_mtx_unlock(&r->r_mx);
+
+	for (i = 0; i < NNI_RESOLV_NTHREADS; i++) {
+		nni_thr_fini(&r->r_thrs[i]);
+	}
+	while ((ent = nni_list_first(&r->r_workq)) != NULL) {
+		nni_list_remove(&r->r_workq, ent);
+	}
+	while ((ent = nni_list_first(&r->r_ents)) != NULL) {
+		nni_resolv_discard(r, ent);
+	}
+	nni_cv_fini(&r->r_cv);
+	nni_mtx_fini(&r->r_mx);
+}
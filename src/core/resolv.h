@@ -0,0 +1,57 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_RESOLV_H
+#define CORE_RESOLV_H
+
+#include "core/nng_impl.h"
+
+// The resolver sits between transports and nni_plat_lookup_host.  Name
+// lookups are performed by a small pool of resolver threads, and results
+// (both positive and negative) are cached process wide, so that dialers
+// retrying against the same host do not each pay for a blocking lookup.
+// Concurrent lookups for the same name are coalesced into a single request.
+
+// NNI_RESOLV_TTL is how long a successful lookup is considered fresh.
+// Once this expires, the stale address is still handed out, but a refresh
+// is queued to the resolver pool in the background.
+#define NNI_RESOLV_TTL		(30 * NNI_SECOND)
+
+// NNI_RESOLV_NEGTTL is how long a failed lookup is remembered.  Callers
+// asking for the name during this period get the failure immediately.
+#define NNI_RESOLV_NEGTTL	(5 * NNI_SECOND)
+
+// NNI_RESOLV_NTHREADS is the number of resolver threads in the pool.
+#define NNI_RESOLV_NTHREADS	4
+
+// NNI_RESOLV_MAXENTS is the soft limit on cached names.  Least recently
+// used entries are discarded beyond this.
+#define NNI_RESOLV_MAXENTS	64
+
+// nni_resolv_func is the signature of the function used to perform the
+// actual lookup.  By default this is nni_plat_lookup_host.
+typedef int (*nni_resolv_func)(const char *, nni_sockaddr *, int);
+
+extern int nni_resolv_init(void);
+extern void nni_resolv_fini(void);
+
+// nni_resolv_lookup resolves the host, using the cache when possible.
+// The host may be NULL, meaning the wildcard (passive) address.  The flags
+// are the same as for nni_plat_lookup_host.
+extern int nni_resolv_lookup(const char *, nni_sockaddr *, int);
+
+// nni_resolv_set_lookup replaces the lookup function, which is useful for
+// testing.  Passing NULL restores the platform default.  The cache is
+// flushed as a side effect.
+extern void nni_resolv_set_lookup(nni_resolv_func);
+
+// nni_resolv_flush discards all cached results that are not in use.
+extern void nni_resolv_flush(void);
+
+#endif  // CORE_RESOLV_H
@@ -13,6 +13,34 @@
 
 // Socket implementation.
 
+// A few flags are set with the lock held, but read on the send and
+// receive paths without it.  These are accessed with nni_sock_get and
+// nni_sock_set, which order them against the other memory accesses.
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+#define NNI_SOCK_BARRIER()	__sync_synchronize()
+#else
+#define NNI_SOCK_BARRIER()
+#endif
+
+static int
+nni_sock_get(volatile int *flag)
+{
+	int val = *flag;
+
+	NNI_SOCK_BARRIER();
+	return (val);
+}
+
+
+static void
+nni_sock_set(volatile int *flag, int val)
+{
+	NNI_SOCK_BARRIER();
+	*flag = val;
+	NNI_SOCK_BARRIER();
+}
+
+
 // nni_sock_sendq and nni_sock_recvq are called by the protocol to obtain
 // the upper read and write queues.
 nni_msgq *
@@ -29,59 +57,6 @@ nni_sock_recvq(nni_sock *s)
 }
 
 
-// Because we have to call back into the socket, and possibly also the proto,
-// and wait for threads to terminate, we do this in a special thread.  The
-// assumption is that closing is always a "fast" operation.
-static void
-nni_reaper(void *arg)
-{
-	nni_sock *sock = arg;
-
-	for (;;) {
-		nni_pipe *pipe;
-		nni_ep *ep;
-
-		nni_mtx_lock(&sock->s_mx);
-		if ((pipe = nni_list_first(&sock->s_reaps)) != NULL) {
-			nni_list_remove(&sock->s_reaps, pipe);
-
-			if (((ep = pipe->p_ep) != NULL) &&
-			    ((ep->ep_pipe == pipe))) {
-				ep->ep_pipe = NULL;
-				nni_cv_wake(&ep->ep_cv);
-			}
-
-			// Remove the pipe from the protocol.  Protocols may
-			// keep lists of pipes for managing their topologies.
-			// Note that if a protocol has rejected the pipe, it
-			// won't have any data.
-			if (pipe->p_active) {
-				sock->s_pipe_ops.pipe_rem(pipe->p_proto_data);
-			}
-			nni_mtx_unlock(&sock->s_mx);
-
-			// XXX: also publish event...
-
-			// There should be no references left to this pipe.
-			// The various threads will have shutdown, except
-			// the threads that this waits for.
-			nni_pipe_destroy(pipe);
-			continue;
-		}
-
-		if ((sock->s_closing) &&
-		    (nni_list_first(&sock->s_reaps) == NULL) &&
-		    (nni_list_first(&sock->s_pipes) == NULL)) {
-			nni_mtx_unlock(&sock->s_mx);
-			break;
-		}
-
-		nni_cv_wait(&sock->s_cv);
-		nni_mtx_unlock(&sock->s_mx);
-	}
-}
-
-
 nni_mtx *
 nni_sock_mtx(nni_sock *sock)
 {
@@ -135,6 +110,52 @@ nni_sock_nulladdpipe(void *arg)
 }
 
 
+// nni_sock_start starts the protocol's worker threads.  Sockets are often
+// opened and never used, or not used for some time, so this is put off
+// until the socket is first asked to dial, listen, or send.
+static int
+nni_sock_start(nni_sock *sock)
+{
+	int rv = 0;
+	int i;
+
+	if (nni_sock_get(&sock->s_started)) {
+		return (0);
+	}
+	nni_mtx_lock(&sock->s_mx);
+	if (sock->s_closing) {
+		nni_mtx_unlock(&sock->s_mx);
+		return (NNG_ECLOSED);
+	}
+	if (sock->s_started) {
+		nni_mtx_unlock(&sock->s_mx);
+		return (0);
+	}
+
+	// NB: If worker functions are null, then the thread initialization
+	// turns into a NOP, and no actual thread will be started.
+	for (i = 0; i < NNI_MAXWORKERS; i++) {
+		nni_worker fn = sock->s_sock_ops.sock_worker[i];
+		rv = nni_thr_init(&sock->s_worker_thr[i], fn, sock->s_data);
+		if (rv != 0) {
+			while (i > 0) {
+				i--;
+				nni_thr_fini(&sock->s_worker_thr[i]);
+			}
+			nni_mtx_unlock(&sock->s_mx);
+			return (rv);
+		}
+	}
+	for (i = 0; i < NNI_MAXWORKERS; i++) {
+		nni_sock_bindthr(sock, &sock->s_worker_thr[i]);
+		nni_thr_run(&sock->s_worker_thr[i]);
+	}
+	nni_sock_set(&sock->s_started, 1);
+	nni_mtx_unlock(&sock->s_mx);
+	return (0);
+}
+
+
 // nn_sock_open creates the underlying socket.
 int
 nni_sock_open(nni_sock **sockp, uint16_t pnum)
@@ -142,7 +163,6 @@ nni_sock_open(nni_sock **sockp, uint16_t pnum)
 	nni_sock *sock;
 	nni_proto *proto;
 	int rv;
-	int i;
 	nni_proto_sock_ops *sops;
 	nni_proto_pipe_ops *pops;
 
@@ -160,11 +180,16 @@ nni_sock_open(nni_sock **sockp, uint16_t pnum)
 	sock->s_sndtimeo = -1;
 	sock->s_rcvtimeo = -1;
 	sock->s_closing = 0;
+	sock->s_filterlock = 1;
+	sock->s_filterskip = 0;
 	sock->s_reconn = NNI_SECOND;
 	sock->s_reconnmax = NNI_SECOND;
+	sock->s_busypoll = 0;
 	NNI_LIST_INIT(&sock->s_pipes, nni_pipe, p_node);
 	NNI_LIST_INIT(&sock->s_reaps, nni_pipe, p_node);
 	NNI_LIST_INIT(&sock->s_eps, nni_ep, ep_node);
+	NNI_LIST_INIT(&sock->s_eps_closed, nni_ep, ep_node);
+	nni_reap_item_init(&sock->s_reap_item);
 
 	sock->s_sock_ops = *proto->proto_sock_ops;
 	sops = &sock->s_sock_ops;
@@ -196,69 +221,56 @@ nni_sock_open(nni_sock **sockp, uint16_t pnum)
 		NNI_FREE_STRUCT(sock);
 		return (rv);
 	}
-	if ((rv = nni_cv_init(&sock->s_cv, &sock->s_mx)) != 0) {
+	if ((rv = nni_mtx_init(&sock->s_ep_mx)) != 0) {
 		nni_mtx_fini(&sock->s_mx);
 		NNI_FREE_STRUCT(sock);
 		return (rv);
 	}
-
-	if ((rv = nni_thr_init(&sock->s_reaper, nni_reaper, sock)) != 0) {
-		nni_cv_fini(&sock->s_cv);
+	if ((rv = nni_mtx_init(&sock->s_pipe_mx)) != 0) {
+		nni_mtx_fini(&sock->s_ep_mx);
+		nni_mtx_fini(&sock->s_mx);
+		NNI_FREE_STRUCT(sock);
+		return (rv);
+	}
+	if ((rv = nni_cv_init(&sock->s_pipe_cv, &sock->s_pipe_mx)) != 0) {
+		nni_mtx_fini(&sock->s_pipe_mx);
+		nni_mtx_fini(&sock->s_ep_mx);
 		nni_mtx_fini(&sock->s_mx);
 		NNI_FREE_STRUCT(sock);
 		return (rv);
 	}
 
 	if ((rv = nni_msgq_init(&sock->s_uwq, 0)) != 0) {
-		nni_thr_fini(&sock->s_reaper);
-		nni_cv_fini(&sock->s_cv);
+		nni_cv_fini(&sock->s_pipe_cv);
+		nni_mtx_fini(&sock->s_pipe_mx);
+		nni_mtx_fini(&sock->s_ep_mx);
 		nni_mtx_fini(&sock->s_mx);
 		NNI_FREE_STRUCT(sock);
 		return (rv);
 	}
 	if ((rv = nni_msgq_init(&sock->s_urq, 0)) != 0) {
 		nni_msgq_fini(sock->s_uwq);
-		nni_thr_fini(&sock->s_reaper);
-		nni_cv_fini(&sock->s_cv);
+		nni_cv_fini(&sock->s_pipe_cv);
+		nni_mtx_fini(&sock->s_pipe_mx);
+		nni_mtx_fini(&sock->s_ep_mx);
 		nni_mtx_fini(&sock->s_mx);
 		NNI_FREE_STRUCT(sock);
 		return (rv);
 	}
+	nni_msgq_set_trace(sock->s_uwq, 0, NNG_TRACE_UWQ);
+	nni_msgq_set_trace(sock->s_urq, NNG_TRACE_URQ, 0);
 
 	if ((rv = sops->sock_init(&sock->s_data, sock)) != 0) {
 		nni_msgq_fini(sock->s_urq);
 		nni_msgq_fini(sock->s_uwq);
-		nni_thr_fini(&sock->s_reaper);
-		nni_cv_fini(&sock->s_cv);
+		nni_cv_fini(&sock->s_pipe_cv);
+		nni_mtx_fini(&sock->s_pipe_mx);
+		nni_mtx_fini(&sock->s_ep_mx);
 		nni_mtx_fini(&sock->s_mx);
 		NNI_FREE_STRUCT(sock);
 		return (rv);
 	}
 
-	// NB: If worker functions are null, then the thread initialization
-	// turns into a NOP, and no actual thread will be started.
-	for (i = 0; i < NNI_MAXWORKERS; i++) {
-		nni_worker fn = sops->sock_worker[i];
-		rv = nni_thr_init(&sock->s_worker_thr[i], fn, sock->s_data);
-		if (rv != 0) {
-			while (i > 0) {
-				i--;
-				nni_thr_fini(&sock->s_worker_thr[i]);
-			}
-			sops->sock_fini(&sock->s_data);
-			nni_msgq_fini(sock->s_urq);
-			nni_msgq_fini(sock->s_uwq);
-			nni_cv_fini(&sock->s_cv);
-			nni_mtx_fini(&sock->s_mx);
-			NNI_FREE_STRUCT(sock);
-		}
-	}
-
-	for (i = 0; i < NNI_MAXWORKERS; i++) {
-		nni_thr_run(&sock->s_worker_thr[i]);
-	}
-
-	nni_thr_run(&sock->s_reaper);
 	*sockp = sock;
 	return (0);
 }
@@ -282,25 +294,30 @@ nni_sock_shutdown(nni_sock *sock)
 		return (NNG_ECLOSED);
 	}
 	// Mark us closing, so no more EPs or changes can occur.
-	sock->s_closing = 1;
+	nni_sock_set(&sock->s_closing, 1);
+	linger = sock->s_linger;
+	nni_mtx_unlock(&sock->s_mx);
 
 	// Stop all EPS.  We're going to do this first, since we know
 	// we're closing.
+	nni_mtx_lock(&sock->s_ep_mx);
 	while ((ep = nni_list_first(&sock->s_eps)) != NULL) {
-		nni_mtx_unlock(&sock->s_mx);
+		nni_mtx_unlock(&sock->s_ep_mx);
 		nni_ep_close(ep);
-		nni_mtx_lock(&sock->s_mx);
+		nni_mtx_lock(&sock->s_ep_mx);
 	}
+	nni_mtx_unlock(&sock->s_ep_mx);
 
 	// Special optimization; if there are no pipes connected,
 	// then there is no reason to linger since there's nothing that
 	// could possibly send this data out.
+	nni_mtx_lock(&sock->s_pipe_mx);
 	if (nni_list_first(&sock->s_pipes) == NULL) {
 		linger = NNI_TIME_ZERO;
 	} else {
-		linger = nni_clock() + sock->s_linger;
+		linger += nni_clock();
 	}
-	nni_mtx_unlock(&sock->s_mx);
+	nni_mtx_unlock(&sock->s_pipe_mx);
 
 
 	// We drain the upper write queue.  This is just like closing it,
@@ -313,9 +330,9 @@ nni_sock_shutdown(nni_sock *sock)
 	// writes (e.g. a slow reader on the other side), it should be
 	// trying to shut things down.  We wait to give it
 	// a chance to do so gracefully.
-	nni_mtx_lock(&sock->s_mx);
+	nni_mtx_lock(&sock->s_pipe_mx);
 	while (nni_list_first(&sock->s_pipes) != NULL) {
-		if (nni_cv_until(&sock->s_cv, linger) == NNG_ETIMEDOUT) {
+		if (nni_cv_until(&sock->s_pipe_cv, linger) == NNG_ETIMEDOUT) {
 			break;
 		}
 	}
@@ -335,21 +352,37 @@ nni_sock_shutdown(nni_sock *sock)
 		if (pipe->p_tran_data != NULL) {
 			pipe->p_tran_ops.pipe_close(pipe->p_tran_data);
 		}
-		pipe->p_reap = 1;
-		nni_list_remove(&sock->s_pipes, pipe);
-		nni_list_append(&sock->s_reaps, pipe);
+		nni_pipe_remove(pipe);
 	}
+	nni_mtx_unlock(&sock->s_pipe_mx);
 
+	nni_mtx_lock(&sock->s_mx);
 	sock->s_sock_ops.sock_close(sock->s_data);
-
-	nni_cv_wake(&sock->s_cv);
 	nni_mtx_unlock(&sock->s_mx);
 
-	// Wait for the threads to exit.
-	for (i = 0; i < NNI_MAXWORKERS; i++) {
+	// Wait for the threads to exit.  (They cannot be started now that
+	// we are closing.)
+	for (i = 0; (i < NNI_MAXWORKERS) && sock->s_started; i++) {
 		nni_thr_wait(&sock->s_worker_thr[i]);
 	}
-	nni_thr_wait(&sock->s_reaper);
+
+	// The shared reapers are tearing our pipes down, several at a
+	// time.  We help, by taking back any they have not yet started on.
+	// That also means we never wait on the reapers when they are all
+	// busy -- perhaps closing sockets like this one.
+	nni_mtx_lock(&sock->s_pipe_mx);
+	while ((pipe = nni_list_first(&sock->s_reaps)) != NULL) {
+		nni_list_remove(&sock->s_reaps, pipe);
+		if (nni_reap_cancel(&pipe->p_reap_item) == 0) {
+			nni_mtx_unlock(&sock->s_pipe_mx);
+			nni_pipe_reap(pipe);
+			nni_mtx_lock(&sock->s_pipe_mx);
+		}
+	}
+	while (sock->s_nreap != 0) {
+		nni_cv_wait(&sock->s_pipe_cv);
+	}
+	nni_mtx_unlock(&sock->s_pipe_mx);
 
 	// At this point, there are no threads blocked inside of us
 	// that are referencing socket state.  User code should call
@@ -365,6 +398,7 @@ nni_sock_shutdown(nni_sock *sock)
 void
 nni_sock_close(nni_sock *sock)
 {
+	nni_ep *ep;
 	int i;
 
 	// Shutdown everything if not already done.  This operation
@@ -382,43 +416,85 @@ nni_sock_close(nni_sock *sock)
 	sock->s_sock_ops.sock_fini(sock->s_data);
 
 	// And we need to clean up *our* state.
-	for (i = 0; i < NNI_MAXWORKERS; i++) {
+	for (i = 0; (i < NNI_MAXWORKERS) && sock->s_started; i++) {
 		nni_thr_fini(&sock->s_worker_thr[i]);
 	}
-	nni_thr_fini(&sock->s_reaper);
+	while ((ep = nni_list_first(&sock->s_eps_closed)) != NULL) {
+		nni_list_remove(&sock->s_eps_closed, ep);
+		nni_ep_destroy(ep);
+	}
 	nni_msgq_fini(sock->s_urq);
 	nni_msgq_fini(sock->s_uwq);
-	nni_cv_fini(&sock->s_cv);
+	nni_cv_fini(&sock->s_pipe_cv);
+	nni_mtx_fini(&sock->s_pipe_mx);
+	nni_mtx_fini(&sock->s_ep_mx);
 	nni_mtx_fini(&sock->s_mx);
 	NNI_FREE_STRUCT(sock);
 }
 
 
+static void
+nni_sock_reap(void *arg)
+{
+	nni_sock_close(arg);
+}
+
+
+// nni_sock_close_async is nni_sock_close, but run by the reaper, so that
+// the caller need not wait for the linger time, or for the pipes to be
+// torn down.  The same rules apply; the caller must not reference the
+// socket after this is called.
+void
+nni_sock_close_async(nni_sock *sock)
+{
+	nni_reap(&sock->s_reap_item, nni_sock_reap, sock);
+}
+
+
 int
 nni_sock_sendmsg(nni_sock *sock, nni_msg *msg, nni_time expire)
 {
 	int rv;
 	int besteffort;
 
+	NNI_TRACE_START(msg, NNG_TRACE_SEND);
+
 	// Senderr is typically set by protocols when the state machine
 	// indicates that it is no longer valid to send a message.  E.g.
-	// a REP socket with no REQ pending.
-	nni_mtx_lock(&sock->s_mx);
-	if (sock->s_closing) {
-		nni_mtx_unlock(&sock->s_mx);
+	// a REP socket with no REQ pending.  The flags are checked without
+	// the lock; a close that races with us is caught by the queues.
+	if (nni_sock_get(&sock->s_closing)) {
 		return (NNG_ECLOSED);
 	}
-	if ((rv = sock->s_senderr) != 0) {
-		nni_mtx_unlock(&sock->s_mx);
+	if ((rv = nni_sock_get(&sock->s_senderr)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_sock_start(sock)) != 0) {
 		return (rv);
 	}
 	besteffort = sock->s_besteffort;
 
-	msg = sock->s_sock_ops.sock_sfilter(sock->s_data, msg);
-	nni_mtx_unlock(&sock->s_mx);
-
-	if (msg == NULL) {
-		return (0);
+	// If we race with a change to raw mode, we may skip the filter
+	// once too soon, or call it once too often; the filter takes care
+	// of the latter itself, under the lock.
+	if ((sock->s_sock_ops.sock_sfilter != nni_sock_nullfilter) &&
+	    !nni_sock_get(&sock->s_filterskip)) {
+		if (!sock->s_filterlock) {
+			msg = sock->s_sock_ops.sock_sfilter(sock->s_data, msg);
+		} else {
+			// The filter may change senderr, so look again
+			// now that we hold the lock.
+			nni_mtx_lock(&sock->s_mx);
+			if ((rv = nni_sock_get(&sock->s_senderr)) != 0) {
+				nni_mtx_unlock(&sock->s_mx);
+				return (rv);
+			}
+			msg = sock->s_sock_ops.sock_sfilter(sock->s_data, msg);
+			nni_mtx_unlock(&sock->s_mx);
+		}
+		if (msg == NULL) {
+			return (0);
+		}
 	}
 
 	if (besteffort) {
@@ -426,7 +502,11 @@ nni_sock_sendmsg(nni_sock *sock, nni_msg *msg, nni_time expire)
 		// backpressure, we just throw it away, and don't complain.
 		expire = NNI_TIME_ZERO;
 	}
-	rv = nni_msgq_put_until(sock->s_uwq, msg, expire);
+	if (sock->s_sock_ops.sock_send != NULL) {
+		rv = sock->s_sock_ops.sock_send(sock->s_data, msg, expire);
+	} else {
+		rv = nni_msgq_put_until(sock->s_uwq, msg, expire);
+	}
 	if (besteffort && (rv == NNG_EAGAIN)) {
 		// Pretend this worked... it didn't, but pretend.
 		nni_msg_free(msg);
@@ -442,31 +522,37 @@ nni_sock_recvmsg(nni_sock *sock, nni_msg **msgp, nni_time expire)
 	int rv;
 	nni_msg *msg;
 
-	nni_mtx_lock(&sock->s_mx);
-	if (sock->s_closing) {
-		nni_mtx_unlock(&sock->s_mx);
+	if (nni_sock_get(&sock->s_closing)) {
 		return (NNG_ECLOSED);
 	}
-	if ((rv = sock->s_recverr) != 0) {
-		nni_mtx_unlock(&sock->s_mx);
+	if ((rv = nni_sock_get(&sock->s_recverr)) != 0) {
 		return (rv);
 	}
-	nni_mtx_unlock(&sock->s_mx);
 
 	for (;;) {
 		rv = nni_msgq_get_until(sock->s_urq, &msg, expire);
 		if (rv != 0) {
 			return (rv);
 		}
-		nni_mtx_lock(&sock->s_mx);
-		msg = sock->s_sock_ops.sock_rfilter(sock->s_data, msg);
-		nni_mtx_unlock(&sock->s_mx);
+		if ((sock->s_sock_ops.sock_rfilter == nni_sock_nullfilter) ||
+		    nni_sock_get(&sock->s_filterskip)) {
+			// Nothing to filter, so no need for the lock.
+			break;
+		}
+		if (!sock->s_filterlock) {
+			msg = sock->s_sock_ops.sock_rfilter(sock->s_data, msg);
+		} else {
+			nni_mtx_lock(&sock->s_mx);
+			msg = sock->s_sock_ops.sock_rfilter(sock->s_data, msg);
+			nni_mtx_unlock(&sock->s_mx);
+		}
 		if (msg != NULL) {
 			break;
 		}
 		// Protocol dropped the message; try again.
 	}
 
+	NNI_TRACE(msg, NNG_TRACE_RECV);
 	*msgp = msg;
 	return (0);
 }
@@ -487,27 +573,49 @@ nni_sock_peer(nni_sock *sock)
 }
 
 
+// nni_sock_ep_create creates an idle endpoint on the socket.  It can be
+// configured with nni_ep_setopt before being started with nni_ep_dial or
+// nni_ep_listen.
 int
-nni_sock_dial(nni_sock *sock, const char *addr, nni_ep **epp, int flags)
+nni_sock_ep_create(nni_sock *sock, const char *addr, nni_ep **epp)
 {
 	nni_ep *ep;
 	int rv;
 
-	nni_mtx_lock(&sock->s_mx);
-	if (sock->s_closing) {
-		nni_mtx_unlock(&sock->s_mx);
+	if ((rv = nni_sock_start(sock)) != 0) {
+		return (rv);
+	}
+	nni_mtx_lock(&sock->s_ep_mx);
+	if (nni_sock_get(&sock->s_closing)) {
+		nni_mtx_unlock(&sock->s_ep_mx);
 		return (NNG_ECLOSED);
 	}
 	if ((rv = nni_ep_create(&ep, sock, addr)) != 0) {
-		nni_mtx_unlock(&sock->s_mx);
+		nni_mtx_unlock(&sock->s_ep_mx);
 		return (rv);
 	}
 	nni_list_append(&sock->s_eps, ep);
-	nni_mtx_unlock(&sock->s_mx);
+	nni_mtx_unlock(&sock->s_ep_mx);
+
+	*epp = ep;
+	return (0);
+}
+
+
+int
+nni_sock_dial(nni_sock *sock, const char *addr, nni_ep **epp, int flags)
+{
+	nni_ep *ep;
+	int rv;
+
+	if ((rv = nni_sock_ep_create(sock, addr, &ep)) != 0) {
+		return (rv);
+	}
 
 	rv = nni_ep_dial(ep, flags);
 	if (rv != 0) {
-		nni_ep_close(ep);
+		// Never handed out, so nobody else can be holding it.
+		nni_ep_destroy(ep);
 	} else {
 		if (epp != NULL) {
 			*epp = ep;
@@ -524,22 +632,14 @@ nni_sock_listen(nni_sock *sock, const char *addr, nni_ep **epp, int flags)
 	nni_ep *ep;
 	int rv;
 
-	nni_mtx_lock(&sock->s_mx);
-	if (sock->s_closing) {
-		nni_mtx_unlock(&sock->s_mx);
-		return (NNG_ECLOSED);
-	}
-
-	if ((rv = nni_ep_create(&ep, sock, addr)) != 0) {
-		nni_mtx_unlock(&sock->s_mx);
+	if ((rv = nni_sock_ep_create(sock, addr, &ep)) != 0) {
 		return (rv);
 	}
-	nni_list_append(&sock->s_eps, ep);
-	nni_mtx_unlock(&sock->s_mx);
 
 	rv = nni_ep_listen(ep, flags);
 	if (rv != 0) {
-		nni_ep_close(ep);
+		// Never handed out, so nobody else can be holding it.
+		nni_ep_destroy(ep);
 	} else {
 		if (epp != NULL) {
 			*epp = ep;
@@ -553,14 +653,75 @@ nni_sock_listen(nni_sock *sock, const char *addr, nni_ep **epp, int flags)
 void
 nni_sock_recverr(nni_sock *sock, int err)
 {
-	sock->s_recverr = err;
+	nni_sock_set(&sock->s_recverr, err);
 }
 
 
 void
 nni_sock_senderr(nni_sock *sock, int err)
 {
-	sock->s_senderr = err;
+	nni_sock_set(&sock->s_senderr, err);
+}
+
+
+void
+nni_sock_filterlock(nni_sock *sock, int locked)
+{
+	sock->s_filterlock = locked;
+}
+
+
+void
+nni_sock_filterskip(nni_sock *sock, int skip)
+{
+	nni_sock_set(&sock->s_filterskip, skip);
+}
+
+
+void
+nni_sock_bindthr(nni_sock *sock, nni_thr *thr)
+{
+	if (sock->s_cpumasklen != 0) {
+		(void) nni_thr_affinity(thr, sock->s_cpumask,
+		    sock->s_cpumasklen);
+	}
+}
+
+
+// nni_sock_setaffinity binds the socket's own threads, and the workers of
+// all its pipes, to the CPUs in the mask.  Endpoint threads pick the mask
+// up when they next start.  There is no NUMA specific allocation; message
+// buffers are allocated by the threads that fill them, so once those
+// threads are pinned, first-touch placement keeps the memory local.
+static int
+nni_sock_setaffinity(nni_sock *sock, const void *val, size_t size)
+{
+	nni_pipe *pipe;
+	int rv;
+	int i;
+
+	if (size > sizeof (sock->s_cpumask)) {
+		return (NNG_EINVAL);
+	}
+
+	if ((rv = nni_plat_affinity_check(val, size)) != 0) {
+		return (rv);
+	}
+	memcpy(sock->s_cpumask, val, size);
+	sock->s_cpumasklen = size;
+
+	for (i = 0; (i < NNI_MAXWORKERS) && sock->s_started; i++) {
+		(void) nni_thr_affinity(&sock->s_worker_thr[i], val, size);
+	}
+	nni_mtx_lock(&sock->s_pipe_mx);
+	NNI_LIST_FOREACH (&sock->s_pipes, pipe) {
+		for (i = 0; i < NNI_MAXWORKERS; i++) {
+			(void) nni_thr_affinity(&pipe->p_worker_thr[i], val,
+			    size);
+		}
+	}
+	nni_mtx_unlock(&sock->s_pipe_mx);
+	return (0);
 }
 
 
@@ -603,6 +764,15 @@ nni_sock_setopt(nni_sock *sock, int opt, const void *val, size_t size)
 	case NNG_OPT_RCVBUF:
 		rv = nni_setopt_buf(sock->s_urq, val, size);
 		break;
+	case NNG_OPT_AFFINITY:
+		rv = nni_sock_setaffinity(sock, val, size);
+		break;
+	case NNG_OPT_BUSYPOLL:
+		rv = nni_setopt_duration(&sock->s_busypoll, val, size);
+		if (rv == 0) {
+			nni_msgq_set_spin(sock->s_urq, sock->s_busypoll);
+		}
+		break;
 	}
 	nni_mtx_unlock(&sock->s_mx);
 	return (rv);
@@ -648,6 +818,18 @@ nni_sock_getopt(nni_sock *sock, int opt, void *val, size_t *sizep)
 	case NNG_OPT_RCVBUF:
 		rv = nni_getopt_buf(sock->s_urq, val, sizep);
 		break;
+	case NNG_OPT_AFFINITY:
+		rsz = sock->s_cpumasklen;
+		if (rsz > *sizep) {
+			rsz = *sizep;
+		}
+		memcpy(val, sock->s_cpumask, rsz);
+		*sizep = sock->s_cpumasklen;
+		rv = 0;
+		break;
+	case NNG_OPT_BUSYPOLL:
+		rv = nni_getopt_duration(&sock->s_busypoll, val, sizep);
+		break;
 	}
 	nni_mtx_unlock(&sock->s_mx);
 	return (rv);
@@ -13,9 +13,23 @@
 // NB: This structure is supplied here for use by the CORE. Use of this library
 // OUSIDE of the core is STRICTLY VERBOTEN.  NO DIRECT ACCESS BY PROTOCOLS OR
 // TRANSPORTS.
+//
+// The socket has three locks.  Where more than one is held, they must be
+// taken in this order:
+//
+//   s_ep_mx	endpoints: the endpoint list, and each endpoint's state
+//   s_mx	the protocol: its state, the filters, options, and the
+//		calls to pipe_add and pipe_rem (see nni_sock_mtx)
+//   s_pipe_mx	pipe membership: the pipe and reap lists
+//
+// Nothing is called out to with s_pipe_mx held, other than closing a
+// pipe's transport.  So pipes come and go without holding up the
+// protocol, except for the moment it takes to add or remove them there.
 struct nng_socket {
 	nni_mtx			s_mx;
-	nni_cv			s_cv;
+	nni_mtx			s_ep_mx;
+	nni_mtx			s_pipe_mx;
+	nni_cv			s_pipe_cv;
 
 	nni_msgq *		s_uwq;  // Upper write queue
 	nni_msgq *		s_urq;  // Upper read queue
@@ -34,25 +48,38 @@ struct nng_socket {
 	nni_duration		s_rcvtimeo;     // receive timeout
 	nni_duration		s_reconn;       // reconnect time
 	nni_duration		s_reconnmax;    // max reconnect time
+	nni_duration		s_busypoll;     // receive busy-poll time
+	uint8_t			s_cpumask[NNI_MAXCPUS / 8];
+	size_t			s_cpumasklen;   // zero means any CPU
 
 	nni_list		s_eps;          // active endpoints
+	nni_list		s_eps_closed;   // closed, freed with the socket
 	nni_list		s_pipes;        // pipes for this socket
 
-	nni_list		s_reaps;        // pipes to reap
-	nni_thr			s_reaper;
+	nni_list		s_reaps;        // pipes waiting for the reaper
+	int			s_nreap;        // pipes not yet reaped
+	nni_reap_item		s_reap_item;    // for nni_sock_close_async
 	nni_thr			s_worker_thr[NNI_MAXWORKERS];
 
+	// The volatile flags are set with the lock held, but
+	// nni_sock_sendmsg and nni_sock_recvmsg read them without it,
+	// always through nni_sock_get and nni_sock_set.  s_filterlock is
+	// fixed once the protocol is initialized.
 	int			s_ep_pend;      // EP dial/listen in progress
-	int			s_closing;      // Socket is closing
+	volatile int		s_started;      // Worker threads are running
+	volatile int		s_closing;      // Socket is closing
 	int			s_besteffort;   // Best effort mode delivery
-	int			s_senderr;      // Protocol state machine use
-	int			s_recverr;      // Protocol state machine use
+	volatile int		s_senderr;      // Protocol state machine use
+	volatile int		s_recverr;      // Protocol state machine use
+	int			s_filterlock;   // Filters need the lock
+	volatile int		s_filterskip;   // Filters would do nothing
 
 	uint32_t		s_nextid;       // Next Pipe ID.
 };
 
 extern int nni_sock_open(nni_sock **, uint16_t);
 extern void nni_sock_close(nni_sock *);
+extern void nni_sock_close_async(nni_sock *);
 extern int nni_sock_shutdown(nni_sock *);
 extern uint16_t nni_sock_proto(nni_sock *);
 extern uint16_t nni_sock_peer(nni_sock *);
@@ -60,6 +87,7 @@ extern int nni_sock_setopt(nni_sock *, int, const void *, size_t);
 extern int nni_sock_getopt(nni_sock *, int, void *, size_t *);
 extern int nni_sock_recvmsg(nni_sock *, nni_msg **, nni_time);
 extern int nni_sock_sendmsg(nni_sock *, nni_msg *, nni_time);
+extern int nni_sock_ep_create(nni_sock *, const char *, nni_ep **);
 extern int nni_sock_dial(nni_sock *, const char *, nni_ep **, int);
 extern int nni_sock_listen(nni_sock *, const char *, nni_ep **, int);
 
@@ -69,6 +97,28 @@ extern int nni_sock_listen(nni_sock *, const char *, nni_ep **, int);
 extern void nni_sock_recverr(nni_sock *, int);
 extern void nni_sock_senderr(nni_sock *, int);
 
+// nni_sock_filterlock tells the socket whether the protocol's filters need
+// to run with the socket lock held, which is the default.  Filters that
+// guard their state with a lock of their own can be run without it, so
+// that threads sending and receiving on the same socket do not all
+// serialize on the socket lock.  Such filters must not call
+// nni_sock_recverr or nni_sock_senderr.  This may only be called from
+// the protocol's sock_init, as senders read it without any lock.
+extern void nni_sock_filterlock(nni_sock *, int);
+
+// nni_sock_filterskip tells the socket that the protocol's filters would
+// pass messages through unchanged (as in raw mode), so that they, and the
+// socket lock they may need, can be skipped.  A sender or receiver that
+// races with the change may still call the filters once more, so they
+// must check for this themselves as well.
+extern void nni_sock_filterskip(nni_sock *, int);
+
+// nni_sock_bindthr applies the socket's CPU affinity (NNG_OPT_AFFINITY)
+// to a thread working on its behalf.  This is best effort; a thread that
+// cannot be bound just runs wherever the system puts it.  The caller must
+// hold the socket (protocol) lock.
+extern void nni_sock_bindthr(nni_sock *, nni_thr *);
+
 // These are socket methods that protocol operations can expect to call.
 // Note that each of these should be called without any locks held, since
 // the socket can reenter the protocol.
@@ -86,7 +136,9 @@ extern nni_msgq *nni_sock_recvq(nni_sock *);
 // Additionally, this can only be acquired from separate threads.  The
 // synchronous entry points (excluding the send/recv thread workers) will
 // be called with this lock already held.  We expose the mutex directly
-// here so that protocols can use it to initialize condvars.
+// here so that protocols can use it to initialize condvars.  This lock
+// guards only protocol state; the socket's lists of pipes and endpoints
+// have locks of their own, which protocols never see.
 extern nni_mtx *nni_sock_mtx(nni_sock *);
 
 #endif  // CORE_SOCKET_H
@@ -89,18 +89,28 @@ nni_cv_wake(nni_cv *cv)
 }
 
 
+void
+nni_cv_wake1(nni_cv *cv)
+{
+	nni_plat_cv_wake1(&cv->cv);
+}
+
+
 static void
 nni_thr_wrap(void *arg)
 {
 	nni_thr *thr = arg;
-	int stop;
+	int start;
 
+	// A thread that was started always runs, even if it is being
+	// waited for by the time we get scheduled; only a thread that was
+	// never started is skipped.
 	nni_plat_mtx_lock(&thr->mtx);
-	while (((stop = thr->stop) == 0) && (thr->start == 0)) {
+	while (((start = thr->start) == 0) && (thr->stop == 0)) {
 		nni_plat_cv_wait(&thr->cv);
 	}
 	nni_plat_mtx_unlock(&thr->mtx);
-	if ((!stop) && (thr->fn != NULL)) {
+	if (start && (thr->fn != NULL)) {
 		thr->fn(thr->arg);
 	}
 	nni_plat_mtx_lock(&thr->mtx);
@@ -180,3 +190,129 @@ nni_thr_fini(nni_thr *thr)
 	nni_plat_cv_fini(&thr->cv);
 	nni_plat_mtx_fini(&thr->mtx);
 }
+
+
+int
+nni_thr_affinity(nni_thr *thr, const uint8_t *mask, size_t len)
+{
+	int rv = 0;
+
+	if (thr->fn == NULL) {
+		return (0);
+	}
+	nni_plat_mtx_lock(&thr->mtx);
+	if (!thr->done) {
+		rv = nni_plat_thr_affinity(&thr->thr, mask, len);
+	}
+	nni_plat_mtx_unlock(&thr->mtx);
+	return (rv);
+}
+
+
+#define NNI_THR_LOCAL_OBJ(tl, node)	((void *) (((char *) (node)) - \
+	(tl)->tl_offset))
+#define NNI_THR_LOCAL_NODE(tl, obj)	((nni_thr_local_node *) \
+	(((char *) (obj)) + (tl)->tl_offset))
+
+static void
+nni_thr_local_release(void *arg)
+{
+	nni_thr_local_node *node = arg;
+	nni_thr_local *tl = node->tln_local;
+
+	nni_mtx_lock(&tl->tl_mx);
+	node->tln_inuse = 0;
+	nni_mtx_unlock(&tl->tl_mx);
+}
+
+
+int
+nni_thr_local_init(nni_thr_local *tl, size_t size, size_t offset,
+    nni_thr_local_func create)
+{
+	int rv;
+
+	if ((rv = nni_mtx_init(&tl->tl_mx)) != 0) {
+		return (rv);
+	}
+	if ((rv = nni_plat_tls_init(&tl->tl_key,
+	    nni_thr_local_release)) != 0) {
+		nni_mtx_fini(&tl->tl_mx);
+		return (rv);
+	}
+	// The list links the embedded nodes, not the objects themselves.
+	NNI_LIST_INIT(&tl->tl_objs, nni_thr_local_node, tln_node);
+	tl->tl_size = size;
+	tl->tl_offset = offset;
+	tl->tl_create = create;
+	return (0);
+}
+
+
+void
+nni_thr_local_fini(nni_thr_local *tl)
+{
+	nni_thr_local_node *node;
+
+	nni_plat_tls_fini(&tl->tl_key);
+	while ((node = nni_list_first(&tl->tl_objs)) != NULL) {
+		nni_list_remove(&tl->tl_objs, node);
+		nni_free(NNI_THR_LOCAL_OBJ(tl, node), tl->tl_size);
+	}
+	nni_mtx_fini(&tl->tl_mx);
+}
+
+
+void *
+nni_thr_local_get(nni_thr_local *tl)
+{
+	nni_thr_local_node *node;
+	void *obj;
+
+	if ((node = nni_plat_tls_get(&tl->tl_key)) != NULL) {
+		return (NNI_THR_LOCAL_OBJ(tl, node));
+	}
+
+	nni_mtx_lock(&tl->tl_mx);
+	NNI_LIST_FOREACH (&tl->tl_objs, node) {
+		if (!node->tln_inuse) {
+			break;
+		}
+	}
+	if (node == NULL) {
+		if ((obj = nni_alloc(tl->tl_size)) == NULL) {
+			nni_mtx_unlock(&tl->tl_mx);
+			return (NULL);
+		}
+		if ((tl->tl_create != NULL) && (tl->tl_create(obj) != 0)) {
+			nni_mtx_unlock(&tl->tl_mx);
+			nni_free(obj, tl->tl_size);
+			return (NULL);
+		}
+		node = NNI_THR_LOCAL_NODE(tl, obj);
+		NNI_LIST_NODE_INIT(&node->tln_node);
+		node->tln_local = tl;
+		nni_list_append(&tl->tl_objs, node);
+	}
+	node->tln_inuse = 1;
+	nni_mtx_unlock(&tl->tl_mx);
+
+	if (nni_plat_tls_set(&tl->tl_key, node) != 0) {
+		nni_thr_local_release(node);
+		return (NULL);
+	}
+	return (NNI_THR_LOCAL_OBJ(tl, node));
+}
+
+
+void
+nni_thr_local_walk(nni_thr_local *tl, void (*fn)(void *, void *), void *arg)
+{
+	nni_thr_local_node *node;
+
+	nni_mtx_lock(&tl->tl_mx);
+	NNI_LIST_FOREACH (&tl->tl_objs, node) {
+		fn(arg, NNI_THR_LOCAL_OBJ(tl, node));
+	}
+	nni_mtx_unlock(&tl->tl_mx);
+}
@@ -33,6 +33,35 @@ typedef struct {
 	int		done;
 } nni_thr;
 
+// An nni_thr_local hands each thread an object of its own, created on
+// first use.  The objects outlive their threads: when a thread exits,
+// its object is marked free, and given to the next thread that asks, so
+// that the number of objects stays bounded by the number of threads that
+// use them concurrently.  Objects are only freed by nni_thr_local_fini.
+// The object embeds an nni_thr_local_node, much as list members embed an
+// nni_list_node.
+typedef struct nni_thr_local nni_thr_local;
+
+typedef struct {
+	nni_list_node	tln_node;
+	int		tln_inuse;      // owned by a live thread
+	nni_thr_local * tln_local;
+} nni_thr_local_node;
+
+// nni_thr_local_func is called on each newly allocated object, zeroed,
+// with the nni_thr_local's lock held.  It may fail with an error, in
+// which case the object is discarded.
+typedef int (*nni_thr_local_func)(void *);
+
+struct nni_thr_local {
+	nni_mtx			tl_mx;
+	nni_plat_tls		tl_key;
+	nni_list		tl_objs;
+	size_t			tl_size;
+	size_t			tl_offset;
+	nni_thr_local_func	tl_create;
+};
+
 // nni_mtx_init initializes the mutex.  (Win32 programmers take note;
 // our mutexes are actually CriticalSections on Win32.)
 extern int nni_mtx_init(nni_mtx *mtx);
@@ -64,6 +93,11 @@ extern void nni_cv_fini(nni_cv *cv);
 // nni_cv_wake wakes all waiters on the condition variable.
 extern void nni_cv_wake(nni_cv *cv);
 
+// nni_cv_wake1 wakes just one waiter on the condition variable.  Use it
+// only when every waiter is waiting for the same thing, and one of them
+// is enough to consume it.
+extern void nni_cv_wake1(nni_cv *cv);
+
 // nni_cv_wait waits until nni_cv_wake is called on the condition variable.
 // The wait is indefinite.  Premature wakeups are possible, so the caller
 // must verify any related condition.
@@ -91,4 +125,31 @@ extern void nni_thr_run(nni_thr *thr);
 // at all.
 extern void nni_thr_wait(nni_thr *thr);
 
+// nni_thr_affinity binds the thread to the CPUs in the mask, as described
+// for nni_plat_thr_affinity.  Threads that have no function, or that have
+// already finished, are silently skipped.
+extern int nni_thr_affinity(nni_thr *thr, const uint8_t *mask, size_t len);
+
+// nni_thr_local_init initializes the set, for objects of the given type,
+// whose nni_thr_local_node is the given field.  The create function may be
+// NULL.
+#define NNI_THR_LOCAL_INIT(tl, type, field, create) \
+	nni_thr_local_init(tl, sizeof (type), offsetof(type, field), create)
+extern int nni_thr_local_init(nni_thr_local *, size_t, size_t,
+    nni_thr_local_func);
+
+// nni_thr_local_fini frees every object, including any still owned by
+// live threads, which must no longer use them.
+extern void nni_thr_local_fini(nni_thr_local *);
+
+// nni_thr_local_get returns the calling thread's object, giving it one if
+// it has none yet.  It returns NULL if that is not possible.  Once the
+// thread has its object, this takes no lock.
+extern void *nni_thr_local_get(nni_thr_local *);
+
+// nni_thr_local_walk calls the function on every object, whether owned or
+// not, with the lock held, so that no new objects appear meanwhile.
+extern void nni_thr_local_walk(nni_thr_local *, void (*)(void *, void *),
+    void *);
+
 #endif CORE_THREAD_H
@@ -0,0 +1,218 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "core/nng_impl.h"
+
+// Each ring has a single writer, its owning thread, and is read only by
+// nni_trace_drain.  The writer bumps tr_start before it touches a slot, and
+// tr_head once the record is complete.  The drainer copies records up to
+// tr_head, then rereads tr_start to learn which of the copied slots may have
+// been overwritten underneath it, and throws those away.  Neither side ever
+// waits for the other.
+//
+// A thread's ring outlives the thread.  When the thread exits, its ring is
+// marked free, and is handed to the next thread that needs one, so that
+// undrained records are not lost and the number of rings stays bounded by
+// the number of threads that trace concurrently.
+
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+#define NNI_TRACE_BARRIER()	__sync_synchronize()
+#else
+#define NNI_TRACE_BARRIER()
+#endif
+
+// Trace ids are the ring number in the upper bits, and a per-ring sequence
+// in the lower bits, so they are unique without any shared counter.
+#define NNI_TRACE_SEQBITS	40
+#define NNI_TRACE_SEQMASK	((((uint64_t) 1) << NNI_TRACE_SEQBITS) - 1)
+
+typedef struct nni_trace_ring {
+	nni_thr_local_node	tr_node;
+	uint64_t		tr_idbase;
+	uint64_t		tr_seq;
+	uint32_t		tr_count;       // messages since last sample
+	volatile uint64_t	tr_start;       // records begun
+	volatile uint64_t	tr_head;        // records completed
+	uint64_t		tr_tail;        // next record to drain
+	nng_trace		tr_recs[NNI_TRACE_RINGSIZE];
+} nni_trace_ring;
+
+uint32_t nni_trace_rate = 0;
+
+static nni_thr_local nni_trace_rings;
+static uint64_t nni_trace_nrings;
+
+// nni_trace_ring_create numbers each new ring; the ring set's lock is held.
+static int
+nni_trace_ring_create(void *arg)
+{
+	nni_trace_ring *r = arg;
+
+	nni_trace_nrings++;
+	r->tr_idbase = nni_trace_nrings << NNI_TRACE_SEQBITS;
+	return (0);
+}
+
+
+static void
+nni_trace_record(nni_trace_ring *r, uint64_t id, int point)
+{
+	nng_trace *rec;
+	uint64_t h = r->tr_head;
+
+	r->tr_start = h + 1;
+	NNI_TRACE_BARRIER();
+	rec = &r->tr_recs[h & (NNI_TRACE_RINGSIZE - 1)];
+	rec->tr_id = id;
+	rec->tr_time = nni_clock();
+	rec->tr_point = point;
+	NNI_TRACE_BARRIER();
+	r->tr_head = h + 1;
+}
+
+
+void
+nni_trace_point(nni_msg *msg, int point)
+{
+	nni_trace_ring *r;
+	uint64_t id;
+
+	if ((id = nni_msg_trace(msg)) == 0) {
+		return;
+	}
+	if ((r = nni_thr_local_get(&nni_trace_rings)) != NULL) {
+		nni_trace_record(r, id, point);
+	}
+}
+
+
+void
+nni_trace_start(nni_msg *msg, int point)
+{
+	nni_trace_ring *r;
+	uint64_t id;
+
+	if ((r = nni_thr_local_get(&nni_trace_rings)) == NULL) {
+		return;
+	}
+	if ((id = nni_msg_trace(msg)) == 0) {
+		if (++r->tr_count < nni_trace_rate) {
+			return;
+		}
+		r->tr_count = 0;
+		r->tr_seq = (r->tr_seq + 1) & NNI_TRACE_SEQMASK;
+		if (r->tr_seq == 0) {
+			r->tr_seq = 1;
+		}
+		id = r->tr_idbase | r->tr_seq;
+		nni_msg_set_trace(msg, id);
+	}
+	nni_trace_record(r, id, point);
+}
+
+
+void
+nni_trace_sample(uint32_t n)
+{
+	nni_trace_rate = n;
+}
+
+
+typedef struct {
+	nng_trace *	recs;
+	size_t		max;
+	size_t		n;
+} nni_trace_drainer;
+
+static void
+nni_trace_drain_ring(void *arg, void *ring)
+{
+	nni_trace_drainer *d = arg;
+	nni_trace_ring *r = ring;
+	nng_trace *recs = d->recs;
+	uint64_t head;
+	uint64_t start;
+	uint64_t tail;
+	uint64_t first;
+	size_t base;
+	size_t lost;
+	size_t n = d->n;
+
+	if (n == d->max) {
+		return;
+	}
+	head = r->tr_head;
+	NNI_TRACE_BARRIER();
+
+	tail = r->tr_tail;
+	if ((head - tail) > NNI_TRACE_RINGSIZE) {
+		tail = head - NNI_TRACE_RINGSIZE;
+	}
+	first = tail;
+	base = n;
+	while ((tail < head) && (n < d->max)) {
+		recs[n++] = r->tr_recs[tail & (NNI_TRACE_RINGSIZE - 1)];
+		tail++;
+	}
+	r->tr_tail = tail;
+
+	// Anything the writer may have started overwriting while we
+	// were copying is suspect, and is discarded.
+	NNI_TRACE_BARRIER();
+	start = r->tr_start;
+	if ((start > NNI_TRACE_RINGSIZE) &&
+	    ((start - NNI_TRACE_RINGSIZE) > first)) {
+		lost = (size_t) (start - NNI_TRACE_RINGSIZE - first);
+		if (lost > (n - base)) {
+			lost = n - base;
+		}
+		memmove(&recs[base], &recs[base + lost],
+		    (n - base - lost) * sizeof (nng_trace));
+		n -= lost;
+	}
+	d->n = n;
+}
+
+
+size_t
+nni_trace_drain(nng_trace *recs, size_t max)
+{
+	nni_trace_drainer d;
+
+	d.recs = recs;
+	d.max = max;
+	d.n = 0;
+	nni_thr_local_walk(&nni_trace_rings, nni_trace_drain_ring, &d);
+	return (d.n);
+}
+
+
+int
+nni_trace_init(void)
+{
+	int rv;
+
+	if ((rv = NNI_THR_LOCAL_INIT(&nni_trace_rings, nni_trace_ring,
+	    tr_node, nni_trace_ring_create)) != 0) {
+		return (rv);
+	}
+	nni_trace_nrings = 0;
+	nni_trace_rate = 0;
+	return (0);
+}
+
+
+void
+nni_trace_fini(void)
+{
+	nni_trace_rate = 0;
+	nni_thr_local_fini(&nni_trace_rings);
+}
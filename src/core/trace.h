@@ -0,0 +1,62 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef CORE_TRACE_H
+#define CORE_TRACE_H
+
+#include "core/nng_impl.h"
+
+// Sampled message tracing.  Each thread that records trace points owns a
+// ring of records, found via thread local storage, so recording never
+// takes a lock.  Rings are only locked against each other when drained.
+// The trace id carried in the message is what ties the records together.
+
+// NNI_TRACE_RINGSIZE is the number of records in each thread's ring.
+// It must be a power of two.
+#define NNI_TRACE_RINGSIZE	1024
+
+// nni_trace_rate is the sampling interval; zero means tracing is off.
+// It is read without a lock on hot paths, which is harmless -- a thread
+// that sees a stale value just samples a few more or fewer messages.
+extern uint32_t nni_trace_rate;
+
+extern int nni_trace_init(void);
+extern void nni_trace_fini(void);
+
+// nni_trace_sample sets the sampling interval.
+extern void nni_trace_sample(uint32_t);
+
+// nni_trace_drain copies up to the given number of records out of the
+// rings, returning the number copied.
+extern size_t nni_trace_drain(nng_trace *, size_t);
+
+// nni_trace_point records the point if the message is being traced.
+extern void nni_trace_point(nni_msg *, int);
+
+// nni_trace_start is like nni_trace_point, but first decides whether to
+// start tracing a message that is not already traced.  This is used where
+// messages enter the system: on send, and when read from a transport.
+extern void nni_trace_start(nni_msg *, int);
+
+// These wrappers keep the cost to a single load when tracing is off.
+#define NNI_TRACE(m, p)					\
+	do {						\
+		if (nni_trace_rate != 0) {		\
+			nni_trace_point((m), (p));	\
+		}					\
+	} while (0)
+
+#define NNI_TRACE_START(m, p)				\
+	do {						\
+		if (nni_trace_rate != 0) {		\
+			nni_trace_start((m), (p));	\
+		}					\
+	} while (0)
+
+#endif  // CORE_TRACE_H
@@ -93,6 +93,13 @@ struct nni_tran_pipe {
 	// it is finished with it.
 	int		(*pipe_send)(void *, nni_msg *);
 
+	// p_cansend returns non-zero if sending the message now would
+	// complete without waiting for the peer to make room, as the send
+	// blocks and has no timeout.  Protocols use it to decide whether
+	// to send on the application's thread.  It may be NULL, in which
+	// case sends are never attempted that way.
+	int		(*pipe_cansend)(void *, nni_msg *);
+
 	// p_recv recvs the message. This is a blocking operation, and a read
 	// will be performed even for cases where no data is expected.  This
 	// allows the socket to detect a closed socket, by the returned error
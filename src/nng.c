@@ -57,6 +57,14 @@ nng_close(nng_socket *s)
 }
 
 
+void
+nng_close_async(nng_socket *s)
+{
+	NNI_INIT_VOID();
+	nni_sock_close_async(s);
+}
+
+
 uint16_t
 nng_protocol(nng_socket *s)
 {
@@ -84,7 +92,7 @@ nng_recvmsg(nng_socket *s, nng_msg **msgp, int flags)
 	} else if (s->s_rcvtimeo < 0) {
 		expire = NNI_TIME_NEVER;
 	} else {
-		expire = nni_clock();
+		expire = nni_clock_coarse();
 		expire += s->s_rcvtimeo;
 	}
 
@@ -104,7 +112,7 @@ nng_sendmsg(nng_socket *s, nng_msg *msg, int flags)
 	} else if (s->s_sndtimeo < 0) {
 		expire = NNI_TIME_NEVER;
 	} else {
-		expire = nni_clock();
+		expire = nni_clock_coarse();
 		expire += s->s_sndtimeo;
 	}
 
@@ -128,6 +136,55 @@ nng_listen(nng_socket *s, const char *addr, nng_endpoint **epp, int flags)
 }
 
 
+int
+nng_endpoint_create(nng_endpoint **epp, nng_socket *s, const char *addr)
+{
+	NNI_INIT_INT();
+	return (nni_sock_ep_create(s, addr, epp));
+}
+
+
+int
+nng_endpoint_dial(nng_endpoint *ep, int flags)
+{
+	NNI_INIT_INT();
+	return (nni_ep_dial(ep, flags));
+}
+
+
+int
+nng_endpoint_listen(nng_endpoint *ep, int flags)
+{
+	NNI_INIT_INT();
+	return (nni_ep_listen(ep, flags));
+}
+
+
+int
+nng_endpoint_close(nng_endpoint *ep)
+{
+	NNI_INIT_INT();
+	nni_ep_close(ep);
+	return (0);
+}
+
+
+int
+nng_endpoint_setopt(nng_endpoint *ep, int opt, void *val, size_t sz)
+{
+	NNI_INIT_INT();
+	return (nni_ep_setopt(ep, opt, val, sz));
+}
+
+
+int
+nng_endpoint_getopt(nng_endpoint *ep, int opt, void *val, size_t *szp)
+{
+	NNI_INIT_INT();
+	return (nni_ep_getopt(ep, opt, val, szp));
+}
+
+
 int
 nng_setopt(nng_socket *s, int opt, const void *val, size_t sz)
 {
@@ -347,6 +404,24 @@ nng_msg_getopt(nng_msg *msg, int opt, void *ptr, size_t *szp)
 }
 
 
+int
+nng_trace_sample(uint32_t n)
+{
+	NNI_INIT_INT();
+	nni_trace_sample(n);
+	return (0);
+}
+
+
+int
+nng_trace_drain(nng_trace *recs, size_t *np)
+{
+	NNI_INIT_INT();
+	*np = nni_trace_drain(recs, *np);
+	return (0);
+}
+
+
 int
 nng_snapshot_create(nng_snapshot **snapp)
 {
@@ -42,6 +42,7 @@ typedef struct nng_event	nng_event;
 typedef struct nng_notify	nng_notify;
 typedef struct nng_snapshot	nng_snapshot;
 typedef struct nng_stat		nng_stat;
+typedef struct nng_trace	nng_trace;
 
 // nng_open simply creates a socket of the given class. It returns an
 // error code on failure, or zero on success.  The socket starts in cooked
@@ -56,6 +57,12 @@ NNG_DECL int nng_open(nng_socket **, uint16_t proto);
 // pipes associated with the socket.
 NNG_DECL void nng_close(nng_socket *);
 
+// nng_close_async is like nng_close, but returns without waiting for the
+// socket to linger, or for its connections to be torn down; that is done
+// in the background.  As with nng_close, it is an error to reference the
+// socket in any way after this is called.
+NNG_DECL void nng_close_async(nng_socket *);
+
 // nng_shutdown shuts down the socket.  This causes any threads doing
 // work for the socket or blocked in socket functions to be woken (and
 // return NNG_ECLOSED).  The socket resources are still present, so it
@@ -153,8 +160,9 @@ NNG_DECL int nng_endpoint_dial(nng_endpoint *, int);
 NNG_DECL int nng_endpoint_listen(nng_endpoint *, int);
 
 // nng_endpoint_close closes the endpointt, shutting down all underlying
-// connections and releasing all associated resources.  It is an error to
-// refer to the endpoint after this is called.
+// connections and releasing most associated resources.  The endpoint may
+// still be referred to, but every operation on it fails with NNG_ECLOSED,
+// until its socket is closed; after that, it is an error to refer to it.
 NNG_DECL int nng_endpoint_close(nng_endpoint *);
 
 // nng_endpoint_setopt sets an option for a specific endpoint.  Note
@@ -276,6 +284,23 @@ NNG_DECL int nng_pipe_close(nng_pipe *);
 #define NNG_OPT_REMOTEADDR		NNG_OPT_SOCKET(17)
 #define NNG_OPT_RECVFD			NNG_OPT_SOCKET(18)
 #define NNG_OPT_SENDFD			NNG_OPT_SOCKET(19)
+#define NNG_OPT_ACCEPTERS		NNG_OPT_SOCKET(20)
+#define NNG_OPT_BACKLOG			NNG_OPT_SOCKET(21)
+#define NNG_OPT_HANDSHAKETIME		NNG_OPT_SOCKET(22)
+#define NNG_OPT_REUSEPORT		NNG_OPT_SOCKET(23)
+#define NNG_OPT_LBPOLICY		NNG_OPT_SOCKET(24)
+#define NNG_OPT_SNDHWM			NNG_OPT_SOCKET(25)
+#define NNG_OPT_FANOUT			NNG_OPT_SOCKET(26)
+#define NNG_OPT_MAXSURVEYS		NNG_OPT_SOCKET(27)
+#define NNG_OPT_SURVEYID		NNG_OPT_SOCKET(28)
+#define NNG_OPT_AFFINITY		NNG_OPT_SOCKET(29)
+#define NNG_OPT_BUSYPOLL		NNG_OPT_SOCKET(30)
+
+// Load balancing policies, for NNG_OPT_LBPOLICY.
+#define NNG_LB_ROUNDROBIN		0
+#define NNG_LB_LEASTBUSY		1
+#define NNG_LB_TWOCHOICE		2
+#define NNG_LB_WEIGHTED			3
 
 // XXX: TBD: priorities, socket names, ipv4only
 
@@ -346,6 +371,38 @@ NNG_DECL int nng_stat_unit(nng_stat *);
 // snapshot was updated, and are undefined until an update is performed.
 NNG_DECL int64_t nng_stat_value(nng_stat *);
 
+// Message tracing.  This is a diagnostic facility for attributing latency
+// to the individual hops between a send and the matching receive.  When
+// enabled, a sample of messages is traced, and a timestamped record is made
+// each time a traced message passes one of the trace points below.  Records
+// are kept in per-thread rings that overwrite the oldest records when full,
+// so they must be drained regularly.  Messages carried by the inproc
+// transport keep their id end to end; other transports start a new trace
+// on the receiving side.
+struct nng_trace {
+	uint64_t	tr_id;          // identifies the traced message
+	uint64_t	tr_time;        // usec, from an arbitrary base
+	int		tr_point;       // NNG_TRACE_xxx
+};
+
+// nng_trace_sample sets the sampling interval.  Each thread traces one of
+// every so many messages that it sends, or reads from a transport.  Zero,
+// the default, disables tracing.
+NNG_DECL int nng_trace_sample(uint32_t);
+
+// nng_trace_drain copies undrained records into the array.  On entry the
+// count is the size of the array, and on return it is the number of records
+// copied.  Records from a single thread are in time order, but records from
+// different threads are not merged.
+NNG_DECL int nng_trace_drain(nng_trace *, size_t *);
+
+#define NNG_TRACE_SEND		1       // nng_sendmsg called
+#define NNG_TRACE_UWQ		2       // taken from the upper write queue
+#define NNG_TRACE_TXWRITE	3       // handed to the transport
+#define NNG_TRACE_TXREAD	4       // returned by the transport
+#define NNG_TRACE_URQ		5       // placed on the upper read queue
+#define NNG_TRACE_RECV		6       // returned by nng_recvmsg
+
 // Device functionality.  This connects two sockets together in a device,
 // which means that messages from one side are forwarded to the other.
 NNG_DECL int nng_device(nng_socket *, nng_socket *);
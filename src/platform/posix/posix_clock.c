@@ -37,6 +37,60 @@ nni_clock(void)
 }
 
 
+#ifdef NNG_USE_COARSE_CLOCKID
+
+// A coarse clock with a resolution worse than this is not worth having;
+// deadlines could be late by twice that much.  Then we use the precise
+// clock instead.
+#define NNI_CLOCK_COARSE_MAXRES	4000
+
+// The coarse clock reports the time as of the last timekeeping update,
+// which the kernel accumulates in whole ticks, so it can trail the precise
+// clock by up to two ticks (not just the one that clock_getres reports).
+// The pad is two ticks in usec, or -1 if the coarse clock is unusable.
+// This is worked out on first use; racing threads all compute the same
+// answer, so no lock is needed.
+static nni_duration nni_clock_coarse_pad = 0;
+
+nni_time
+nni_clock_coarse(void)
+{
+	struct timespec ts;
+	nni_time usec;
+
+	if (nni_clock_coarse_pad == 0) {
+		if ((clock_getres(NNG_USE_COARSE_CLOCKID, &ts) != 0) ||
+		    (ts.tv_sec != 0) ||
+		    (ts.tv_nsec > (NNI_CLOCK_COARSE_MAXRES * 1000))) {
+			nni_clock_coarse_pad = -1;
+		} else {
+			nni_clock_coarse_pad = 2 * ((ts.tv_nsec + 999) / 1000);
+		}
+	}
+	if ((nni_clock_coarse_pad < 0) ||
+	    (clock_gettime(NNG_USE_COARSE_CLOCKID, &ts) != 0)) {
+		return (nni_clock());
+	}
+
+	usec = ts.tv_sec;
+	usec *= 1000000;
+	usec += (ts.tv_nsec / 1000);
+	return (usec + nni_clock_coarse_pad);
+}
+
+
+#else   // NNG_USE_COARSE_CLOCKID
+
+nni_time
+nni_clock_coarse(void)
+{
+	return (nni_clock());
+}
+
+
+#endif  // NNG_USE_COARSE_CLOCKID
+
+
 void
 nni_usleep(nni_duration usec)
 {
@@ -87,6 +141,13 @@ nni_clock(void)
 }
 
 
+nni_time
+nni_clock_coarse(void)
+{
+	return (nni_clock());
+}
+
+
 void
 nni_usleep(nni_duration usec)
 {
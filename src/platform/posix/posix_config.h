@@ -27,11 +27,23 @@
 //	is defined.  Platforms that don't use POSIX clocks will probably
 //	ignore any setting here.
 //
+// #define NNG_USE_COARSE_CLOCKID
+//	This macro may be defined to a cheaper clock id with the same base
+//	as NNG_USE_CLOCKID, such as CLOCK_REALTIME_COARSE on Linux.  It is
+//	used to compute deadlines, and is ignored if it turns out to be too
+//	coarse to be useful.
+//
 // #define NNG_HAVE_BACKTRACE
 //	If your system has a working backtrace(), and backtrace_symbols(),
 //	along with <execinfo.h>, you can define this to get richer backtrace
 //	information for debugging.
 //
+// #define NNG_USE_FUTEX
+//	On Linux, this replaces the pthread mutexes and condition variables
+//	with an adaptive spin-then-sleep mutex and a condition variable
+//	built directly on futexes.  The NNG_ENABLE_FUTEX cmake option sets
+//	it.  It needs the GCC atomic builtins.
+//
 // #define NNG_USE_GETRANDOM
 // #define NNG_USE_GETENTROPY
 // #define NNG_USE_ARC4RANDOM
@@ -67,3 +79,10 @@
 #else
 #define NNG_USE_CLOCKID		CLOCK_REALTIME
 #endif  // CLOCK_REALTIME
+
+// NNG_USE_COARSE_CLOCKID is a cheaper, lower resolution clock with the
+// same base as NNG_USE_CLOCKID, used for nni_clock_coarse.  If it is not
+// defined, nni_clock_coarse is just nni_clock.
+#if defined(CLOCK_REALTIME_COARSE) && !defined(NNG_USE_GETTIMEOFDAY)
+#define NNG_USE_COARSE_CLOCKID	CLOCK_REALTIME_COARSE
+#endif
@@ -0,0 +1,252 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+// Futex based mutexes and condition variables, for Linux.  Our locks are
+// held very briefly, so a thread that finds one taken is better off
+// spinning for a little while than going to sleep in the kernel.  The
+// mutex is the classic three state futex mutex, with an adaptive spin in
+// front of it, in the manner of glibc's PTHREAD_MUTEX_ADAPTIVE_NP.  The
+// condition variable skips the system call entirely when nobody waits,
+// and a broadcast wakes just one waiter, moving the rest over to sleep on
+// the mutex, so that they do not all stampede for it at once.
+//
+// Unlike the pthread version, misuse (such as unlocking a mutex that is
+// not held) is only partly detected.
+
+#include "core/nng_impl.h"
+
+#if defined(PLATFORM_POSIX_THREAD) && defined(NNG_USE_FUTEX)
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// NNI_FUTEX_MAXSPIN bounds the adaptive spin, in iterations.
+#define NNI_FUTEX_MAXSPIN	200
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NNI_FUTEX_RELAX()	__asm__ __volatile__ ("pause")
+#elif defined(__aarch64__)
+#define NNI_FUTEX_RELAX()	__asm__ __volatile__ ("yield")
+#else
+#define NNI_FUTEX_RELAX()
+#endif
+
+// The timed wait uses an absolute time, which has to be on the same clock
+// as nni_clock.  Without FUTEX_CLOCK_REALTIME it is CLOCK_MONOTONIC.
+#if NNG_USE_CLOCKID == CLOCK_REALTIME
+#define NNI_FUTEX_WAIT	(FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG | \
+	FUTEX_CLOCK_REALTIME)
+#else
+#define NNI_FUTEX_WAIT	(FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG)
+#endif
+
+static int
+nni_futex_wait(volatile int *addr, int val, const struct timespec *abstime)
+{
+	if (syscall(SYS_futex, addr, NNI_FUTEX_WAIT, val, abstime, NULL,
+	    FUTEX_BITSET_MATCH_ANY) != 0) {
+		return (errno);
+	}
+	return (0);
+}
+
+
+static void
+nni_futex_wake(volatile int *addr, int n)
+{
+	(void) syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+
+int
+nni_plat_mtx_init(nni_plat_mtx *mtx)
+{
+	mtx->state = 0;
+	mtx->spins = 0;
+	return (0);
+}
+
+
+void
+nni_plat_mtx_fini(nni_plat_mtx *mtx)
+{
+	if (mtx->state != 0) {
+		nni_panic("nni_plat_mtx_fini: mutex is locked");
+	}
+}
+
+
+// nni_plat_mtx_sleep takes the lock the slow way, marking it contended,
+// and sleeping until it is released.
+static void
+nni_plat_mtx_sleep(nni_plat_mtx *mtx)
+{
+	while (__sync_lock_test_and_set(&mtx->state, 2) != 0) {
+		(void) nni_futex_wait(&mtx->state, 2, NULL);
+	}
+}
+
+
+void
+nni_plat_mtx_lock(nni_plat_mtx *mtx)
+{
+	int max;
+	int i;
+
+	if (__sync_bool_compare_and_swap(&mtx->state, 0, 1)) {
+		return;
+	}
+
+	// Spin, but only as long as spinning has recently been paying
+	// off for this lock.  The estimate is updated without the lock;
+	// it is only a hint, so a lost update does no harm.
+	if (nni_plat_ncpu() > 1) {
+		max = mtx->spins * 2 + 10;
+		if (max > NNI_FUTEX_MAXSPIN) {
+			max = NNI_FUTEX_MAXSPIN;
+		}
+		for (i = 0; i < max; i++) {
+			NNI_FUTEX_RELAX();
+			if ((mtx->state == 0) &&
+			    __sync_bool_compare_and_swap(&mtx->state, 0, 1)) {
+				break;
+			}
+		}
+		mtx->spins += (i - mtx->spins) / 8;
+		if (i < max) {
+			return;
+		}
+	}
+	nni_plat_mtx_sleep(mtx);
+}
+
+
+void
+nni_plat_mtx_unlock(nni_plat_mtx *mtx)
+{
+	int old;
+
+	if ((old = __sync_fetch_and_sub(&mtx->state, 1)) == 1) {
+		return;
+	}
+	if (old != 2) {
+		nni_panic("nni_plat_mtx_unlock: mutex not locked");
+	}
+	mtx->state = 0;
+	nni_futex_wake(&mtx->state, 1);
+}
+
+
+int
+nni_plat_mtx_trylock(nni_plat_mtx *mtx)
+{
+	if (!__sync_bool_compare_and_swap(&mtx->state, 0, 1)) {
+		return (NNG_EBUSY);
+	}
+	return (0);
+}
+
+
+int
+nni_plat_cv_init(nni_plat_cv *cv, nni_plat_mtx *mtx)
+{
+	cv->seq = 0;
+	cv->waiters = 0;
+	cv->mtx = mtx;
+	return (0);
+}
+
+
+void
+nni_plat_cv_fini(nni_plat_cv *cv)
+{
+	if (cv->waiters != 0) {
+		nni_panic("nni_plat_cv_fini: condition has waiters");
+	}
+}
+
+
+void
+nni_plat_cv_wake(nni_plat_cv *cv)
+{
+	int seq;
+
+	seq = __sync_add_and_fetch(&cv->seq, 1);
+	if (cv->waiters == 0) {
+		return;
+	}
+
+	// Wake one, and move the rest onto the mutex, which the caller
+	// holds.  They will be woken one at a time as it is released.  If
+	// the sequence moved on under us, a plain wake of all of them
+	// is still correct.
+	if (syscall(SYS_futex, &cv->seq, FUTEX_CMP_REQUEUE_PRIVATE, 1,
+	    INT_MAX, &cv->mtx->state, seq) < 0) {
+		nni_futex_wake(&cv->seq, INT_MAX);
+	}
+}
+
+
+void
+nni_plat_cv_wake1(nni_plat_cv *cv)
+{
+	(void) __sync_add_and_fetch(&cv->seq, 1);
+	if (cv->waiters != 0) {
+		nni_futex_wake(&cv->seq, 1);
+	}
+}
+
+
+static int
+nni_plat_cv_sleep(nni_plat_cv *cv, const struct timespec *abstime)
+{
+	int seq = cv->seq;
+	int rv;
+
+	(void) __sync_add_and_fetch(&cv->waiters, 1);
+	nni_plat_mtx_unlock(cv->mtx);
+	rv = nni_futex_wait(&cv->seq, seq, abstime);
+	(void) __sync_sub_and_fetch(&cv->waiters, 1);
+
+	// We may have been requeued onto the mutex with others, so we must
+	// take it in the contended state, to be sure they get woken too.
+	nni_plat_mtx_sleep(cv->mtx);
+	return (rv);
+}
+
+
+void
+nni_plat_cv_wait(nni_plat_cv *cv)
+{
+	(void) nni_plat_cv_sleep(cv, NULL);
+}
+
+
+int
+nni_plat_cv_until(nni_plat_cv *cv, nni_time until)
+{
+	struct timespec ts;
+
+	// Our caller has already guaranteed a sane value for until.
+	ts.tv_sec = until / 1000000;
+	ts.tv_nsec = (until % 1000000) * 1000;
+
+	if (nni_plat_cv_sleep(cv, &ts) == ETIMEDOUT) {
+		return (NNG_ETIMEDOUT);
+	}
+	return (0);
+}
+
+
+#endif  // PLATFORM_POSIX_THREAD && NNG_USE_FUTEX
@@ -39,6 +39,10 @@ struct nni_plat_tcpsock {
 	int	fd;
 	int	devnull; // used for shutting down blocking accept()
 };
+
+// nni_posix_writable returns non-zero if len bytes can be written to the
+// stream socket fd without waiting for the peer.  IPC uses it too.
+extern int nni_posix_writable(int, size_t);
 #endif
 
 #ifdef PLATFORM_POSIX_IPC
@@ -59,19 +63,43 @@ extern int nni_plat_devnull;    // open descriptor on /dev/null
 // These types are provided for here, to permit them to be directly inlined
 // elsewhere.
 
+#ifdef NNG_USE_FUTEX
+
+// The futex mutex state is 0 when unlocked, 1 when locked, and 2 when
+// locked and there may be sleepers.  The condition variable sleeps on a
+// sequence number, which is bumped by every wakeup.
+struct nni_plat_mtx {
+	volatile int	state;
+	int		spins;          // adaptive spin estimate
+};
+
+struct nni_plat_cv {
+	volatile int	seq;
+	volatile int	waiters;
+	nni_plat_mtx *	mtx;
+};
+
+#else
+
 struct nni_plat_mtx {
 	pthread_mutex_t mtx;
 };
 
+struct nni_plat_cv {
+	pthread_cond_t		cv;
+	pthread_mutex_t *	mtx;
+};
+
+#endif
+
 struct nni_plat_thr {
 	pthread_t	tid;
 	void		(*func)(void *);
 	void *		arg;
 };
 
-struct nni_plat_cv {
-	pthread_cond_t		cv;
-	pthread_mutex_t *	mtx;
+struct nni_plat_tls {
+	pthread_key_t	key;
 };
 
 #endif
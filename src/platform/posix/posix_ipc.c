@@ -52,6 +52,13 @@ nni_plat_ipc_path_to_sockaddr(struct sockaddr_un *sun, const char *path)
 }
 
 
+int
+nni_plat_ipc_writable(nni_plat_ipcsock *s, size_t len)
+{
+	return (nni_posix_writable(s->fd, len));
+}
+
+
 int
 nni_plat_ipc_send(nni_plat_ipcsock *s, nni_iov *iovs, int cnt)
 {
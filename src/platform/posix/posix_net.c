@@ -15,6 +15,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -22,6 +23,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <sys/time.h>
+#include <poll.h>
 
 static int
 nni_plat_to_sockaddr(struct sockaddr_storage *ss, const nni_sockaddr *sa)
@@ -107,6 +110,56 @@ nni_plat_lookup_host(const char *host, nni_sockaddr *addr, int flags)
 }
 
 
+int
+nni_posix_writable(int fd, size_t len)
+{
+	struct pollfd pfd;
+	socklen_t sz;
+	int space;
+#ifdef SIOCOUTQ
+	int queued;
+#endif
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 0) != 1) {
+		return (0);
+	}
+	if ((pfd.revents & (POLLERR | POLLHUP)) != 0) {
+		return (0);
+	}
+
+	// POLLOUT only means that there is some room.  Make sure that
+	// there is room for all of it.
+#ifdef SIOCOUTQ
+	// Linux reports twice the buffer size that was asked for, the
+	// other half being for its own bookkeeping, and counts what is
+	// still queued against the same limit.
+	sz = sizeof (space);
+	if ((getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &space, &sz) != 0) ||
+	    (ioctl(fd, SIOCOUTQ, &queued) != 0)) {
+		return (0);
+	}
+	space = (space / 2) - queued;
+#else
+	// Elsewhere POLLOUT means that at least the low water mark is free.
+	sz = sizeof (space);
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDLOWAT, &space, &sz) != 0) {
+		return (0);
+	}
+#endif
+	return ((space > 0) && (len <= (size_t) space));
+}
+
+
+int
+nni_plat_tcp_writable(nni_plat_tcpsock *s, size_t len)
+{
+	return (nni_posix_writable(s->fd, len));
+}
+
+
 int
 nni_plat_tcp_send(nni_plat_tcpsock *s, nni_iov *iovs, int cnt)
 {
@@ -130,9 +183,13 @@ nni_plat_tcp_send(nni_plat_tcpsock *s, nni_iov *iovs, int cnt)
 	while (resid) {
 		rv = writev(s->fd, iov, cnt);
 		if (rv < 0) {
-			if (rv == EINTR) {
+			if (errno == EINTR) {
 				continue;
 			}
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				// Only possible with a timeout set.
+				return (NNG_ETIMEDOUT);
+			}
 			return (nni_plat_errno(errno));
 		}
 		if (rv > resid) {
@@ -182,6 +239,10 @@ nni_plat_tcp_recv(nni_plat_tcpsock *s, nni_iov *iovs, int cnt)
 			if (errno == EINTR) {
 				continue;
 			}
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				// Only possible with a timeout set.
+				return (NNG_ETIMEDOUT);
+			}
 			return (nni_plat_errno(errno));
 		}
 		if (rv == 0) {
@@ -263,14 +324,15 @@ nni_plat_tcp_shutdown(nni_plat_tcpsock *s)
 }
 
 
-// nni_plat_tcp_bind creates a file descriptor bound to the given address.
-// This basically does the equivalent of socket, bind, and listen.  We have
-// chosen a default value for the listen backlog of 128, which should be
-// plenty.  (If it isn't, then the accept thread can't get enough resources
-// to keep up, and your clients are going to experience bad things.  Normally
-// the actual backlog should hover near 0 anyway.)
+// nni_plat_tcp_listen creates a file descriptor bound to the given address.
+// This basically does the equivalent of socket, bind, and listen.  The
+// backlog is chosen by the caller; 128 is a reasonable default.  (If it
+// isn't enough, then the accept threads can't get enough resources to keep
+// up, and your clients are going to experience bad things.  Normally the
+// actual backlog should hover near 0 anyway.)
 int
-nni_plat_tcp_listen(nni_plat_tcpsock *s, const nni_sockaddr *addr)
+nni_plat_tcp_listen(nni_plat_tcpsock *s, const nni_sockaddr *addr,
+    int backlog, int flags)
 {
 	int fd;
 	int len;
@@ -281,6 +343,11 @@ nni_plat_tcp_listen(nni_plat_tcpsock *s, const nni_sockaddr *addr)
 	if (len < 0) {
 		return (NNG_EADDRINVAL);
 	}
+#ifndef SO_REUSEPORT
+	if (flags & NNI_FLAG_REUSEPORT) {
+		return (NNG_ENOTSUP);
+	}
+#endif
 
 #ifdef SOCK_CLOEXEC
 	fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -293,15 +360,26 @@ nni_plat_tcp_listen(nni_plat_tcpsock *s, const nni_sockaddr *addr)
 
 	nni_plat_tcp_setopts(fd);
 
+#ifdef SO_REUSEPORT
+	if (flags & NNI_FLAG_REUSEPORT) {
+		int one = 1;
+
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one,
+		    sizeof (one)) != 0) {
+			rv = nni_plat_errno(errno);
+			(void) close(fd);
+			return (rv);
+		}
+	}
+#endif
+
 	if (bind(fd, (struct sockaddr *) &ss, len) < 0) {
 		rv = nni_plat_errno(errno);
 		(void) close(fd);
 		return (rv);
 	}
 
-	// Listen -- 128 depth is probably sufficient.  If it isn't, other
-	// bad things are going to happen.
-	if (listen(fd, 128) != 0) {
+	if (listen(fd, backlog) != 0) {
 		rv = nni_plat_errno(errno);
 		(void) close(fd);
 		return (rv);
@@ -312,6 +390,46 @@ nni_plat_tcp_listen(nni_plat_tcpsock *s, const nni_sockaddr *addr)
 }
 
 
+int
+nni_plat_tcp_timeout(nni_plat_tcpsock *s, nni_duration tmo)
+{
+	struct timeval tv;
+
+	if (tmo < 0) {
+		tmo = 0;
+	}
+	tv.tv_sec = tmo / 1000000;
+	tv.tv_usec = tmo % 1000000;
+
+	if ((setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+	    sizeof (tv)) != 0) ||
+	    (setsockopt(s->fd, SOL_SOCKET, SO_SNDTIMEO, &tv,
+	    sizeof (tv)) != 0)) {
+		return (nni_plat_errno(errno));
+	}
+	return (0);
+}
+
+
+int
+nni_plat_tcp_busypoll(nni_plat_tcpsock *s, nni_duration spin)
+{
+#ifdef SO_BUSY_POLL
+	int usec = (int) spin;
+
+	if (setsockopt(s->fd, SOL_SOCKET, SO_BUSY_POLL, &usec,
+	    sizeof (usec)) != 0) {
+		return (nni_plat_errno(errno));
+	}
+	return (0);
+#else
+	NNI_ARG_UNUSED(s);
+	NNI_ARG_UNUSED(spin);
+	return (NNG_ENOTSUP);
+#endif
+}
+
+
 // nni_plat_tcp_connect establishes an outbound connection.  It the
 // bind address is not null, then it will attempt to bind to the local
 // address specified first.
@@ -21,10 +21,15 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
+#ifdef NNG_HAVE_PTHREAD_SETAFFINITY
+#include <sched.h>
+#endif
 
 static pthread_mutex_t nni_plat_lock = PTHREAD_MUTEX_INITIALIZER;
 static int nni_plat_inited = 0;
 static int nni_plat_forked = 0;
+static int nni_plat_ncpus = 1;
 
 pthread_condattr_t nni_cvattr;
 pthread_mutexattr_t nni_mxattr;
@@ -34,6 +39,8 @@ pthread_mutexattr_t nni_mxattr;
 
 int nni_plat_devnull = -1;
 
+#ifndef NNG_USE_FUTEX
+
 int
 nni_plat_mtx_init(nni_plat_mtx *mtx)
 {
@@ -132,6 +139,17 @@ nni_plat_cv_wake(nni_plat_cv *cv)
 }
 
 
+void
+nni_plat_cv_wake1(nni_plat_cv *cv)
+{
+	int rv;
+
+	if ((rv = pthread_cond_signal(&cv->cv)) != 0) {
+		nni_panic("pthread_cond_signal: %s", strerror(rv));
+	}
+}
+
+
 void
 nni_plat_cv_wait(nni_plat_cv *cv)
 {
@@ -178,6 +196,8 @@ nni_plat_cv_fini(nni_plat_cv *cv)
 	}
 }
 
+#endif  // NNG_USE_FUTEX
+
 
 static void *
 nni_plat_thr_main(void *arg)
@@ -224,6 +244,110 @@ nni_plat_thr_fini(nni_plat_thr *thr)
 }
 
 
+int
+nni_plat_thr_affinity(nni_plat_thr *thr, const uint8_t *mask, size_t len)
+{
+#ifdef NNG_HAVE_PTHREAD_SETAFFINITY
+	cpu_set_t set;
+	size_t i;
+	int rv;
+
+	CPU_ZERO(&set);
+	if (len == 0) {
+		for (i = 0; i < CPU_SETSIZE; i++) {
+			CPU_SET(i, &set);
+		}
+	}
+	for (i = 0; (i < (len * 8)) && (i < CPU_SETSIZE); i++) {
+		if (mask[i / 8] & (1u << (i % 8))) {
+			CPU_SET(i, &set);
+		}
+	}
+	rv = pthread_setaffinity_np(thr->tid, sizeof (set), &set);
+	switch (rv) {
+	case 0:
+		return (0);
+	case EINVAL:
+		return (NNG_EINVAL);
+	case ESRCH:
+		// The thread is already gone, so there is nothing to bind.
+		return (0);
+	default:
+		return (NNG_ENOTSUP);
+	}
+#else
+	NNI_ARG_UNUSED(thr);
+	NNI_ARG_UNUSED(mask);
+	NNI_ARG_UNUSED(len);
+	return (NNG_ENOTSUP);
+#endif
+}
+
+
+int
+nni_plat_affinity_check(const uint8_t *mask, size_t len)
+{
+#ifdef NNG_HAVE_PTHREAD_SETAFFINITY
+	size_t i;
+
+	if (len == 0) {
+		return (0);
+	}
+	for (i = 0; (i < (len * 8)) && (i < (size_t) nni_plat_ncpus); i++) {
+		if (mask[i / 8] & (1u << (i % 8))) {
+			return (0);
+		}
+	}
+	return (NNG_EINVAL);
+#else
+	NNI_ARG_UNUSED(mask);
+	NNI_ARG_UNUSED(len);
+	return (NNG_ENOTSUP);
+#endif
+}
+
+
+int
+nni_plat_ncpu(void)
+{
+	return (nni_plat_ncpus);
+}
+
+
+int
+nni_plat_tls_init(nni_plat_tls *tls, void (*destroy)(void *))
+{
+	if (pthread_key_create(&tls->key, destroy) != 0) {
+		return (NNG_ENOMEM);
+	}
+	return (0);
+}
+
+
+void
+nni_plat_tls_fini(nni_plat_tls *tls)
+{
+	(void) pthread_key_delete(tls->key);
+}
+
+
+void *
+nni_plat_tls_get(nni_plat_tls *tls)
+{
+	return (pthread_getspecific(tls->key));
+}
+
+
+int
+nni_plat_tls_set(nni_plat_tls *tls, void *val)
+{
+	if (pthread_setspecific(tls->key, val) != 0) {
+		return (NNG_ENOMEM);
+	}
+	return (0);
+}
+
+
 void
 nni_atfork_child(void)
 {
@@ -283,6 +407,11 @@ nni_plat_init(int (*helper)(void))
 		(void) close(nni_plat_devnull);
 		return (NNG_ENOMEM);
 	}
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((nni_plat_ncpus = (int) sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+		nni_plat_ncpus = 1;
+	}
+#endif
 	if ((rv = helper()) == 0) {
 		nni_plat_inited = 1;
 	}
@@ -25,15 +25,19 @@ struct nni_bus_sock {
 	nni_sock *	nsock;
 	int		raw;
 	int		closing;
-	nni_list	pipes;
+	int		pipebuf;
+	int		pipehwm;
+	nni_pipeset *	pipes;
 };
 
+// Default depth of each peer's send queue.
+#define NNI_BUS_PIPEBUF	16
+
 // An nni_bus_pipe is our per-pipe protocol private structure.
 struct nni_bus_pipe {
 	nni_pipe *	npipe;
 	nni_bus_sock *	psock;
 	nni_msgq *	sendq;
-	nni_list_node	node;
 	int		sigclose;
 };
 
@@ -46,9 +50,14 @@ nni_bus_sock_init(void **sp, nni_sock *nsock)
 	if ((psock = NNI_ALLOC_STRUCT(psock)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	NNI_LIST_INIT(&psock->pipes, nni_bus_pipe, node);
+	if ((rv = nni_pipeset_create(&psock->pipes)) != 0) {
+		NNI_FREE_STRUCT(psock);
+		return (rv);
+	}
 	psock->nsock = nsock;
 	psock->raw = 0;
+	psock->pipebuf = NNI_BUS_PIPEBUF;
+	psock->pipehwm = 0;
 
 	*sp = psock;
 	return (0);
@@ -60,25 +69,26 @@ nni_bus_sock_fini(void *arg)
 {
 	nni_bus_sock *psock = arg;
 
+	nni_pipeset_destroy(psock->pipes);
 	NNI_FREE_STRUCT(psock);
 }
 
 
 static int
-nni_bus_pipe_init(void **pp, nni_pipe *npipe, void *psock)
+nni_bus_pipe_init(void **pp, nni_pipe *npipe, void *arg)
 {
 	nni_bus_pipe *ppipe;
+	nni_bus_sock *psock = arg;
 	int rv;
 
 	if ((ppipe = NNI_ALLOC_STRUCT(ppipe)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	NNI_LIST_NODE_INIT(&ppipe->node);
-	// This depth could be tunable.
-	if ((rv = nni_msgq_init(&ppipe->sendq, 16)) != 0) {
+	if ((rv = nni_msgq_init(&ppipe->sendq, psock->pipebuf)) != 0) {
 		NNI_FREE_STRUCT(ppipe);
 		return (rv);
 	}
+	nni_msgq_set_maxbytes(ppipe->sendq, psock->pipehwm);
 	ppipe->npipe = npipe;
 	ppipe->psock = psock;
 	ppipe->sigclose = 0;
@@ -92,6 +102,9 @@ nni_bus_pipe_fini(void *arg)
 {
 	nni_bus_pipe *ppipe = arg;
 
+	// The sender may still be holding a snapshot that has this pipe.
+	nni_pipeset_sync(ppipe->psock->pipes);
+	nni_msgq_fini(ppipe->sendq);
 	NNI_FREE_STRUCT(ppipe);
 }
 
@@ -102,8 +115,7 @@ nni_bus_pipe_add(void *arg)
 	nni_bus_pipe *ppipe = arg;
 	nni_bus_sock *psock = ppipe->psock;
 
-	nni_list_append(&psock->pipes, ppipe);
-	return (0);
+	return (nni_pipeset_add(psock->pipes, ppipe));
 }
 
 
@@ -113,7 +125,7 @@ nni_bus_pipe_rem(void *arg)
 	nni_bus_pipe *ppipe = arg;
 	nni_bus_sock *psock = ppipe->psock;
 
-	nni_list_remove(&psock->pipes, ppipe);
+	nni_pipeset_remove(psock->pipes, ppipe);
 }
 
 
@@ -175,12 +187,43 @@ static int
 nni_bus_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 {
 	nni_bus_sock *psock = arg;
+	nni_pipeset_snap *snap;
+	nni_bus_pipe *pp;
 	int rv;
+	int i;
 
 	switch (opt) {
 	case NNG_OPT_RAW:
 		rv = nni_setopt_int(&psock->raw, buf, sz, 0, 1);
 		break;
+	case NNG_OPT_SNDBUF:
+		// This sizes the upper write queue and each pipe's queue.
+		// Each pipe needs at least one slot, or tryput would
+		// almost always fail.
+		if ((rv = nni_setopt_buf_min(nni_sock_sendq(psock->nsock),
+		    buf, sz, 1)) != 0) {
+			break;
+		}
+		psock->pipebuf = nni_msgq_cap(nni_sock_sendq(psock->nsock));
+		snap = nni_pipeset_hold(psock->pipes);
+		for (i = 0; i < snap->ps_npipes; i++) {
+			pp = snap->ps_pipes[i];
+			(void) nni_msgq_resize(pp->sendq, psock->pipebuf);
+		}
+		nni_pipeset_rele(psock->pipes, snap);
+		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_setopt_int(&psock->pipehwm, buf, sz, 0, 0x7fffffff);
+		if (rv != 0) {
+			break;
+		}
+		snap = nni_pipeset_hold(psock->pipes);
+		for (i = 0; i < snap->ps_npipes; i++) {
+			pp = snap->ps_pipes[i];
+			nni_msgq_set_maxbytes(pp->sendq, psock->pipehwm);
+		}
+		nni_pipeset_rele(psock->pipes, snap);
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -198,6 +241,9 @@ nni_bus_sock_getopt(void *arg, int opt, void *buf, size_t *szp)
 	case NNG_OPT_RAW:
 		rv = nni_getopt_int(&psock->raw, buf, szp);
 		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_getopt_int(&psock->pipehwm, buf, szp);
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -210,22 +256,23 @@ nni_bus_sock_sender(void *arg)
 {
 	nni_bus_sock *psock = arg;
 	nni_msgq *uwq = nni_sock_sendq(psock->nsock);
-	nni_mtx *mx = nni_sock_mtx(psock->nsock);
 	nni_msg *msg, *dup;
 
 	for (;;) {
+		nni_pipeset_snap *snap;
 		nni_bus_pipe *ppipe;
-		nni_bus_pipe *last;
 		int rv;
+		int i;
 
 		if ((rv = nni_msgq_get(uwq, &msg)) != 0) {
 			break;
 		}
 
-		nni_mtx_lock(mx);
-		last = nni_list_last(&psock->pipes);
-		NNI_LIST_FOREACH (&psock->pipes, ppipe) {
-			if (ppipe != last) {
+		// Walk a snapshot of the peers; see core/pipeset.h.
+		snap = nni_pipeset_hold(psock->pipes);
+		for (i = 0; i < snap->ps_npipes; i++) {
+			ppipe = snap->ps_pipes[i];
+			if (i != (snap->ps_npipes - 1)) {
 				rv = nni_msg_dup(&dup, msg);
 				if (rv != 0) {
 					continue;
@@ -237,11 +284,10 @@ nni_bus_sock_sender(void *arg)
 				nni_msg_free(dup);
 			}
 		}
-		nni_mtx_unlock(mx);
-
-		if (last == NULL) {
+		if (snap->ps_npipes == 0) {
 			nni_msg_free(msg);
 		}
+		nni_pipeset_rele(psock->pipes, snap);
 	}
 }
 
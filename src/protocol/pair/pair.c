@@ -15,6 +15,12 @@
 // Pair protocol.  The PAIR protocol is a simple 1:1 messaging pattern.
 // While a peer is connected to the server, all other peer connection
 // attempts are discarded.
+//
+// When the pipe is idle, and nothing is waiting on the upper write queue,
+// nni_pair_sock_send sends the message directly on the caller's thread,
+// saving the handoff to the pipe's sender.  Otherwise the message is
+// queued as usual.  Only one thread sends on the pipe at a time, and a
+// message is never sent directly ahead of one that was queued before it.
 
 typedef struct nni_pair_pipe	nni_pair_pipe;
 typedef struct nni_pair_sock	nni_pair_sock;
@@ -26,6 +32,9 @@ struct nni_pair_sock {
 	nni_msgq *	uwq;
 	nni_msgq *	urq;
 	int		raw;
+	nni_cv		cv;
+	nni_pair_pipe * sending;        // pipe with a send in progress
+	int		queued;         // queued messages not yet sent
 };
 
 // An nni_pair_pipe is our per-pipe protocol private structure.  We keep
@@ -36,6 +45,7 @@ struct nni_pair_pipe {
 	nni_pipe *	npipe;
 	nni_pair_sock * psock;
 	int		sigclose;
+	int		removed;
 };
 
 static void nni_pair_receiver(void *);
@@ -50,8 +60,14 @@ nni_pair_sock_init(void **sp, nni_sock *nsock)
 	if ((psock = NNI_ALLOC_STRUCT(psock)) == NULL) {
 		return (NNG_ENOMEM);
 	}
+	if ((rv = nni_cv_init(&psock->cv, nni_sock_mtx(nsock))) != 0) {
+		NNI_FREE_STRUCT(psock);
+		return (rv);
+	}
 	psock->nsock = nsock;
 	psock->ppipe = NULL;
+	psock->sending = NULL;
+	psock->queued = 0;
 	psock->raw = 0;
 	psock->uwq = nni_sock_sendq(nsock);
 	psock->urq = nni_sock_recvq(nsock);
@@ -65,6 +81,7 @@ nni_pair_sock_fini(void *arg)
 {
 	nni_pair_sock *psock = arg;
 
+	nni_cv_fini(&psock->cv);
 	NNI_FREE_STRUCT(psock);
 }
 
@@ -79,6 +96,7 @@ nni_pair_pipe_init(void **pp, nni_pipe *npipe, void *psock)
 	}
 	ppipe->npipe = npipe;
 	ppipe->sigclose = 0;
+	ppipe->removed = 0;
 	ppipe->psock = psock;
 	*pp = ppipe;
 	return (0);
@@ -117,6 +135,8 @@ nni_pair_pipe_rem(void *arg)
 	if (psock->ppipe == ppipe) {
 		psock->ppipe = NULL;
 	}
+	ppipe->removed = 1;
+	nni_cv_wake(&psock->cv);
 }
 
 
@@ -128,6 +148,7 @@ nni_pair_pipe_send(void *arg)
 	nni_msgq *uwq = psock->uwq;
 	nni_msgq *urq = psock->urq;
 	nni_pipe *npipe = ppipe->npipe;
+	nni_mtx *mx = nni_sock_mtx(psock->nsock);
 	nni_msg *msg;
 	int rv;
 
@@ -136,7 +157,23 @@ nni_pair_pipe_send(void *arg)
 		if (rv != 0) {
 			break;
 		}
+
+		// Wait for any direct send to finish.
+		nni_mtx_lock(mx);
+		while (psock->sending != NULL) {
+			nni_cv_wait(&psock->cv);
+		}
+		psock->sending = ppipe;
+		nni_mtx_unlock(mx);
+
 		rv = nni_pipe_send(npipe, msg);
+
+		nni_mtx_lock(mx);
+		psock->sending = NULL;
+		psock->queued--;
+		nni_cv_wake(&psock->cv);
+		nni_mtx_unlock(mx);
+
 		if (rv != 0) {
 			nni_msg_free(msg);
 			break;
@@ -144,6 +181,15 @@ nni_pair_pipe_send(void *arg)
 	}
 	nni_msgq_signal(urq, &ppipe->sigclose);
 	nni_pipe_close(npipe);
+
+	// A direct send may still be using the pipe.  Once the pipe has
+	// been removed no new ones can start, and when we return the pipe
+	// may be destroyed.
+	nni_mtx_lock(mx);
+	while ((!ppipe->removed) || (psock->sending == ppipe)) {
+		nni_cv_wait(&psock->cv);
+	}
+	nni_mtx_unlock(mx);
 }
 
 
@@ -173,6 +219,54 @@ nni_pair_pipe_recv(void *arg)
 }
 
 
+static int
+nni_pair_sock_send(void *arg, nni_msg *msg, nni_time expire)
+{
+	nni_pair_sock *psock = arg;
+	nni_pair_pipe *ppipe;
+	nni_mtx *mx = nni_sock_mtx(psock->nsock);
+	int sent = 0;
+	int rv;
+
+	nni_mtx_lock(mx);
+	if (((ppipe = psock->ppipe) != NULL) && (psock->sending == NULL) &&
+	    (psock->queued == 0)) {
+		psock->sending = ppipe;
+		nni_mtx_unlock(mx);
+
+		if (nni_pipe_cansend(ppipe->npipe, msg)) {
+			NNI_TRACE(msg, NNG_TRACE_UWQ);
+			if (nni_pipe_send(ppipe->npipe, msg) != 0) {
+				// As with the queued path, the message is
+				// lost with the pipe.
+				nni_msg_free(msg);
+				nni_pipe_close(ppipe->npipe);
+			}
+			sent = 1;
+		}
+
+		nni_mtx_lock(mx);
+		psock->sending = NULL;
+		nni_cv_wake(&psock->cv);
+		if (sent) {
+			nni_mtx_unlock(mx);
+			return (0);
+		}
+	}
+
+	// Busy, or no peer yet; take the slow path.
+	psock->queued++;
+	nni_mtx_unlock(mx);
+
+	if ((rv = nni_msgq_put_until(psock->uwq, msg, expire)) != 0) {
+		nni_mtx_lock(mx);
+		psock->queued--;
+		nni_mtx_unlock(mx);
+	}
+	return (rv);
+}
+
+
 static int
 nni_pair_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 {
@@ -224,6 +318,7 @@ static nni_proto_sock_ops nni_pair_sock_ops = {
 	.sock_fini	= nni_pair_sock_fini,
 	.sock_setopt	= nni_pair_sock_setopt,
 	.sock_getopt	= nni_pair_sock_getopt,
+	.sock_send	= nni_pair_sock_send,
 };
 
 nni_proto nni_pair_proto = {
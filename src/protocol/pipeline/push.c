@@ -13,8 +13,33 @@
 #include "core/nng_impl.h"
 
 // Push protocol.  The PUSH protocol is the "write" side of a pipeline.
-// Push distributes fairly, or tries to, by giving messages in round-robin
-// order.
+// By default push distributes fairly, or tries to, by giving messages in
+// round-robin order.  Other policies (NNG_OPT_LBPOLICY) take the load on
+// each pipe into account, so that slow consumers get less of the work:
+//
+// NNG_LB_LEASTBUSY picks the pipe with the fewest outstanding messages
+// (queued or being written).
+//
+// NNG_LB_TWOCHOICE picks two pipes at random, and uses the less busy one.
+// This is nearly as good as NNG_LB_LEASTBUSY, but is cheaper with many
+// pipes, and avoids herding onto a single idle pipe.
+//
+// NNG_LB_WEIGHTED uses smooth weighted round-robin, where each pipe's
+// weight is the inverse of the time it should take to drain what it has
+// outstanding.  That is based on how long its writes have taken, or, if
+// it is longer, on how long the message it is working on has been in
+// service, so a consumer that stops reading loses weight even though it
+// completes nothing.
+//
+// If the chosen pipe cannot take the message, we fall back to trying the
+// others in round-robin order, so a message is never held for one pipe
+// while another is able to take it.
+//
+// When a pipe is idle, and no messages are waiting to be placed, the
+// message is sent directly on the caller's thread (nni_push_sock_send),
+// rather than being handed through the upper write queue and the pipe's
+// own queue to its sender.  A message is never sent directly ahead of one
+// that was queued before it.
 
 typedef struct nni_push_pipe	nni_push_pipe;
 typedef struct nni_push_sock	nni_push_sock;
@@ -29,6 +54,10 @@ struct nni_push_sock {
 	nni_list	pipes;
 	nni_push_pipe * nextpipe;
 	int		npipes;
+	int		policy;
+	int		pipebuf;
+	int		pipehwm;
+	int		queued;         // on the upper write queue, or held
 	nni_sock *	sock;
 };
 
@@ -39,8 +68,33 @@ struct nni_push_pipe {
 	nni_msgq *	mq;
 	int		sigclose;
 	nni_list_node	node;
+	int		outstanding;    // queued or being sent
+	nni_time	busysince;      // when the current message started
+	nni_duration	svctime;        // average time to write, in usec
+	int		curweight;      // for weighted round-robin
+	int		direct;         // a direct send is in progress
+	int		removed;
 };
 
+// The service time average is an EWMA with this shift as its gain.
+#define NNI_PUSH_EWMA_SHIFT	3
+
+// Weights are this divided by the expected drain time in usec, so that a
+// pipe which drains in under a microsecond weighs this much, and a very
+// slow one at least 1.
+#define NNI_PUSH_WEIGHT_MAX	100000
+
+// Pipe queues always have room for at least one message.  With no send
+// buffer, a pipe only takes a message when it has nothing outstanding, so
+// that the message is not held behind another send.  We don't rely on the
+// queue being unbuffered for that, because whether a put succeeds would
+// then depend on the sender having parked in nni_msgq_get, and nothing
+// tells us when that happens.  Instead every change that can let a pipe
+// take a message is made, or followed, under the socket lock, and wakes
+// the worker if it is waiting.
+#define NNI_PUSH_PIPECAP(push)	((push)->pipebuf > 0 ? (push)->pipebuf : 1)
+
+
 static int
 nni_push_sock_init(void **pushp, nni_sock *sock)
 {
@@ -59,6 +113,10 @@ nni_push_sock_init(void **pushp, nni_sock *sock)
 	push->npipes = 0;
 	push->wantw = 0;
 	push->nextpipe = NULL;
+	push->policy = NNG_LB_ROUNDROBIN;
+	push->pipebuf = 0;
+	push->pipehwm = 0;
+	push->queued = 0;
 	push->sock = sock;
 	push->uwq = nni_sock_sendq(sock);
 	*pushp = push;
@@ -93,19 +151,27 @@ static int
 nni_push_pipe_init(void **ppp, nni_pipe *pipe, void *psock)
 {
 	nni_push_pipe *pp;
+	nni_push_sock *push = psock;
 	int rv;
 
 	if ((pp = NNI_ALLOC_STRUCT(pp)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	if ((rv = nni_msgq_init(&pp->mq, 0)) != 0) {
+	if ((rv = nni_msgq_init(&pp->mq, NNI_PUSH_PIPECAP(push))) != 0) {
 		NNI_FREE_STRUCT(pp);
 		return (rv);
 	}
+	nni_msgq_set_maxbytes(pp->mq, push->pipehwm);
 	NNI_LIST_NODE_INIT(&pp->node);
 	pp->pipe = pipe;
 	pp->sigclose = 0;
-	pp->push = psock;
+	pp->push = push;
+	pp->outstanding = 0;
+	pp->busysince = 0;
+	pp->svctime = 0;
+	pp->curweight = 0;
+	pp->direct = 0;
+	pp->removed = 0;
 	*ppp = pp;
 	return (0);
 }
@@ -152,6 +218,30 @@ nni_push_pipe_rem(void *arg)
 	}
 	push->npipes--;
 	nni_list_remove(&push->pipes, pp);
+	pp->removed = 1;
+	nni_cv_wake(&push->cv);
+}
+
+
+// nni_push_busy accounts for a message given to the pipe.  The socket
+// lock must be held.
+static void
+nni_push_busy(nni_push_pipe *pp)
+{
+	if (pp->outstanding++ == 0) {
+		pp->busysince = nni_clock();
+	}
+}
+
+
+// nni_push_done accounts for a message the pipe has finished writing,
+// which took svc usec.  The socket lock must be held.
+static void
+nni_push_done(nni_push_pipe *pp, nni_duration svc)
+{
+	pp->outstanding--;
+	pp->svctime += (svc - pp->svctime) / (1 << NNI_PUSH_EWMA_SHIFT);
+	pp->busysince = nni_clock();
 }
 
 
@@ -162,22 +252,48 @@ nni_push_pipe_send(void *arg)
 	nni_push_sock *push = pp->push;
 	nni_mtx *mx = nni_sock_mtx(push->sock);
 	nni_msg *msg;
+	nni_time start;
+	nni_duration svc;
+	int rv;
 
 	for (;;) {
 		if (nni_msgq_get_sig(pp->mq, &msg, &pp->sigclose) != 0) {
 			break;
 		}
+
+		// There is room in our queue now.
+		nni_mtx_lock(mx);
+		if (push->wantw) {
+			nni_cv_wake(&push->cv);
+		}
+		nni_mtx_unlock(mx);
+
+		start = nni_clock();
+		rv = nni_pipe_send(pp->pipe, msg);
+		svc = (nni_duration) (nni_clock() - start);
+
 		nni_mtx_lock(mx);
+		nni_push_done(pp, svc);
 		if (push->wantw) {
 			nni_cv_wake(&push->cv);
 		}
 		nni_mtx_unlock(mx);
-		if (nni_pipe_send(pp->pipe, msg) != 0) {
+
+		if (rv != 0) {
 			nni_msg_free(msg);
 			break;
 		}
 	}
 	nni_pipe_close(pp->pipe);
+
+	// A direct send may still be using the pipe.  Once the pipe has
+	// been removed no new ones can start, and when we return the pipe
+	// may be destroyed.
+	nni_mtx_lock(mx);
+	while ((!pp->removed) || pp->direct) {
+		nni_cv_wait(&push->cv);
+	}
+	nni_mtx_unlock(mx);
 }
 
 
@@ -202,12 +318,39 @@ static int
 nni_push_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 {
 	nni_push_sock *push = arg;
+	nni_push_pipe *pp;
 	int rv;
 
 	switch (opt) {
 	case NNG_OPT_RAW:
 		rv = nni_setopt_int(&push->raw, buf, sz, 0, 1);
 		break;
+	case NNG_OPT_LBPOLICY:
+		rv = nni_setopt_int(&push->policy, buf, sz,
+		    NNG_LB_ROUNDROBIN, NNG_LB_WEIGHTED);
+		break;
+	case NNG_OPT_SNDBUF:
+		// This sizes both the upper write queue and each pipe's
+		// own queue.  The latter lets a busy consumer have work
+		// queued up behind the message it is processing.
+		if ((rv = nni_setopt_buf(push->uwq, buf, sz)) != 0) {
+			break;
+		}
+		push->pipebuf = nni_msgq_cap(push->uwq);
+		NNI_LIST_FOREACH (&push->pipes, pp) {
+			(void) nni_msgq_resize(pp->mq, NNI_PUSH_PIPECAP(push));
+		}
+		nni_cv_wake(&push->cv);
+		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_setopt_int(&push->pipehwm, buf, sz, 0, 0x7fffffff);
+		if (rv != 0) {
+			break;
+		}
+		NNI_LIST_FOREACH (&push->pipes, pp) {
+			nni_msgq_set_maxbytes(pp->mq, push->pipehwm);
+		}
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -225,6 +368,12 @@ nni_push_sock_getopt(void *arg, int opt, void *buf, size_t *szp)
 	case NNG_OPT_RAW:
 		rv = nni_getopt_int(&push->raw, buf, szp);
 		break;
+	case NNG_OPT_LBPOLICY:
+		rv = nni_getopt_int(&push->policy, buf, szp);
+		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_getopt_int(&push->pipehwm, buf, szp);
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -232,15 +381,118 @@ nni_push_sock_getopt(void *arg, int opt, void *buf, size_t *szp)
 }
 
 
+static nni_push_pipe *
+nni_push_nth(nni_push_sock *push, int n)
+{
+	nni_push_pipe *pp;
+
+	NNI_LIST_FOREACH (&push->pipes, pp) {
+		if (n-- == 0) {
+			break;
+		}
+	}
+	return (pp);
+}
+
+
+// nni_push_put gives the message to the pipe if it can take it now.
+// Pipes busy with a direct send are skipped; their senders must not be
+// handed anything until it is done.
+static int
+nni_push_put(nni_push_sock *push, nni_push_pipe *pp, nni_msg *msg)
+{
+	if (pp->direct) {
+		return (NNG_EAGAIN);
+	}
+	if ((push->pipebuf == 0) && (pp->outstanding != 0)) {
+		return (NNG_EAGAIN);
+	}
+	if (nni_msgq_tryput(pp->mq, msg) != 0) {
+		return (NNG_EAGAIN);
+	}
+	nni_push_busy(pp);
+	return (0);
+}
+
+
+// nni_push_choose picks the preferred pipe according to the policy.  It
+// returns NULL for round-robin, which has no preference.
+static nni_push_pipe *
+nni_push_choose(nni_push_sock *push)
+{
+	nni_push_pipe *pp;
+	nni_push_pipe *best = NULL;
+	nni_push_pipe *alt;
+	nni_duration est;
+	nni_time now;
+	int total;
+	int w;
+	int n;
+
+	switch (push->policy) {
+	case NNG_LB_LEASTBUSY:
+		NNI_LIST_FOREACH (&push->pipes, pp) {
+			if ((best == NULL) ||
+			    (pp->outstanding < best->outstanding)) {
+				best = pp;
+			}
+		}
+		break;
+
+	case NNG_LB_TWOCHOICE:
+		if (push->npipes < 2) {
+			break;
+		}
+		n = nni_random() % push->npipes;
+		best = nni_push_nth(push, n);
+		n = (n + 1 + (nni_random() % (push->npipes - 1))) %
+		    push->npipes;
+		alt = nni_push_nth(push, n);
+		if (alt->outstanding < best->outstanding) {
+			best = alt;
+		}
+		break;
+
+	case NNG_LB_WEIGHTED:
+		// A pipe that is stuck on a message is at least as slow as
+		// that message has been, even if it has never finished one.
+		total = 0;
+		now = nni_clock();
+		NNI_LIST_FOREACH (&push->pipes, pp) {
+			est = pp->svctime;
+			if ((pp->outstanding > 0) &&
+			    ((nni_duration) (now - pp->busysince) > est)) {
+				est = (nni_duration) (now - pp->busysince);
+			}
+			est *= (pp->outstanding + 1);
+			if (est >= NNI_PUSH_WEIGHT_MAX) {
+				w = 1;
+			} else {
+				w = (int) (NNI_PUSH_WEIGHT_MAX / (est + 1));
+			}
+			pp->curweight += w;
+			total += w;
+			if ((best == NULL) || (pp->curweight > best->curweight)) {
+				best = pp;
+			}
+		}
+		if (best != NULL) {
+			best->curweight -= total;
+		}
+		break;
+	}
+	return (best);
+}
+
+
 static void
-nni_push_sock_send(void *arg)
+nni_push_sock_worker(void *arg)
 {
 	nni_push_sock *push = arg;
 	nni_push_pipe *pp;
 	nni_msgq *uwq = push->uwq;
 	nni_msg *msg = NULL;
 	nni_mtx *mx = nni_sock_mtx(push->sock);
-	int rv;
 	int i;
 
 	for (;;) {
@@ -252,22 +504,29 @@ nni_push_sock_send(void *arg)
 		nni_mtx_lock(mx);
 		if (push->closing) {
 			if (msg != NULL) {
+				push->queued--;
 				nni_mtx_unlock(mx);
 				nni_msg_free(msg);
 				return;
 			}
 		}
-		for (i = 0; i < push->npipes; i++) {
+		if (((pp = nni_push_choose(push)) != NULL) &&
+		    (nni_push_put(push, pp, msg) == 0)) {
+			msg = NULL;
+		}
+		for (i = 0; (msg != NULL) && (i < push->npipes); i++) {
 			pp = push->nextpipe;
 			if (pp == NULL) {
 				pp = nni_list_first(&push->pipes);
 			}
 			push->nextpipe = nni_list_next(&push->pipes, pp);
-			if (nni_msgq_tryput(pp->mq, msg) == 0) {
+			if (nni_push_put(push, pp, msg) == 0) {
 				msg = NULL;
-				break;
 			}
 		}
+		if (msg == NULL) {
+			push->queued--;
+		}
 		if (msg != NULL) {
 			// We weren't able to deliver it, so keep it and
 			// wait for a sender to let us know its ready.
@@ -281,6 +540,89 @@ nni_push_sock_send(void *arg)
 }
 
 
+// nni_push_idle returns a pipe that has nothing queued or being sent,
+// preferring the one the policy chooses, or NULL if there is none.
+static nni_push_pipe *
+nni_push_idle(nni_push_sock *push)
+{
+	nni_push_pipe *pp;
+	int i;
+
+	if (((pp = nni_push_choose(push)) != NULL) && (pp->outstanding == 0)) {
+		return (pp);
+	}
+	for (i = 0; i < push->npipes; i++) {
+		pp = push->nextpipe;
+		if (pp == NULL) {
+			pp = nni_list_first(&push->pipes);
+		}
+		push->nextpipe = nni_list_next(&push->pipes, pp);
+		if (pp->outstanding == 0) {
+			return (pp);
+		}
+	}
+	return (NULL);
+}
+
+
+static int
+nni_push_sock_send(void *arg, nni_msg *msg, nni_time expire)
+{
+	nni_push_sock *push = arg;
+	nni_push_pipe *pp;
+	nni_mtx *mx = nni_sock_mtx(push->sock);
+	nni_time start;
+	nni_duration svc;
+	int sent = 0;
+	int rv;
+
+	nni_mtx_lock(mx);
+	if ((push->queued == 0) && (!push->closing) &&
+	    ((pp = nni_push_idle(push)) != NULL)) {
+		pp->direct = 1;
+		nni_push_busy(pp);
+		nni_mtx_unlock(mx);
+
+		start = nni_clock();
+		if (nni_pipe_cansend(pp->pipe, msg)) {
+			NNI_TRACE(msg, NNG_TRACE_UWQ);
+			if (nni_pipe_send(pp->pipe, msg) != 0) {
+				// As with the queued path, the message is
+				// lost with the pipe.
+				nni_msg_free(msg);
+				nni_pipe_close(pp->pipe);
+			}
+			sent = 1;
+		}
+		svc = (nni_duration) (nni_clock() - start);
+
+		nni_mtx_lock(mx);
+		pp->direct = 0;
+		if (sent) {
+			nni_push_done(pp, svc);
+		} else {
+			pp->outstanding--;
+		}
+		nni_cv_wake(&push->cv);
+		if (sent) {
+			nni_mtx_unlock(mx);
+			return (0);
+		}
+	}
+
+	// Busy, or no pipes; take the slow path.
+	push->queued++;
+	nni_mtx_unlock(mx);
+
+	if ((rv = nni_msgq_put_until(push->uwq, msg, expire)) != 0) {
+		nni_mtx_lock(mx);
+		push->queued--;
+		nni_mtx_unlock(mx);
+	}
+	return (rv);
+}
+
+
 // This is the global protocol structure -- our linkage to the core.
 // This should be the only global non-static symbol in this file.
 static nni_proto_pipe_ops nni_push_pipe_ops = {
@@ -298,7 +640,8 @@ static nni_proto_sock_ops nni_push_sock_ops = {
 	.sock_close	= nni_push_sock_close,
 	.sock_setopt	= nni_push_sock_setopt,
 	.sock_getopt	= nni_push_sock_getopt,
-	.sock_worker	= { nni_push_sock_send },
+	.sock_send	= nni_push_sock_send,
+	.sock_worker	= { nni_push_sock_worker },
 };
 
 nni_proto nni_push_proto = {
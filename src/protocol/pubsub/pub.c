@@ -19,13 +19,82 @@
 
 typedef struct nni_pub_pipe	nni_pub_pipe;
 typedef struct nni_pub_sock	nni_pub_sock;
+typedef struct nni_pub_job	nni_pub_job;
+typedef struct nni_pub_shards	nni_pub_shards;
+typedef struct nni_pub_fanout	nni_pub_fanout;
+
+// Default depth of each subscriber's queue.  This absorbs short stalls
+// by a subscriber; beyond that, messages for it are dropped.
+#define NNI_PUB_PIPEBUF		16
+
+// Limit on the number of fan-out workers, and the depth of the job queue
+// feeding each one.  When a worker's queue is full, the sender waits.
+#define NNI_PUB_MAXFANOUT	64
+#define NNI_PUB_JOBQ		64
+
+// The option for the number of workers is changed under the socket lock,
+// but the sender reads it for every message, so it does that without the
+// lock, ordered with a barrier as the socket core does for its flags.
+#ifdef NNG_HAVE_GCC_ATOMIC_BUILTINS
+#define NNI_PUB_BARRIER()	__sync_synchronize()
+#else
+#define NNI_PUB_BARRIER()
+#endif
+
+// With many subscribers, duplicating and queueing each message is more
+// than one thread can keep up with.  The sender can hand each message to
+// a set of fan-out workers instead.  Each worker owns the shard of the
+// subscribers whose pipe ID is congruent to its index, so any given
+// subscriber is always served by the same worker, and sees messages in
+// order.  A job is shared by all workers; the last one to finish with it
+// frees it.
+struct nni_pub_job {
+	nni_msg *		msg;
+	nni_pipeset_snap *	snap;
+	nni_pub_shards *	shards;
+	int			refcnt;         // protected by pub->jobmx
+};
+
+// The subscribers of a snapshot, sorted by shard, so that each worker
+// walks only its own.  Shard i is pipes[start[i]] up to pipes[start[i+1]].
+// The sender keeps the table for as long as the membership stays the
+// same; it does not hold the snapshot itself, as each job does that.
+struct nni_pub_shards {
+	uint64_t		gen;
+	int			nshards;
+	int			refcnt;         // protected by pub->jobmx
+	size_t			size;
+	int *			start;
+	nni_pub_pipe **		pipes;
+};
+
+struct nni_pub_fanout {
+	nni_pub_sock *		pub;
+	int			shard;
+	int			closing;
+	nni_mtx			mx;
+	nni_cv			cv;
+	nni_thr			thr;
+	nni_pub_job *		jobs[NNI_PUB_JOBQ];
+	int			get;
+	int			len;
+};
 
 // An nni_pub_sock is our per-socket protocol private structure.
 struct nni_pub_sock {
 	nni_sock *	sock;
 	nni_msgq *	uwq;
 	int		raw;
-	nni_list	pipes;
+	int		pipebuf;
+	int		pipehwm;
+	int		nfanout;        // requested workers (option)
+	nni_pipeset *	pipes;
+
+	// These are only touched by the sender thread.
+	int		nworkers;       // running workers
+	nni_pub_fanout	workers[NNI_PUB_MAXFANOUT];
+	nni_pub_shards *shards;         // table for the current snapshot
+	nni_mtx		jobmx;
 };
 
 // An nni_pub_pipe is our per-pipe protocol private structure.
@@ -33,7 +102,7 @@ struct nni_pub_pipe {
 	nni_pipe *	pipe;
 	nni_pub_sock *	pub;
 	nni_msgq *	sendq;
-	nni_list_node	node;
+	uint32_t	id;
 	int		sigclose;
 };
 
@@ -46,9 +115,22 @@ nni_pub_sock_init(void **pubp, nni_sock *sock)
 	if ((pub = NNI_ALLOC_STRUCT(pub)) == NULL) {
 		return (NNG_ENOMEM);
 	}
+	if ((rv = nni_mtx_init(&pub->jobmx)) != 0) {
+		NNI_FREE_STRUCT(pub);
+		return (rv);
+	}
+	if ((rv = nni_pipeset_create(&pub->pipes)) != 0) {
+		nni_mtx_fini(&pub->jobmx);
+		NNI_FREE_STRUCT(pub);
+		return (rv);
+	}
 	pub->sock = sock;
 	pub->raw = 0;
-	NNI_LIST_INIT(&pub->pipes, nni_pub_pipe, node);
+	pub->pipebuf = NNI_PUB_PIPEBUF;
+	pub->pipehwm = 0;
+	pub->nfanout = 1;
+	pub->nworkers = 0;
+	pub->shards = NULL;
 
 	pub->uwq = nni_sock_sendq(sock);
 
@@ -63,6 +145,8 @@ nni_pub_sock_fini(void *arg)
 {
 	nni_pub_sock *pub = arg;
 
+	nni_pipeset_destroy(pub->pipes);
+	nni_mtx_fini(&pub->jobmx);
 	NNI_FREE_STRUCT(pub);
 }
 
@@ -71,16 +155,17 @@ static int
 nni_pub_pipe_init(void **ppp, nni_pipe *pipe, void *psock)
 {
 	nni_pub_pipe *pp;
+	nni_pub_sock *pub = psock;
 	int rv;
 
 	if ((pp = NNI_ALLOC_STRUCT(pp)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	// XXX: consider making this depth tunable
-	if ((rv = nni_msgq_init(&pp->sendq, 16)) != 0) {
+	if ((rv = nni_msgq_init(&pp->sendq, pub->pipebuf)) != 0) {
 		NNI_FREE_STRUCT(pp);
 		return (rv);
 	}
+	nni_msgq_set_maxbytes(pp->sendq, pub->pipehwm);
 	pp->pipe = pipe;
 	pp->pub = psock;
 	pp->sigclose = 0;
@@ -94,6 +179,8 @@ nni_pub_pipe_fini(void *arg)
 {
 	nni_pub_pipe *pp = arg;
 
+	// The sender may still be holding a snapshot that has this pipe.
+	nni_pipeset_sync(pp->pub->pipes);
 	nni_msgq_fini(pp->sendq);
 	NNI_FREE_STRUCT(pp);
 }
@@ -108,8 +195,8 @@ nni_pub_pipe_add(void *arg)
 	if (nni_pipe_peer(pp->pipe) != NNG_PROTO_SUB) {
 		return (NNG_EPROTO);
 	}
-	nni_list_append(&pub->pipes, pp);
-	return (0);
+	pp->id = nni_pipe_id(pp->pipe);
+	return (nni_pipeset_add(pub->pipes, pp));
 }
 
 
@@ -119,7 +206,256 @@ nni_pub_pipe_rem(void *arg)
 	nni_pub_pipe *pp = arg;
 	nni_pub_sock *pub = pp->pub;
 
-	nni_list_remove(&pub->pipes, pp);
+	nni_pipeset_remove(pub->pipes, pp);
+}
+
+
+// nni_pub_shards_build sorts the subscribers in the snapshot by shard.
+static nni_pub_shards *
+nni_pub_shards_build(nni_pipeset_snap *snap, int nshards)
+{
+	nni_pub_shards *sh;
+	nni_pub_pipe *pp;
+	size_t size;
+	int i;
+
+	size = sizeof (*sh) + (snap->ps_npipes * sizeof (nni_pub_pipe *)) +
+	    ((nshards + 1) * sizeof (int));
+	if ((sh = nni_alloc(size)) == NULL) {
+		return (NULL);
+	}
+	sh->gen = snap->ps_gen;
+	sh->nshards = nshards;
+	sh->refcnt = 1;
+	sh->size = size;
+	sh->pipes = (nni_pub_pipe **) (sh + 1);
+	sh->start = (int *) (sh->pipes + snap->ps_npipes);
+
+	// Count each shard, turn the counts into offsets, and place the
+	// pipes.  Placing advances each offset to the start of the next
+	// shard, so they are shifted back down afterwards.
+	for (i = 0; i <= nshards; i++) {
+		sh->start[i] = 0;
+	}
+	for (i = 0; i < snap->ps_npipes; i++) {
+		pp = snap->ps_pipes[i];
+		sh->start[(pp->id % nshards) + 1]++;
+	}
+	for (i = 0; i < nshards; i++) {
+		sh->start[i + 1] += sh->start[i];
+	}
+	for (i = 0; i < snap->ps_npipes; i++) {
+		pp = snap->ps_pipes[i];
+		sh->pipes[sh->start[pp->id % nshards]++] = pp;
+	}
+	for (i = nshards; i > 0; i--) {
+		sh->start[i] = sh->start[i - 1];
+	}
+	sh->start[0] = 0;
+	return (sh);
+}
+
+
+static void
+nni_pub_shards_rele(nni_pub_sock *pub, nni_pub_shards *sh)
+{
+	int last;
+
+	nni_mtx_lock(&pub->jobmx);
+	last = (--sh->refcnt == 0);
+	nni_mtx_unlock(&pub->jobmx);
+
+	if (last) {
+		nni_free(sh, sh->size);
+	}
+}
+
+
+// nni_pub_fanout_shard delivers a copy of the job's message to each
+// subscriber in the given shard.
+static void
+nni_pub_fanout_shard(nni_pub_job *job, int shard)
+{
+	nni_pub_shards *sh = job->shards;
+	nni_pub_pipe *pp;
+	nni_msg *dup;
+	int i;
+
+	for (i = sh->start[shard]; i < sh->start[shard + 1]; i++) {
+		pp = sh->pipes[i];
+		if (nni_msg_dup(&dup, job->msg) != 0) {
+			continue;
+		}
+		if (nni_msgq_tryput(pp->sendq, dup) != 0) {
+			nni_msg_free(dup);
+		}
+	}
+}
+
+
+static void
+nni_pub_job_rele(nni_pub_sock *pub, nni_pub_job *job)
+{
+	int last;
+
+	nni_mtx_lock(&pub->jobmx);
+	last = (--job->refcnt == 0);
+	nni_mtx_unlock(&pub->jobmx);
+
+	if (last) {
+		nni_msg_free(job->msg);
+		nni_pipeset_rele(pub->pipes, job->snap);
+		nni_pub_shards_rele(pub, job->shards);
+		NNI_FREE_STRUCT(job);
+	}
+}
+
+
+static void
+nni_pub_fanout_worker(void *arg)
+{
+	nni_pub_fanout *fo = arg;
+	nni_pub_job *job;
+
+	nni_mtx_lock(&fo->mx);
+	for (;;) {
+		if (fo->len == 0) {
+			if (fo->closing) {
+				break;
+			}
+			nni_cv_wait(&fo->cv);
+			continue;
+		}
+		job = fo->jobs[fo->get];
+		fo->get = (fo->get + 1) % NNI_PUB_JOBQ;
+		fo->len--;
+		nni_cv_wake(&fo->cv);
+		nni_mtx_unlock(&fo->mx);
+
+		nni_pub_fanout_shard(job, fo->shard);
+		nni_pub_job_rele(fo->pub, job);
+
+		nni_mtx_lock(&fo->mx);
+	}
+	nni_mtx_unlock(&fo->mx);
+}
+
+
+static void
+nni_pub_fanout_submit(nni_pub_fanout *fo, nni_pub_job *job)
+{
+	nni_mtx_lock(&fo->mx);
+	while (fo->len == NNI_PUB_JOBQ) {
+		nni_cv_wait(&fo->cv);
+	}
+	fo->jobs[(fo->get + fo->len) % NNI_PUB_JOBQ] = job;
+	fo->len++;
+	nni_cv_wake(&fo->cv);
+	nni_mtx_unlock(&fo->mx);
+}
+
+
+// nni_pub_fanout_stop shuts down all the fan-out workers.  Any jobs they
+// did not get to are finished here, so nothing is lost or reordered.
+static void
+nni_pub_fanout_stop(nni_pub_sock *pub)
+{
+	nni_pub_fanout *fo;
+	nni_pub_job *job;
+	int i;
+
+	for (i = 0; i < pub->nworkers; i++) {
+		fo = &pub->workers[i];
+		nni_mtx_lock(&fo->mx);
+		fo->closing = 1;
+		nni_cv_wake(&fo->cv);
+		nni_mtx_unlock(&fo->mx);
+	}
+	for (i = 0; i < pub->nworkers; i++) {
+		fo = &pub->workers[i];
+		nni_thr_fini(&fo->thr);
+		while (fo->len > 0) {
+			job = fo->jobs[fo->get];
+			fo->get = (fo->get + 1) % NNI_PUB_JOBQ;
+			fo->len--;
+			nni_pub_fanout_shard(job, fo->shard);
+			nni_pub_job_rele(pub, job);
+		}
+		nni_cv_fini(&fo->cv);
+		nni_mtx_fini(&fo->mx);
+	}
+	pub->nworkers = 0;
+}
+
+
+// nni_pub_fanout_start starts the requested number of fan-out workers.
+// A single worker is pointless, so in that case (or if we cannot start
+// the threads) the sender does the fan-out itself.
+static void
+nni_pub_fanout_start(nni_pub_sock *pub, int n)
+{
+	nni_pub_fanout *fo;
+	int i;
+
+	if (n < 2) {
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		fo = &pub->workers[i];
+		fo->pub = pub;
+		fo->shard = i;
+		fo->closing = 0;
+		fo->get = 0;
+		fo->len = 0;
+		if (nni_mtx_init(&fo->mx) != 0) {
+			break;
+		}
+		if (nni_cv_init(&fo->cv, &fo->mx) != 0) {
+			nni_mtx_fini(&fo->mx);
+			break;
+		}
+		if (nni_thr_init(&fo->thr, nni_pub_fanout_worker, fo) != 0) {
+			nni_cv_fini(&fo->cv);
+			nni_mtx_fini(&fo->mx);
+			break;
+		}
+		pub->nworkers++;
+	}
+	if (pub->nworkers != n) {
+		nni_pub_fanout_stop(pub);
+		return;
+	}
+	nni_mtx_lock(nni_sock_mtx(pub->sock));
+	for (i = 0; i < n; i++) {
+		nni_sock_bindthr(pub->sock, &pub->workers[i].thr);
+		nni_thr_run(&pub->workers[i].thr);
+	}
+	nni_mtx_unlock(nni_sock_mtx(pub->sock));
+}
+
+
+// nni_pub_shards_get returns the shard table for the snapshot, with a
+// reference held, building a new one if the membership or the number of
+// workers has changed.
+static nni_pub_shards *
+nni_pub_shards_get(nni_pub_sock *pub, nni_pipeset_snap *snap)
+{
+	nni_pub_shards *sh = pub->shards;
+
+	if ((sh == NULL) || (sh->gen != snap->ps_gen) ||
+	    (sh->nshards != pub->nworkers)) {
+		if ((sh = nni_pub_shards_build(snap, pub->nworkers)) == NULL) {
+			return (NULL);
+		}
+		if (pub->shards != NULL) {
+			nni_pub_shards_rele(pub, pub->shards);
+		}
+		pub->shards = sh;
+	}
+	nni_mtx_lock(&pub->jobmx);
+	sh->refcnt++;
+	nni_mtx_unlock(&pub->jobmx);
+	return (sh);
 }
 
 
@@ -129,21 +465,66 @@ nni_pub_sock_send(void *arg)
 	nni_pub_sock *pub = arg;
 	nni_msgq *uwq = pub->uwq;
 	nni_msg *msg, *dup;
-	nni_mtx *mx = nni_sock_mtx(pub->sock);
+	int nfanout = 1;
 
 	for (;;) {
+		nni_pipeset_snap *snap;
 		nni_pub_pipe *pp;
-		nni_pub_pipe *last;
+		nni_pub_job *job;
 		int rv;
+		int i;
 
 		if ((rv = nni_msgq_get(uwq, &msg)) != 0) {
 			break;
 		}
 
-		nni_mtx_lock(mx);
-		last = nni_list_last(&pub->pipes);
-		NNI_LIST_FOREACH (&pub->pipes, pp) {
-			if (pp != last) {
+		// Changing the number of workers changes the sharding, so
+		// the old workers are drained before new ones start.
+		i = *(volatile int *) &pub->nfanout;
+		NNI_PUB_BARRIER();
+		if (i != nfanout) {
+			nni_pub_fanout_stop(pub);
+			nni_pub_fanout_start(pub, i);
+			nfanout = i;
+		}
+
+		// The fan-out runs against a snapshot of the subscribers,
+		// so pipes can come and go (and the socket lock is free for
+		// other use) while we work through a large list.
+		snap = nni_pipeset_hold(pub->pipes);
+		if (snap->ps_npipes == 0) {
+			nni_msg_free(msg);
+			nni_pipeset_rele(pub->pipes, snap);
+			continue;
+		}
+
+		if ((pub->nworkers > 0) &&
+		    ((job = NNI_ALLOC_STRUCT(job)) != NULL)) {
+			if ((job->shards = nni_pub_shards_get(pub, snap)) !=
+			    NULL) {
+				job->msg = msg;
+				job->snap = snap;
+				job->refcnt = pub->nworkers;
+				for (i = 0; i < pub->nworkers; i++) {
+					nni_pub_fanout_submit(
+						&pub->workers[i], job);
+				}
+				continue;
+			}
+			NNI_FREE_STRUCT(job);
+		}
+
+		// If we could not allocate a job, the workers might still
+		// have earlier messages queued; let them finish first so
+		// that per-subscriber ordering holds.
+		if (pub->nworkers > 0) {
+			nni_pub_fanout_stop(pub);
+			nni_pub_fanout_start(pub, nfanout);
+		}
+
+		for (i = 0; i < snap->ps_npipes; i++) {
+			pp = snap->ps_pipes[i];
+			if (i != (snap->ps_npipes - 1)) {
 				rv = nni_msg_dup(&dup, msg);
 				if (rv != 0) {
 					continue;
@@ -155,11 +536,13 @@ nni_pub_sock_send(void *arg)
 				nni_msg_free(dup);
 			}
 		}
-		nni_mtx_unlock(mx);
+		nni_pipeset_rele(pub->pipes, snap);
+	}
 
-		if (last == NULL) {
-			nni_msg_free(msg);
-		}
+	nni_pub_fanout_stop(pub);
+	if (pub->shards != NULL) {
+		nni_pub_shards_rele(pub, pub->shards);
+		pub->shards = NULL;
 	}
 }
 
@@ -218,12 +601,51 @@ static int
 nni_pub_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 {
 	nni_pub_sock *pub = arg;
+	nni_pipeset_snap *snap;
+	nni_pub_pipe *pp;
 	int rv;
+	int i;
 
 	switch (opt) {
 	case NNG_OPT_RAW:
 		rv = nni_setopt_int(&pub->raw, buf, sz, 0, 1);
 		break;
+	case NNG_OPT_SNDBUF:
+		// This sizes the upper write queue and each pipe's queue.
+		// An unbuffered pipe queue would drop nearly every message,
+		// since the fan-out never waits, so at least one is needed.
+		if ((rv = nni_setopt_buf_min(pub->uwq, buf, sz, 1)) != 0) {
+			break;
+		}
+		pub->pipebuf = nni_msgq_cap(pub->uwq);
+		snap = nni_pipeset_hold(pub->pipes);
+		for (i = 0; i < snap->ps_npipes; i++) {
+			pp = snap->ps_pipes[i];
+			(void) nni_msgq_resize(pp->sendq, pub->pipebuf);
+		}
+		nni_pipeset_rele(pub->pipes, snap);
+		break;
+	case NNG_OPT_FANOUT:
+		rv = nni_setopt_int(&i, buf, sz, 1, NNI_PUB_MAXFANOUT);
+		if (rv != 0) {
+			break;
+		}
+		NNI_PUB_BARRIER();
+		*(volatile int *) &pub->nfanout = i;
+		NNI_PUB_BARRIER();
+		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_setopt_int(&pub->pipehwm, buf, sz, 0, 0x7fffffff);
+		if (rv != 0) {
+			break;
+		}
+		snap = nni_pipeset_hold(pub->pipes);
+		for (i = 0; i < snap->ps_npipes; i++) {
+			pp = snap->ps_pipes[i];
+			nni_msgq_set_maxbytes(pp->sendq, pub->pipehwm);
+		}
+		nni_pipeset_rele(pub->pipes, snap);
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -241,6 +663,12 @@ nni_pub_sock_getopt(void *arg, int opt, void *buf, size_t *szp)
 	case NNG_OPT_RAW:
 		rv = nni_getopt_int(&pub->raw, buf, szp);
 		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_getopt_int(&pub->pipehwm, buf, szp);
+		break;
+	case NNG_OPT_FANOUT:
+		rv = nni_getopt_int(&pub->nfanout, buf, szp);
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
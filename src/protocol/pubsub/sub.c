@@ -26,9 +26,12 @@ struct nni_sub_topic {
 	void *		buf;
 };
 
-// An nni_rep_sock is our per-socket protocol private structure.
+// An nni_rep_sock is our per-socket protocol private structure.  The
+// topics have a lock of their own, so that receivers can filter
+// without holding the socket lock.
 struct nni_sub_sock {
 	nni_sock *	sock;
+	nni_mtx		mx;
 	nni_list	topics;
 	nni_msgq *	urq;
 	int		raw;
@@ -49,12 +52,17 @@ nni_sub_sock_init(void **subp, nni_sock *sock)
 	if ((sub = NNI_ALLOC_STRUCT(sub)) == NULL) {
 		return (NNG_ENOMEM);
 	}
+	if ((rv = nni_mtx_init(&sub->mx)) != 0) {
+		NNI_FREE_STRUCT(sub);
+		return (rv);
+	}
 	NNI_LIST_INIT(&sub->topics, nni_sub_topic, node);
 	sub->sock = sock;
 	sub->raw = 0;
 
 	sub->urq = nni_sock_recvq(sock);
 	nni_sock_senderr(sock, NNG_ENOTSUP);
+	nni_sock_filterlock(sock, 0);
 	*subp = sub;
 	return (0);
 }
@@ -71,6 +79,7 @@ nni_sub_sock_fini(void *arg)
 		nni_free(topic->buf, topic->len);
 		NNI_FREE_STRUCT(topic);
 	}
+	nni_mtx_fini(&sub->mx);
 	NNI_FREE_STRUCT(sub);
 }
 
@@ -220,10 +229,14 @@ nni_sub_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 		rv = nni_setopt_int(&sub->raw, buf, sz, 0, 1);
 		break;
 	case NNG_OPT_SUBSCRIBE:
+		nni_mtx_lock(&sub->mx);
 		rv = nni_sub_subscribe(sub, buf, sz);
+		nni_mtx_unlock(&sub->mx);
 		break;
 	case NNG_OPT_UNSUBSCRIBE:
+		nni_mtx_lock(&sub->mx);
 		rv = nni_sub_unsubscribe(sub, buf, sz);
+		nni_mtx_unlock(&sub->mx);
 		break;
 	default:
 		rv = NNG_ENOTSUP;
@@ -267,6 +280,7 @@ nni_sub_sock_rfilter(void *arg, nni_msg *msg)
 
 	match = 0;
 	// Check to see if the message matches one of our subscriptions.
+	nni_mtx_lock(&sub->mx);
 	NNI_LIST_FOREACH (&sub->topics, topic) {
 		if (len >= topic->len) {
 			int rv = memcmp(topic->buf, body, topic->len);
@@ -284,6 +298,7 @@ nni_sub_sock_rfilter(void *arg, nni_msg *msg)
 			break;
 		}
 	}
+	nni_mtx_unlock(&sub->mx);
 	if (!match) {
 		nni_msg_free(msg);
 		return (NULL);
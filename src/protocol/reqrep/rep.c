@@ -224,11 +224,6 @@ nni_rep_pipe_recv(void *arg)
 	NNI_PUT32(idbuf, id);
 
 	for (;;) {
-		size_t len;
-		uint8_t *body;
-		int hops;
-
-again:
 		rv = nni_pipe_recv(pipe, &msg);
 		if (rv != 0) {
 			break;
@@ -242,28 +237,9 @@ again:
 		}
 
 		// Move backtrace from body to header
-		hops = 0;
-		for (;;) {
-			int end = 0;
-			if (hops >= rep->ttl) {
-				nni_msg_free(msg);
-				goto again;
-			}
-			if (nni_msg_len(msg) < 4) {
-				nni_msg_free(msg);
-				goto again;
-			}
-			body = nni_msg_body(msg);
-			end = (body[0] & 0x80) ? 1 : 0;
-			rv = nni_msg_append_header(msg, body, 4);
-			if (rv != 0) {
-				nni_msg_free(msg);
-				goto again;
-			}
-			nni_msg_trim(msg, 4);
-			if (end) {
-				break;
-			}
+		if (nni_msg_backtrace(msg, rep->ttl) != 0) {
+			nni_msg_free(msg);
+			continue;
 		}
 
 		// Now send it up.
@@ -284,13 +260,23 @@ nni_rep_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 {
 	nni_rep_sock *rep = arg;
 	int rv;
+	int oldraw;
 
 	switch (opt) {
 	case NNG_OPT_MAXTTL:
 		rv = nni_setopt_int(&rep->ttl, buf, sz, 1, 255);
 		break;
 	case NNG_OPT_RAW:
+		oldraw = rep->raw;
 		rv = nni_setopt_int(&rep->raw, buf, sz, 0, 1);
+		if (oldraw != rep->raw) {
+			if (rep->raw) {
+				nni_sock_senderr(rep->sock, 0);
+			} else {
+				nni_sock_senderr(rep->sock, NNG_ESTATE);
+			}
+			nni_sock_filterskip(rep->sock, rep->raw);
+		}
 		break;
 	default:
 		rv = NNG_ENOTSUP;
@@ -234,6 +234,8 @@ nni_req_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 		break;
 	case NNG_OPT_RAW:
 		rv = nni_setopt_int(&req->raw, buf, sz, 0, 1);
+		// Raw mode filters pass messages through untouched.
+		nni_sock_filterskip(req->sock, req->raw);
 		break;
 	default:
 		rv = NNG_ENOTSUP;
@@ -286,7 +288,7 @@ nni_req_sock_resend(void *arg)
 			if (req->retrymsg == NULL) {
 				nni_msg_dup(&req->retrymsg, req->reqmsg);
 			}
-			req->resend = nni_clock() + req->retry;
+			req->resend = nni_clock_coarse() + req->retry;
 		}
 		nni_mtx_unlock(mx);
 	}
@@ -332,7 +334,7 @@ nni_req_sock_sfilter(void *arg, nni_msg *msg)
 	}
 
 	// Schedule the next retry
-	req->resend = nni_clock() + req->retry;
+	req->resend = nni_clock_coarse() + req->retry;
 	nni_cv_wake(&req->cv);
 
 	// Clear the error condition.
@@ -219,11 +219,6 @@ nni_resp_pipe_recv(void *arg)
 	NNI_PUT32(idbuf, id);
 
 	for (;;) {
-		size_t len;
-		uint8_t *body;
-		int hops;
-
-again:
 		rv = nni_pipe_recv(npipe, &msg);
 		if (rv != 0) {
 			break;
@@ -236,28 +231,9 @@ again:
 		}
 
 		// Move backtrace from body to header
-		hops = 0;
-		for (;;) {
-			int end = 0;
-			if (hops >= psock->ttl) {
-				nni_msg_free(msg);
-				goto again;
-			}
-			if (nni_msg_len(msg) < 4) {
-				nni_msg_free(msg);
-				goto again;
-			}
-			body = nni_msg_body(msg);
-			end = (body[0] & 0x80) ? 1 : 0;
-			rv = nni_msg_append_header(msg, body, 4);
-			if (rv != 0) {
-				nni_msg_free(msg);
-				goto again;
-			}
-			nni_msg_trim(msg, 4);
-			if (end) {
-				break;
-			}
+		if (nni_msg_backtrace(msg, psock->ttl) != 0) {
+			nni_msg_free(msg);
+			continue;
 		}
 
 		// Now send it up.
@@ -288,11 +264,12 @@ nni_resp_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 		oldraw = psock->raw;
 		rv = nni_setopt_int(&psock->raw, buf, sz, 0, 1);
 		if (oldraw != psock->raw) {
-			if (!psock->raw) {
+			if (psock->raw) {
 				nni_sock_senderr(psock->nsock, 0);
 			} else {
 				nni_sock_senderr(psock->nsock, NNG_ESTATE);
 			}
+			nni_sock_filterskip(psock->nsock, psock->raw);
 		}
 		break;
 	default:
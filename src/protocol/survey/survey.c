@@ -14,23 +14,50 @@
 
 // Surveyor protocol.  The SURVEYOR protocol is the "survey" side of the
 // survey pattern.  This is useful for building service discovery, voting, etc.
+//
+// Several surveys may be outstanding at once (up to NNG_OPT_MAXSURVEYS).
+// Each one is kept in a hash by its ID, and on a timer list sorted by
+// deadline, which the timeout worker sleeps on.  Responses to any live
+// survey are delivered, tagged with the survey ID (NNG_OPT_SURVEYID), so
+// that the caller can tell the result streams apart.  With the default
+// limit of one, starting a survey cancels the previous one.
 
 typedef struct nni_surv_pipe	nni_surv_pipe;
 typedef struct nni_surv_sock	nni_surv_sock;
+typedef struct nni_surv_survey	nni_surv_survey;
+
+// Upper bound on NNG_OPT_MAXSURVEYS.
+#define NNI_SURV_MAXSURVEYS	4096
+
+// An nni_surv_survey is an outstanding survey.
+struct nni_surv_survey {
+	uint32_t	id;
+	nni_time	expire;
+	nni_list_node	node;
+};
 
 // An nni_surv_sock is our per-socket protocol private structure.
 struct nni_surv_sock {
 	nni_sock *	nsock;
 	nni_cv		cv;
 	nni_duration	survtime;
-	nni_time	expire;
 	int		raw;
 	int		closing;
+	int		pipebuf;
+	int		pipehwm;
+	int		active;         // receiving is allowed
+	int		maxsurveys;
+	int		nsurveys;
 	uint32_t	nextid;         // next id
-	uint8_t		survid[4];      // outstanding request ID (big endian)
+	uint32_t	lastid;         // most recent survey ID
+	nni_idhash *	surveys;        // outstanding surveys, by ID
+	nni_list	timers;         // outstanding surveys, by deadline
 	nni_list	pipes;
 };
 
+// Default depth of each respondent's send queue.
+#define NNI_SURV_PIPEBUF	16
+
 // An nni_surv_pipe is our per-pipe protocol private structure.
 struct nni_surv_pipe {
 	nni_pipe *	npipe;
@@ -53,12 +80,25 @@ nni_surv_sock_init(void **sp, nni_sock *nsock)
 		NNI_FREE_STRUCT(psock);
 		return (rv);
 	}
+	if ((rv = nni_idhash_create(&psock->surveys)) != 0) {
+		nni_cv_fini(&psock->cv);
+		NNI_FREE_STRUCT(psock);
+		return (rv);
+	}
 	NNI_LIST_INIT(&psock->pipes, nni_surv_pipe, node);
+	NNI_LIST_INIT(&psock->timers, nni_surv_survey, node);
 	psock->nextid = nni_random();
 	psock->nsock = nsock;
 	psock->raw = 0;
+	psock->pipebuf = NNI_SURV_PIPEBUF;
+	psock->pipehwm = 0;
 	psock->survtime = NNI_SECOND * 60;
-	psock->expire = NNI_TIME_ZERO;
+	psock->maxsurveys = 1;
+	psock->nsurveys = 0;
+	psock->lastid = 0;
+
+	// Let the timeout worker set the initial (idle) error state.
+	psock->active = 1;
 
 	*sp = psock;
 	nni_sock_recverr(nsock, NNG_ESTATE);
@@ -77,30 +117,56 @@ nni_surv_sock_close(void *arg)
 }
 
 
+// nni_surv_cancel discards an outstanding survey; late responses to it
+// will be dropped.  Must be called with the socket lock held.
+static void
+nni_surv_cancel(nni_surv_sock *psock, nni_surv_survey *survey)
+{
+	nni_list_remove(&psock->timers, survey);
+	(void) nni_idhash_remove(psock->surveys, survey->id);
+	psock->nsurveys--;
+	NNI_FREE_STRUCT(survey);
+}
+
+
+static void
+nni_surv_cancel_all(nni_surv_sock *psock)
+{
+	nni_surv_survey *survey;
+
+	while ((survey = nni_list_first(&psock->timers)) != NULL) {
+		nni_surv_cancel(psock, survey);
+	}
+}
+
+
 static void
 nni_surv_sock_fini(void *arg)
 {
 	nni_surv_sock *psock = arg;
 
+	nni_surv_cancel_all(psock);
+	nni_idhash_destroy(psock->surveys);
 	nni_cv_fini(&psock->cv);
 	NNI_FREE_STRUCT(psock);
 }
 
 
 static int
-nni_surv_pipe_init(void **pp, nni_pipe *npipe, void *psock)
+nni_surv_pipe_init(void **pp, nni_pipe *npipe, void *arg)
 {
 	nni_surv_pipe *ppipe;
+	nni_surv_sock *psock = arg;
 	int rv;
 
 	if ((ppipe = NNI_ALLOC_STRUCT(ppipe)) == NULL) {
 		return (NNG_ENOMEM);
 	}
-	// This depth could be tunable.
-	if ((rv = nni_msgq_init(&ppipe->sendq, 16)) != 0) {
+	if ((rv = nni_msgq_init(&ppipe->sendq, psock->pipebuf)) != 0) {
 		NNI_FREE_STRUCT(ppipe);
 		return (rv);
 	}
+	nni_msgq_set_maxbytes(ppipe->sendq, psock->pipehwm);
 	ppipe->npipe = npipe;
 	ppipe->psock = psock;
 	ppipe->sigclose = 0;
@@ -114,6 +180,7 @@ nni_surv_pipe_fini(void *arg)
 {
 	nni_surv_pipe *sp = arg;
 
+	nni_msgq_fini(sp->sendq);
 	NNI_FREE_STRUCT(sp);
 }
 
@@ -212,6 +279,7 @@ static int
 nni_surv_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 {
 	nni_surv_sock *psock = arg;
+	nni_surv_pipe *pp;
 	int rv;
 	int oldraw;
 
@@ -228,11 +296,37 @@ nni_surv_sock_setopt(void *arg, int opt, const void *buf, size_t sz)
 			} else {
 				nni_sock_recverr(psock->nsock, NNG_ESTATE);
 			}
-			memset(psock->survid, 0, sizeof (psock->survid));
-			psock->expire = NNI_TIME_NEVER;
+			nni_sock_filterskip(psock->nsock, psock->raw);
+			nni_surv_cancel_all(psock);
+			psock->active = 0;
 			nni_cv_wake(&psock->cv);
 		}
 		break;
+	case NNG_OPT_MAXSURVEYS:
+		rv = nni_setopt_int(&psock->maxsurveys, buf, sz, 1,
+			NNI_SURV_MAXSURVEYS);
+		break;
+	case NNG_OPT_SNDBUF:
+		// This sizes the upper write queue and each pipe's queue.
+		// As with PUB, a zero depth is refused.
+		if ((rv = nni_setopt_buf_min(nni_sock_sendq(psock->nsock),
+		    buf, sz, 1)) != 0) {
+			break;
+		}
+		psock->pipebuf = nni_msgq_cap(nni_sock_sendq(psock->nsock));
+		NNI_LIST_FOREACH (&psock->pipes, pp) {
+			(void) nni_msgq_resize(pp->sendq, psock->pipebuf);
+		}
+		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_setopt_int(&psock->pipehwm, buf, sz, 0, 0x7fffffff);
+		if (rv != 0) {
+			break;
+		}
+		NNI_LIST_FOREACH (&psock->pipes, pp) {
+			nni_msgq_set_maxbytes(pp->sendq, psock->pipehwm);
+		}
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -253,6 +347,25 @@ nni_surv_sock_getopt(void *arg, int opt, void *buf, size_t *szp)
 	case NNG_OPT_RAW:
 		rv = nni_getopt_int(&psock->raw, buf, szp);
 		break;
+	case NNG_OPT_SNDHWM:
+		rv = nni_getopt_int(&psock->pipehwm, buf, szp);
+		break;
+	case NNG_OPT_MAXSURVEYS:
+		rv = nni_getopt_int(&psock->maxsurveys, buf, szp);
+		break;
+	case NNG_OPT_SURVEYID:
+		if (psock->lastid == 0) {
+			rv = NNG_ESTATE;
+			break;
+		}
+		if (*szp < sizeof (psock->lastid)) {
+			rv = NNG_EINVAL;
+			break;
+		}
+		memcpy(buf, &psock->lastid, sizeof (psock->lastid));
+		*szp = sizeof (psock->lastid);
+		rv = 0;
+		break;
 	default:
 		rv = NNG_ENOTSUP;
 	}
@@ -308,22 +421,28 @@ nni_surv_sock_timeout(void *arg)
 	nni_mtx *mx = nni_sock_mtx(psock->nsock);
 	nni_msgq *urq = nni_sock_recvq(psock->nsock);
 
+	nni_surv_survey *survey;
+	nni_time now;
+
 	nni_mtx_lock(mx);
 	for (;;) {
 		if (psock->closing) {
 			nni_mtx_unlock(mx);
 			return;
 		}
-		if (nni_clock() > psock->expire) {
-			// Set the expiration ~forever
-			psock->expire = NNI_TIME_NEVER;
-			// Survey IDs *always* have the high order bit set,
-			// so zeroing means that nothing can match.
-			memset(psock->survid, 0, sizeof (psock->survid));
+		now = nni_clock();
+		while (((survey = nni_list_first(&psock->timers)) != NULL) &&
+		    (now >= survey->expire)) {
+			nni_surv_cancel(psock, survey);
+		}
+		if ((survey == NULL) && psock->active && (!psock->raw)) {
+			// The last survey is over.
+			psock->active = 0;
 			nni_sock_recverr(psock->nsock, NNG_ESTATE);
 			nni_msgq_set_get_error(urq, NNG_ETIMEDOUT);
 		}
-		nni_cv_until(&psock->cv, psock->expire);
+		nni_cv_until(&psock->cv,
+		    survey != NULL ? survey->expire : NNI_TIME_NEVER);
 	}
 }
 
@@ -332,6 +451,9 @@ static nni_msg *
 nni_surv_sock_sfilter(void *arg, nni_msg *msg)
 {
 	nni_surv_sock *psock = arg;
+	nni_surv_survey *survey;
+	nni_surv_survey *prev;
+	uint8_t header[4];
 	uint32_t id;
 
 	if (psock->raw) {
@@ -340,24 +462,57 @@ nni_surv_sock_sfilter(void *arg, nni_msg *msg)
 		return (msg);
 	}
 
+	if ((survey = NNI_ALLOC_STRUCT(survey)) == NULL) {
+		nni_msg_free(msg);
+		return (NULL);
+	}
+
 	// Generate a new request ID.  We always set the high
 	// order bit so that the peer can locate the end of the
 	// backtrace.  (Pipe IDs have the high order bit clear.)
-	id = (psock->nextid++) | 0x80000000u;
+	// We skip any ID still in use by a (long) outstanding survey.
+	do {
+		id = (psock->nextid++) | 0x80000000u;
+	} while (nni_idhash_find(psock->surveys, id, (void **) &prev) == 0);
 
 	// Survey ID is in big endian format.
-	NNI_PUT32(psock->survid, id);
+	NNI_PUT32(header, id);
 
-	if (nni_msg_append_header(msg, psock->survid, 4) != 0) {
+	if ((nni_msg_append_header(msg, header, 4) != 0) ||
+	    (nni_idhash_insert(psock->surveys, id, survey) != 0)) {
 		// Should be ENOMEM.
+		NNI_FREE_STRUCT(survey);
 		nni_msg_free(msg);
 		return (NULL);
 	}
 
-	// If another message is there, this cancels it.  We move the
-	// survey expiration out.  The timeout thread will wake up in
-	// the wake below, and reschedule itself appropriately.
-	psock->expire = nni_clock() + psock->survtime;
+	// If we are at the limit, the survey nearest its deadline makes
+	// room for this one.  (With the default limit of one, a new
+	// survey simply replaces the old.)
+	if (psock->nsurveys >= psock->maxsurveys) {
+		nni_surv_cancel(psock, nni_list_first(&psock->timers));
+	}
+
+	// Insert on the timer list in deadline order.  Surveys usually
+	// share the same duration, so search from the tail.
+	survey->id = id;
+	survey->expire = nni_clock_coarse() + psock->survtime;
+	NNI_LIST_NODE_INIT(&survey->node);
+	prev = nni_list_last(&psock->timers);
+	while ((prev != NULL) && (prev->expire > survey->expire)) {
+		prev = nni_list_prev(&psock->timers, prev);
+	}
+	if (prev == NULL) {
+		nni_list_prepend(&psock->timers, survey);
+	} else {
+		nni_list_insert_after(&psock->timers, survey, prev);
+	}
+	psock->nsurveys++;
+	psock->lastid = id;
+	psock->active = 1;
+
+	// The timeout thread will wake up in the wake below, and
+	// reschedule itself appropriately.
 	nni_cv_wake(&psock->cv);
 
 	// Clear the error condition.
@@ -372,6 +527,8 @@ static nni_msg *
 nni_surv_sock_rfilter(void *arg, nni_msg *msg)
 {
 	nni_surv_sock *ssock = arg;
+	nni_surv_survey *survey;
+	uint32_t id;
 
 	if (ssock->raw) {
 		// Pass it unmolested
@@ -383,13 +540,15 @@ nni_surv_sock_rfilter(void *arg, nni_msg *msg)
 		return (NULL);
 	}
 
-	if (memcmp(nni_msg_header(msg), ssock->survid, 4) != 0) {
-		// Wrong request id
+	NNI_GET32((uint8_t *) nni_msg_header(msg), id);
+	if (nni_idhash_find(ssock->surveys, id, (void **) &survey) != 0) {
+		// Not an outstanding survey (perhaps expired).
 		nni_msg_free(msg);
 		return (NULL);
 	}
-	// Prune the survey ID.
+	// Prune the survey ID, and tag the message with it instead.
 	nni_msg_trim_header(msg, 4);
+	(void) nni_msg_setopt(msg, NNG_OPT_SURVEYID, &id, sizeof (id));
 
 	return (msg);
 }
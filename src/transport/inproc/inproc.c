@@ -54,6 +54,7 @@ struct nni_inproc_ep {
 	nni_cv		cv;
 	nni_list	clients;
 	void *		cpipe;  // connected pipe (DIAL only)
+	nni_duration	spin;   // busy-poll time for our receive queue
 };
 
 #define NNI_INPROC_EP_IDLE	0
@@ -148,6 +149,17 @@ nni_inproc_pipe_send(void *arg, nni_msg *msg)
 }
 
 
+static int
+nni_inproc_pipe_cansend(void *arg, nni_msg *msg)
+{
+	nni_inproc_pipe *pipe = arg;
+
+	NNI_ARG_UNUSED(msg);
+
+	return (nni_msgq_canput(pipe->wq));
+}
+
+
 static int
 nni_inproc_pipe_recv(void *arg, nni_msg **msgp)
 {
@@ -208,6 +220,7 @@ nni_inproc_ep_init(void **epp, const char *url, uint16_t proto)
 	ep->mode = NNI_INPROC_EP_IDLE;
 	ep->closed = 0;
 	ep->proto = proto;
+	ep->spin = 0;
 	NNI_LIST_NODE_INIT(&ep->node);
 	NNI_LIST_INIT(&ep->clients, nni_inproc_ep, node);
 
@@ -391,6 +404,8 @@ nni_inproc_ep_accept(void *arg, void **pipep)
 	pair->pipe[0].addr = pair->pipe[1].addr = pair->addr;
 	pair->pipe[1].peer = client->proto;
 	pair->pipe[0].peer = ep->proto;
+	nni_msgq_set_spin(pair->q[0], client->spin);
+	nni_msgq_set_spin(pair->q[1], ep->spin);
 	pair->refcnt = 2;
 	client->cpipe = &pair->pipe[0];
 	*pipep = &pair->pipe[1];
@@ -402,9 +417,36 @@ nni_inproc_ep_accept(void *arg, void **pipep)
 }
 
 
+static int
+nni_inproc_ep_setopt(void *arg, int opt, const void *v, size_t sz)
+{
+	nni_inproc_ep *ep = arg;
+
+	switch (opt) {
+	case NNG_OPT_BUSYPOLL:
+		return (nni_setopt_duration(&ep->spin, v, sz));
+	}
+	return (NNG_ENOTSUP);
+}
+
+
+static int
+nni_inproc_ep_getopt(void *arg, int opt, void *v, size_t *szp)
+{
+	nni_inproc_ep *ep = arg;
+
+	switch (opt) {
+	case NNG_OPT_BUSYPOLL:
+		return (nni_getopt_duration(&ep->spin, v, szp));
+	}
+	return (NNG_ENOTSUP);
+}
+
+
 static nni_tran_pipe nni_inproc_pipe_ops = {
 	.pipe_destroy	= nni_inproc_pipe_destroy,
 	.pipe_send	= nni_inproc_pipe_send,
+	.pipe_cansend	= nni_inproc_pipe_cansend,
 	.pipe_recv	= nni_inproc_pipe_recv,
 	.pipe_close	= nni_inproc_pipe_close,
 	.pipe_peer	= nni_inproc_pipe_peer,
@@ -418,8 +460,8 @@ static nni_tran_ep nni_inproc_ep_ops = {
 	.ep_bind	= nni_inproc_ep_bind,
 	.ep_accept	= nni_inproc_ep_accept,
 	.ep_close	= nni_inproc_ep_close,
-	.ep_setopt	= NULL,
-	.ep_getopt	= NULL,
+	.ep_setopt	= nni_inproc_ep_setopt,
+	.ep_getopt	= nni_inproc_ep_getopt,
 };
 
 // This is the inproc transport linkage, and should be the only global
@@ -100,6 +100,19 @@ nni_ipc_pipe_send(void *arg, nni_msg *msg)
 }
 
 
+static int
+nni_ipc_pipe_cansend(void *arg, nni_msg *msg)
+{
+	nni_ipc_pipe *pipe = arg;
+	size_t len;
+
+	// The message type and length prefix, then the header and body.
+	len = 1 + sizeof (uint64_t) + nni_msg_header_len(msg) +
+	    nni_msg_len(msg);
+	return (nni_plat_ipc_writable(&pipe->fd, len));
+}
+
+
 static int
 nni_ipc_pipe_recv(void *arg, nni_msg **msgp)
 {
@@ -347,6 +360,7 @@ nni_ipc_ep_accept(void *arg, void **pipep)
 static nni_tran_pipe nni_ipc_pipe_ops = {
 	.pipe_destroy	= nni_ipc_pipe_destroy,
 	.pipe_send	= nni_ipc_pipe_send,
+	.pipe_cansend	= nni_ipc_pipe_cansend,
 	.pipe_recv	= nni_ipc_pipe_recv,
 	.pipe_close	= nni_ipc_pipe_close,
 	.pipe_peer	= nni_ipc_pipe_peer,
@@ -26,17 +26,51 @@ struct nni_tcp_pipe {
 	uint16_t		peer;
 	uint16_t		proto;
 	uint32_t		rcvmax;
+	nni_list_node		node;   // ready list, for accepted pipes
 };
 
+// Listening endpoints run one or more accepter threads.  Each of these
+// accepts a connection and performs the SP handshake, then places the
+// finished pipe on the ready list, where nni_tcp_ep_accept collects it.
+// A slow or malicious peer therefore only occupies one accepter, and only
+// until the handshake timeout expires.  No more than the backlog of pipes
+// may be ready or in handshake at once; beyond that, the accepters wait
+// for the socket to collect some, and new connections queue in the
+// kernel instead.  With NNG_OPT_REUSEPORT, each
+// accepter has its own listening socket, and the kernel spreads inbound
+// connections across them instead of having the threads contend for one.
+typedef struct nni_tcp_accepter {
+	nni_tcp_ep *		ep;
+	nni_plat_tcpsock *	lfd;
+	nni_tcp_pipe *		hspipe;         // handshake in progress
+	nni_thr			thr;
+} nni_tcp_accepter;
+
 struct nni_tcp_ep {
 	char			addr[NNG_MAXADDRLEN+1];
-	nni_plat_tcpsock	fd;
 	int			closed;
 	uint16_t		proto;
 	uint32_t		rcvmax;
 	int			ipv4only;
+	int			backlog;
+	int			naccepters;
+	int			reuseport;
+	nni_duration		hstimeo;
+	nni_duration		busypoll;
+	nni_mtx			mx;
+	nni_cv			cv;
+	nni_list		ready;
+	int			npending;       // ready or in handshake
+	int			nfds;
+	nni_plat_tcpsock *	fds;
+	nni_tcp_accepter *	accepters;
 };
 
+#define NNI_TCP_BACKLOG		128
+#define NNI_TCP_ACCEPTERS	4
+#define NNI_TCP_MAXACCEPTERS	256
+#define NNI_TCP_HSTIMEO		(10 * NNI_SECOND)
+
 static int
 nni_tcp_tran_init(void)
 {
@@ -95,6 +129,18 @@ nni_tcp_pipe_send(void *arg, nni_msg *msg)
 }
 
 
+static int
+nni_tcp_pipe_cansend(void *arg, nni_msg *msg)
+{
+	nni_tcp_pipe *pipe = arg;
+	size_t len;
+
+	// The length prefix, then the header and body.
+	len = sizeof (uint64_t) + nni_msg_header_len(msg) + nni_msg_len(msg);
+	return (nni_plat_tcp_writable(&pipe->fd, len));
+}
+
+
 static int
 nni_tcp_pipe_recv(void *arg, nni_msg **msgp)
 {
@@ -176,11 +222,29 @@ nni_tcp_ep_init(void **epp, const char *url, uint16_t proto)
 	if ((ep = NNI_ALLOC_STRUCT(ep)) == NULL) {
 		return (NNG_ENOMEM);
 	}
+	if ((rv = nni_mtx_init(&ep->mx)) != 0) {
+		NNI_FREE_STRUCT(ep);
+		return (rv);
+	}
+	if ((rv = nni_cv_init(&ep->cv, &ep->mx)) != 0) {
+		nni_mtx_fini(&ep->mx);
+		NNI_FREE_STRUCT(ep);
+		return (rv);
+	}
+	NNI_LIST_INIT(&ep->ready, nni_tcp_pipe, node);
 	ep->closed = 0;
 	ep->proto = proto;
 	ep->ipv4only = 0;
 	ep->rcvmax = 1024 * 1024;       // XXX: fix this
-	nni_plat_tcp_init(&ep->fd);
+	ep->backlog = NNI_TCP_BACKLOG;
+	ep->npending = 0;
+	ep->naccepters = NNI_TCP_ACCEPTERS;
+	ep->reuseport = 0;
+	ep->hstimeo = NNI_TCP_HSTIMEO;
+	ep->busypoll = 0;
+	ep->nfds = 0;
+	ep->fds = NULL;
+	ep->accepters = NULL;
 
 	(void) snprintf(ep->addr, sizeof (ep->addr), "%s", url);
 
@@ -189,12 +253,41 @@ nni_tcp_ep_init(void **epp, const char *url, uint16_t proto)
 }
 
 
+static void
+nni_tcp_pipe_discard(nni_tcp_pipe *pipe)
+{
+	nni_plat_tcp_shutdown(&pipe->fd);
+	nni_plat_tcp_fini(&pipe->fd);
+	NNI_FREE_STRUCT(pipe);
+}
+
+
 static void
 nni_tcp_ep_fini(void *arg)
 {
 	nni_tcp_ep *ep = arg;
+	nni_tcp_pipe *pipe;
+	int i;
 
-	nni_plat_tcp_fini(&ep->fd);
+	if (ep->accepters != NULL) {
+		for (i = 0; i < ep->naccepters; i++) {
+			nni_thr_fini(&ep->accepters[i].thr);
+		}
+		nni_free(ep->accepters,
+		    ep->naccepters * sizeof (nni_tcp_accepter));
+	}
+	while ((pipe = nni_list_first(&ep->ready)) != NULL) {
+		nni_list_remove(&ep->ready, pipe);
+		nni_tcp_pipe_discard(pipe);
+	}
+	if (ep->fds != NULL) {
+		for (i = 0; i < ep->nfds; i++) {
+			nni_plat_tcp_fini(&ep->fds[i]);
+		}
+		nni_free(ep->fds, ep->nfds * sizeof (nni_plat_tcpsock));
+	}
+	nni_cv_fini(&ep->cv);
+	nni_mtx_fini(&ep->mx);
 	NNI_FREE_STRUCT(ep);
 }
 
@@ -203,8 +296,67 @@ static void
 nni_tcp_ep_close(void *arg)
 {
 	nni_tcp_ep *ep = arg;
+	int i;
+
+	nni_mtx_lock(&ep->mx);
+	ep->closed = 1;
+	for (i = 0; i < ep->nfds; i++) {
+		nni_plat_tcp_shutdown(&ep->fds[i]);
+	}
+	if (ep->accepters != NULL) {
+		for (i = 0; i < ep->naccepters; i++) {
+			nni_tcp_pipe *pipe = ep->accepters[i].hspipe;
 
-	nni_plat_tcp_shutdown(&ep->fd);
+			if (pipe != NULL) {
+				nni_plat_tcp_shutdown(&pipe->fd);
+			}
+		}
+	}
+	nni_cv_wake(&ep->cv);
+	nni_mtx_unlock(&ep->mx);
+}
+
+
+static int
+nni_tcp_ep_setopt(void *arg, int opt, const void *v, size_t sz)
+{
+	nni_tcp_ep *ep = arg;
+
+	switch (opt) {
+	case NNG_OPT_ACCEPTERS:
+		return (nni_setopt_int(&ep->naccepters, v, sz, 1,
+		       NNI_TCP_MAXACCEPTERS));
+	case NNG_OPT_BACKLOG:
+		return (nni_setopt_int(&ep->backlog, v, sz, 1, 0x7fffffff));
+	case NNG_OPT_REUSEPORT:
+		return (nni_setopt_int(&ep->reuseport, v, sz, 0, 1));
+	case NNG_OPT_HANDSHAKETIME:
+		return (nni_setopt_duration(&ep->hstimeo, v, sz));
+	case NNG_OPT_BUSYPOLL:
+		return (nni_setopt_duration(&ep->busypoll, v, sz));
+	}
+	return (NNG_ENOTSUP);
+}
+
+
+static int
+nni_tcp_ep_getopt(void *arg, int opt, void *v, size_t *szp)
+{
+	nni_tcp_ep *ep = arg;
+
+	switch (opt) {
+	case NNG_OPT_ACCEPTERS:
+		return (nni_getopt_int(&ep->naccepters, v, szp));
+	case NNG_OPT_BACKLOG:
+		return (nni_getopt_int(&ep->backlog, v, szp));
+	case NNG_OPT_REUSEPORT:
+		return (nni_getopt_int(&ep->reuseport, v, szp));
+	case NNG_OPT_HANDSHAKETIME:
+		return (nni_getopt_duration(&ep->hstimeo, v, szp));
+	case NNG_OPT_BUSYPOLL:
+		return (nni_getopt_duration(&ep->busypoll, v, szp));
+	}
+	return (NNG_ENOTSUP);
 }
 
 
@@ -261,13 +413,19 @@ nni_parseaddr(char *pair, char **hostp, uint16_t *portp)
 
 
 static int
-nni_tcp_negotiate(nni_tcp_pipe *pipe)
+nni_tcp_negotiate(nni_tcp_pipe *pipe, nni_duration tmo)
 {
 	int rv;
 	nni_iov iov;
 	uint8_t buf[8];
 	uint16_t peer;
 
+	// The handshake is bounded so that a peer that never sends its
+	// header cannot hold our thread indefinitely.
+	if ((tmo > 0) && ((rv = nni_plat_tcp_timeout(&pipe->fd, tmo)) != 0)) {
+		return (rv);
+	}
+
 	// First send our header..
 	buf[0] = 0;
 	buf[1] = 'S';
@@ -295,6 +453,9 @@ nni_tcp_negotiate(nni_tcp_pipe *pipe)
 	}
 
 	NNI_GET16(&buf[4], pipe->peer);
+	if (tmo > 0) {
+		return (nni_plat_tcp_timeout(&pipe->fd, 0));
+	}
 	return (0);
 }
 
@@ -327,7 +488,7 @@ nni_tcp_ep_connect(void *arg, void **pipep)
 		if ((rv = nni_parseaddr(lclpart, &host, &port)) != 0) {
 			return (rv);
 		}
-		if ((rv = nni_plat_lookup_host(host, &lcladdr, flag)) != 0) {
+		if ((rv = nni_resolv_lookup(host, &lcladdr, flag)) != 0) {
 			return (rv);
 		}
 		// The port is in the same offset for both v4 and v6.
@@ -340,7 +501,7 @@ nni_tcp_ep_connect(void *arg, void **pipep)
 	if ((rv = nni_parseaddr(rempart, &host, &port)) != 0) {
 		return (rv);
 	}
-	if ((rv = nni_plat_lookup_host(host, &remaddr, flag)) != 0) {
+	if ((rv = nni_resolv_lookup(host, &remaddr, flag)) != 0) {
 		return (rv);
 	}
 
@@ -360,11 +521,13 @@ nni_tcp_ep_connect(void *arg, void **pipep)
 		NNI_FREE_STRUCT(pipe);
 		return (rv);
 	}
+	if (ep->busypoll > 0) {
+		// Best effort; raising it may need privilege.
+		(void) nni_plat_tcp_busypoll(&pipe->fd, ep->busypoll);
+	}
 
-	if ((rv = nni_tcp_negotiate(pipe)) != 0) {
-		nni_plat_tcp_shutdown(&pipe->fd);
-		nni_plat_tcp_fini(&pipe->fd);
-		NNI_FREE_STRUCT(pipe);
+	if ((rv = nni_tcp_negotiate(pipe, ep->hstimeo)) != 0) {
+		nni_tcp_pipe_discard(pipe);
 		return (rv);
 	}
 	*pipep = pipe;
@@ -372,6 +535,96 @@ nni_tcp_ep_connect(void *arg, void **pipep)
 }
 
 
+static void
+nni_tcp_ep_accepter(void *arg)
+{
+	nni_tcp_accepter *acc = arg;
+	nni_tcp_ep *ep = acc->ep;
+	nni_tcp_pipe *pipe;
+	nni_time cooldown;
+	int rv;
+
+	for (;;) {
+		nni_mtx_lock(&ep->mx);
+		while ((!ep->closed) && (ep->npending >= ep->backlog)) {
+			nni_cv_wait(&ep->cv);
+		}
+		if (ep->closed) {
+			nni_mtx_unlock(&ep->mx);
+			return;
+		}
+		ep->npending++;
+		nni_mtx_unlock(&ep->mx);
+
+		if ((pipe = NNI_ALLOC_STRUCT(pipe)) == NULL) {
+			rv = NNG_ENOMEM;
+			goto fail;
+		}
+		pipe->proto = ep->proto;
+		pipe->rcvmax = ep->rcvmax;
+		NNI_LIST_NODE_INIT(&pipe->node);
+		nni_plat_tcp_init(&pipe->fd);
+
+		if ((rv = nni_plat_tcp_accept(&pipe->fd, acc->lfd)) != 0) {
+			NNI_FREE_STRUCT(pipe);
+			goto fail;
+		}
+		if (ep->busypoll > 0) {
+			(void) nni_plat_tcp_busypoll(&pipe->fd, ep->busypoll);
+		}
+
+		// Publish the pipe so that closing the endpoint can abort
+		// the handshake rather than waiting for it to time out.
+		nni_mtx_lock(&ep->mx);
+		if (ep->closed) {
+			nni_mtx_unlock(&ep->mx);
+			nni_tcp_pipe_discard(pipe);
+			return;
+		}
+		acc->hspipe = pipe;
+		nni_mtx_unlock(&ep->mx);
+
+		rv = nni_tcp_negotiate(pipe, ep->hstimeo);
+
+		nni_mtx_lock(&ep->mx);
+		acc->hspipe = NULL;
+		if (ep->closed) {
+			nni_mtx_unlock(&ep->mx);
+			nni_tcp_pipe_discard(pipe);
+			return;
+		}
+		if (rv != 0) {
+			// Just this peer's problem; keep accepting.
+			ep->npending--;
+			nni_mtx_unlock(&ep->mx);
+			nni_tcp_pipe_discard(pipe);
+			continue;
+		}
+		nni_list_append(&ep->ready, pipe);
+		nni_cv_wake(&ep->cv);
+		nni_mtx_unlock(&ep->mx);
+		continue;
+
+fail:
+		// Back off briefly, longer for memory exhaustion, to let
+		// the system recover.  Closing the endpoint also lands here.
+		cooldown = nni_clock() + (rv == NNG_ENOMEM ? 100000 : 1000);
+		nni_mtx_lock(&ep->mx);
+		ep->npending--;
+		while (!ep->closed) {
+			if (nni_cv_until(&ep->cv, cooldown) == NNG_ETIMEDOUT) {
+				break;
+			}
+		}
+		if (ep->closed) {
+			nni_mtx_unlock(&ep->mx);
+			return;
+		}
+		nni_mtx_unlock(&ep->mx);
+	}
+}
+
+
 static int
 nni_tcp_ep_bind(void *arg)
 {
@@ -380,6 +633,8 @@ nni_tcp_ep_bind(void *arg)
 	char *host;
 	uint16_t port;
 	int flag;
+	int nfds;
+	int i;
 	int rv;
 	nni_sockaddr baddr;
 
@@ -391,15 +646,72 @@ nni_tcp_ep_bind(void *arg)
 	if ((rv = nni_parseaddr(addr, &host, &port)) != 0) {
 		return (rv);
 	}
-	if ((rv = nni_plat_lookup_host(host, &baddr, flag)) != 0) {
+	if ((rv = nni_resolv_lookup(host, &baddr, flag)) != 0) {
 		return (rv);
 	}
 	baddr.s_un.s_in.sa_port = port;
 
-	if ((rv = nni_plat_tcp_listen(&ep->fd, &baddr)) != 0) {
-		return (rv);
+	// Sharding an ephemeral port is meaningless, as each socket would
+	// get a different port; just use the one socket then.
+	nfds = 1;
+	flag = 0;
+	if (ep->reuseport && (port != 0)) {
+		nfds = ep->naccepters;
+		flag = NNI_FLAG_REUSEPORT;
+	}
+
+	ep->fds = nni_alloc(nfds * sizeof (nni_plat_tcpsock));
+	ep->accepters = nni_alloc(ep->naccepters * sizeof (nni_tcp_accepter));
+	if ((ep->fds == NULL) || (ep->accepters == NULL)) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	for (i = 0; i < nfds; i++) {
+		nni_plat_tcp_init(&ep->fds[i]);
+	}
+	ep->nfds = nfds;
+	for (i = 0; i < nfds; i++) {
+		rv = nni_plat_tcp_listen(&ep->fds[i], &baddr, ep->backlog,
+		    flag);
+		if (rv != 0) {
+			goto fail;
+		}
+	}
+	for (i = 0; i < ep->naccepters; i++) {
+		nni_tcp_accepter *acc = &ep->accepters[i];
+
+		acc->ep = ep;
+		acc->lfd = &ep->fds[i % nfds];
+		acc->hspipe = NULL;
+		if ((rv = nni_thr_init(&acc->thr, nni_tcp_ep_accepter, acc)) !=
+		    0) {
+			while (i > 0) {
+				i--;
+				nni_thr_fini(&ep->accepters[i].thr);
+			}
+			goto fail;
+		}
+	}
+	for (i = 0; i < ep->naccepters; i++) {
+		nni_thr_run(&ep->accepters[i].thr);
 	}
 	return (0);
+
+fail:
+	if (ep->accepters != NULL) {
+		nni_free(ep->accepters,
+		    ep->naccepters * sizeof (nni_tcp_accepter));
+		ep->accepters = NULL;
+	}
+	if (ep->fds != NULL) {
+		for (i = 0; i < ep->nfds; i++) {
+			nni_plat_tcp_fini(&ep->fds[i]);
+		}
+		nni_free(ep->fds, nfds * sizeof (nni_plat_tcpsock));
+		ep->fds = NULL;
+	}
+	ep->nfds = 0;
+	return (rv);
 }
 
 
@@ -408,26 +720,20 @@ nni_tcp_ep_accept(void *arg, void **pipep)
 {
 	nni_tcp_ep *ep = arg;
 	nni_tcp_pipe *pipe;
-	int rv;
 
-
-	if ((pipe = NNI_ALLOC_STRUCT(pipe)) == NULL) {
-		return (NNG_ENOMEM);
+	nni_mtx_lock(&ep->mx);
+	while ((!ep->closed) && ((pipe = nni_list_first(&ep->ready)) == NULL)) {
+		nni_cv_wait(&ep->cv);
 	}
-	pipe->proto = ep->proto;
-	pipe->rcvmax = ep->rcvmax;
-	nni_plat_tcp_init(&pipe->fd);
-
-	if ((rv = nni_plat_tcp_accept(&pipe->fd, &ep->fd)) != 0) {
-		NNI_FREE_STRUCT(pipe);
-		return (rv);
-	}
-	if ((rv = nni_tcp_negotiate(pipe)) != 0) {
-		nni_plat_tcp_shutdown(&pipe->fd);
-		nni_plat_tcp_fini(&pipe->fd);
-		NNI_FREE_STRUCT(pipe);
-		return (rv);
+	if (ep->closed) {
+		nni_mtx_unlock(&ep->mx);
+		return (NNG_ECLOSED);
 	}
+	nni_list_remove(&ep->ready, pipe);
+	ep->npending--;
+	nni_cv_wake(&ep->cv);
+	nni_mtx_unlock(&ep->mx);
+
 	*pipep = pipe;
 	return (0);
 }
@@ -436,6 +742,7 @@ nni_tcp_ep_accept(void *arg, void **pipep)
 static nni_tran_pipe nni_tcp_pipe_ops = {
 	.pipe_destroy	= nni_tcp_pipe_destroy,
 	.pipe_send	= nni_tcp_pipe_send,
+	.pipe_cansend	= nni_tcp_pipe_cansend,
 	.pipe_recv	= nni_tcp_pipe_recv,
 	.pipe_close	= nni_tcp_pipe_close,
 	.pipe_peer	= nni_tcp_pipe_peer,
@@ -449,8 +756,8 @@ static nni_tran_ep nni_tcp_ep_ops = {
 	.ep_bind	= nni_tcp_ep_bind,
 	.ep_accept	= nni_tcp_ep_accept,
 	.ep_close	= nni_tcp_ep_close,
-	.ep_setopt	= NULL,
-	.ep_getopt	= NULL,
+	.ep_setopt	= nni_tcp_ep_setopt,
+	.ep_getopt	= nni_tcp_ep_getopt,
 };
 
 // This is the TCP transport linkage, and should be the only global
@@ -10,6 +10,55 @@
 #include "core/idhash.c"
 #include "convey.h"
 
+// idhash_probes reports the mean and longest distance of the entries from
+// their home slots.
+static void
+idhash_probes(nni_idhash *h, double *meanp, uint32_t *maxp)
+{
+	uint64_t total = 0;
+	uint32_t max = 0;
+	uint32_t i;
+
+	for (i = 0; i < h->ih_cap; i++) {
+		if (h->ih_entries[i].ihe_val == NULL) {
+			continue;
+		}
+		total += h->ih_entries[i].ihe_dist;
+		if (h->ih_entries[i].ihe_dist > max) {
+			max = h->ih_entries[i].ihe_dist;
+		}
+	}
+	*meanp = h->ih_count ? (double) total / h->ih_count : 0.0;
+	*maxp = max;
+}
+
+
+typedef struct {
+	nni_idhash *	h;
+	volatile int	stop;
+	int		lookups;
+	int		misses;
+} idhash_reader;
+
+static void
+idhash_reader_main(void *arg)
+{
+	idhash_reader *r = arg;
+	void *val;
+	uint32_t id;
+
+	while (!r->stop) {
+		for (id = 1; id <= 64; id++) {
+			r->lookups++;
+			if ((nni_idhash_find(r->h, id, &val) != 0) ||
+			    (val != r)) {
+				r->misses++;
+			}
+		}
+	}
+}
+
+
 Main({
 	Test("General ID Hash", {
 		int rv;
@@ -32,8 +81,8 @@ Main({
 				char *four = "four";
 				rv = nni_idhash_insert(h, 5, five);
 				So(rv == 0);
-				So(h->ih_load == 1);
 				So(h->ih_count == 1);
+				So(h->ih_entries[5].ihe_dist == 0);
 
 				Convey("And we can find it", {
 					void *ptr;
@@ -61,7 +110,6 @@ Main({
 					void *ptr;
 					rv = nni_idhash_insert(h, 13, four);
 					So(rv == 0);
-					So(h->ih_load == 2);
 					So(h->ih_count == 2);
 					rv = nni_idhash_find(h, 5, &ptr);
 					So(rv == 0);
@@ -69,7 +117,8 @@ Main({
 					rv = nni_idhash_find(h, 13, &ptr);
 					So(rv == 0);
 					So(ptr == four);
-					So(h->ih_entries[5].ihe_skips == 1);
+					So(h->ih_entries[6].ihe_key == 13);
+					So(h->ih_entries[6].ihe_dist == 1);
 					Convey("And delete the intermediate", {
 						rv = nni_idhash_remove(h, 5);
 						So(rv == 0);
@@ -77,7 +126,10 @@ Main({
 						rv = nni_idhash_find(h, 13, &ptr);
 						So(rv == 0);
 						So(ptr == four);
-						So(h->ih_load == 2);
+						// 13 moved back home.
+						So(h->ih_entries[5].ihe_key == 13);
+						So(h->ih_entries[5].ihe_dist == 0);
+						So(h->ih_entries[6].ihe_val == NULL);
 					})
 				})
 
@@ -120,7 +172,7 @@ Main({
 				}
 				So(nni_idhash_count(h, &count) == 0);
 				So(count == 1024);
-				So(h->ih_cap = 2048);
+				So(h->ih_cap == 2048);
 				So(h->ih_count == 1024);
 
 				Convey("We can remove them", {
@@ -133,4 +185,95 @@ Main({
 			})
 		})
 	})
+
+	Test("Churn ID Hash", {
+		int rv;
+
+		Convey("Given an id hash", {
+			nni_idhash *h;
+
+			So(nni_init() == 0);
+			rv = nni_idhash_create(&h);
+			So(rv == 0);
+
+			Reset({
+				nni_idhash_destroy(h);
+			})
+
+			Convey("Churn does not lengthen probes", {
+				static uint32_t ids[1000];
+				uint32_t seed = 1;
+				uint32_t max;
+				uint32_t count;
+				double mean;
+				int nops = 1000000;
+				int i;
+
+				// A window of 1000 scattered ids, like pipes
+				// coming and going; the oldest is removed and a
+				// new one added, over and over.
+				rv = 0;
+				for (i = 0; i < 1000; i++) {
+					seed = seed * 1103515245 + 12345;
+					ids[i] = (seed ^ (seed >> 16)) | 1;
+					rv |= nni_idhash_insert(h, ids[i], ids);
+				}
+				So(rv == 0);
+				for (i = 0; i < nops; i++) {
+					void *val;
+
+					rv = nni_idhash_remove(h, ids[i % 1000]);
+					seed = seed * 1103515245 + 12345;
+					ids[i % 1000] = (seed ^ (seed >> 16)) | 1;
+					rv |= nni_idhash_insert(h, ids[i % 1000], ids);
+					rv |= nni_idhash_find(h,
+					    ids[(i + 500) % 1000], &val);
+					if (rv != 0) {
+						break;
+					}
+				}
+				So(rv == 0);
+				So(nni_idhash_count(h, &count) == 0);
+				So(count == 1000);
+
+				idhash_probes(h, &mean, &max);
+				So(mean < 2.0);
+				So(max < 32);
+			})
+
+			Convey("Lookups need no lock while it changes", {
+				idhash_reader r;
+				nni_thr thr;
+				uint32_t id;
+				int i;
+
+				r.h = h;
+				r.stop = 0;
+				r.lookups = 0;
+				r.misses = 0;
+				rv = 0;
+				for (id = 1; id <= 64; id++) {
+					So(nni_idhash_insert(h, id, &r) == 0);
+				}
+				So(nni_thr_init(&thr, idhash_reader_main, &r) == 0);
+				nni_thr_run(&thr);
+
+				// Grow and shrink the table repeatedly under the
+				// reader, which must always find its ids.
+				for (i = 0; i < 200; i++) {
+					for (id = 1000; id < 1500; id++) {
+						rv |= nni_idhash_insert(h, id, h);
+					}
+					for (id = 1000; id < 1500; id++) {
+						rv |= nni_idhash_remove(h, id);
+					}
+				}
+				r.stop = 1;
+				nni_thr_fini(&thr);
+				So(rv == 0);
+				So(r.lookups > 0);
+				So(r.misses == 0);
+			})
+		})
+	})
 })
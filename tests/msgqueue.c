@@ -0,0 +1,459 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "core/msgqueue.c"
+#include "convey.h"
+
+#include <string.h>
+
+static nni_msg *
+mkmsg(int val)
+{
+	nni_msg *msg;
+
+	if (nni_msg_alloc(&msg, sizeof (val)) != 0) {
+		return (NULL);
+	}
+	memcpy(nni_msg_body(msg), &val, sizeof (val));
+	return (msg);
+}
+
+
+static int
+msgval(nni_msg *msg)
+{
+	int val;
+
+	memcpy(&val, nni_msg_body(msg), sizeof (val));
+	nni_msg_free(msg);
+	return (val);
+}
+
+
+typedef struct {
+	nni_msgq *	mq;
+	int		val;
+	int		rv;
+} writer;
+
+static void
+putter(void *arg)
+{
+	writer *w = arg;
+	nni_msg *msg;
+
+	msg = mkmsg(w->val);
+	if ((w->rv = nni_msgq_put(w->mq, msg)) != 0) {
+		nni_msg_free(msg);
+	}
+}
+
+
+typedef struct {
+	nni_msgq *	mq;
+	int		count;  // messages to move
+	int		val;    // first value to put, or sum of values got
+	int		done;   // messages moved
+	int		rv;
+} mover;
+
+static void
+mput(void *arg)
+{
+	mover *m = arg;
+	nni_msg *msg;
+
+	for (m->done = 0; m->done < m->count; m->done++) {
+		msg = mkmsg(m->val + m->done);
+		m->rv = nni_msgq_put_until(m->mq, msg, nni_clock() + 1000000);
+		if (m->rv != 0) {
+			nni_msg_free(msg);
+			break;
+		}
+	}
+}
+
+
+static void
+mget(void *arg)
+{
+	mover *m = arg;
+	nni_msg *msg;
+
+	m->val = 0;
+	for (m->done = 0; m->done < m->count; m->done++) {
+		m->rv = nni_msgq_get_until(m->mq, &msg, nni_clock() + 1000000);
+		if (m->rv != 0) {
+			break;
+		}
+		m->val += msgval(msg);
+	}
+}
+
+
+// A reader for the handoff tests, with its own deadline and signal.
+typedef struct {
+	nni_msgq *	mq;
+	nni_time	expire;
+	nni_signal	sig;
+	int		val;
+	int		rv;
+} taker;
+
+static void
+take(void *arg)
+{
+	taker *t = arg;
+	nni_msg *msg;
+
+	t->val = 0;
+	if ((t->rv = nni_msgq_get_(t->mq, &msg, t->expire, &t->sig)) == 0) {
+		t->val = msgval(msg);
+	}
+}
+
+
+static void
+takesig(void *arg)
+{
+	taker *t = arg;
+
+	nni_msgq_signal(t->mq, &t->sig);
+}
+
+
+static void
+takeclose(void *arg)
+{
+	taker *t = arg;
+
+	nni_msgq_close(t->mq);
+}
+
+
+// waitreaders waits until n readers are asleep on the queue.
+static void
+waitreaders(nni_msgq *mq, int n)
+{
+	int rwait;
+
+	for (;;) {
+		nni_mtx_lock(&mq->mq_lock);
+		rwait = mq->mq_rwait;
+		nni_mtx_unlock(&mq->mq_lock);
+		if (rwait >= n) {
+			return;
+		}
+		nni_usleep(1000);
+	}
+}
+
+
+// leftover returns the value of a message left on the queue, or zero.
+static int
+leftover(nni_msgq *mq)
+{
+	nni_msg *msg;
+
+	if (nni_msgq_get_until(mq, &msg, NNI_TIME_ZERO) != 0) {
+		return (0);
+	}
+	return (msgval(msg));
+}
+
+
+TestMain("Message queues", {
+	int rv = nni_init();
+
+	Convey("Platform init worked", {
+		So(rv == 0);
+	})
+
+	Convey("An unbuffered queue serves several parked writers", {
+		static nni_thr thr[2];
+		static writer w[2];
+		nni_msgq *mq;
+		nni_msg *msg;
+		int sum = 0;
+		int i;
+
+		So(nni_msgq_init(&mq, 0) == 0);
+
+		// Both writers park before the reader comes along.  Each
+		// get must let the next writer through.
+		for (i = 0; i < 2; i++) {
+			w[i].mq = mq;
+			w[i].val = i + 1;
+			w[i].rv = -1;
+			So(nni_thr_init(&thr[i], putter, &w[i]) == 0);
+			nni_thr_run(&thr[i]);
+		}
+		nni_usleep(20000);
+
+		for (i = 0; i < 2; i++) {
+			So(nni_msgq_get_until(mq, &msg,
+			    nni_clock() + 1000000) == 0);
+			sum += msgval(msg);
+		}
+		So(sum == 3);
+
+		for (i = 0; i < 2; i++) {
+			nni_thr_fini(&thr[i]);
+			So(w[i].rv == 0);
+		}
+		nni_msgq_fini(mq);
+	})
+
+	Convey("Parked writers serve readers that arrive together", {
+		static nni_thr thr[4];
+		static mover m[4];
+		nni_msgq *mq;
+		int i;
+
+		// Both writers are asleep before either reader comes.  Each
+		// reader must get a writer of its own, even though the first
+		// writer woken has not yet run when the second reader looks.
+		So(nni_msgq_init(&mq, 0) == 0);
+		for (i = 0; i < 4; i++) {
+			m[i].mq = mq;
+			m[i].count = 1;
+			m[i].val = i + 1;
+			So(nni_thr_init(&thr[i], i < 2 ? mput : mget,
+			    &m[i]) == 0);
+		}
+		nni_thr_run(&thr[0]);
+		nni_thr_run(&thr[1]);
+		nni_usleep(20000);
+
+		// Hold the lock so that both readers are lined up for it by
+		// the time the first one lets go, ahead of the writer it
+		// wakes.
+		nni_mtx_lock(&mq->mq_lock);
+		nni_thr_run(&thr[2]);
+		nni_thr_run(&thr[3]);
+		nni_usleep(20000);
+		nni_mtx_unlock(&mq->mq_lock);
+		for (i = 0; i < 4; i++) {
+			nni_thr_fini(&thr[i]);
+			So(m[i].rv == 0);
+			So(m[i].done == 1);
+		}
+		So(m[2].val + m[3].val == 3);
+		nni_msgq_fini(mq);
+	})
+
+	Convey("Many readers and writers move every message", {
+		static nni_thr thr[8];
+		static mover m[8];
+		nni_msgq *mq;
+		int sum = 0;
+		int cap;
+		int i;
+
+		for (cap = 0; cap <= 2; cap += 2) {
+			So(nni_msgq_init(&mq, cap) == 0);
+			for (i = 0; i < 8; i++) {
+				m[i].mq = mq;
+				m[i].count = 500;
+				m[i].val = (i % 4) * 500;
+				So(nni_thr_init(&thr[i], i < 4 ? mput : mget,
+				    &m[i]) == 0);
+			}
+			for (i = 0; i < 8; i++) {
+				nni_thr_run(&thr[i]);
+			}
+			sum = 0;
+			for (i = 0; i < 8; i++) {
+				nni_thr_fini(&thr[i]);
+				So(m[i].rv == 0);
+				So(m[i].done == 500);
+			}
+			for (i = 4; i < 8; i++) {
+				sum += m[i].val;
+			}
+			// 0 + 1 + ... + 1999
+			So(sum == 1999 * 2000 / 2);
+			nni_msgq_fini(mq);
+		}
+	})
+
+	Convey("Handed off messages reach exactly one reader each", {
+		static nni_thr thr[4];
+		static taker t[4];
+		nni_msgq *mq;
+		int sum = 0;
+		int i;
+
+		So(nni_msgq_init(&mq, 0) == 0);
+		for (i = 0; i < 4; i++) {
+			t[i].mq = mq;
+			t[i].expire = nni_clock() + 1000000;
+			t[i].sig = 0;
+			So(nni_thr_init(&thr[i], take, &t[i]) == 0);
+			nni_thr_run(&thr[i]);
+		}
+		waitreaders(mq, 4);
+
+		// Every put finds a reader asleep, and gives it the message
+		// without using a slot.
+		for (i = 0; i < 4; i++) {
+			So(nni_msgq_tryput(mq, mkmsg(1 << i)) == 0);
+			So(nni_msgq_len(mq) == 0);
+		}
+		for (i = 0; i < 4; i++) {
+			nni_thr_fini(&thr[i]);
+			So(t[i].rv == 0);
+			sum |= t[i].val;
+		}
+		So(sum == 15);
+		nni_msgq_fini(mq);
+	})
+
+	Convey("A reader timing out during a handoff loses nothing", {
+		static nni_thr thr;
+		static taker t;
+		nni_msgq *mq;
+		nni_msg *msg;
+		int i;
+
+		So(nni_msgq_init(&mq, 0) == 0);
+		for (i = 0; i < 20; i++) {
+			t.mq = mq;
+			t.expire = nni_clock() + 5000;
+			t.sig = 0;
+			So(nni_thr_init(&thr, take, &t) == 0);
+			nni_thr_run(&thr);
+			waitreaders(mq, 1);
+
+			// The deadline passes while we hold the lock, so the
+			// put races the reader giving up.
+			nni_mtx_lock(&mq->mq_lock);
+			nni_usleep(10000);
+			nni_mtx_unlock(&mq->mq_lock);
+			msg = mkmsg(i + 1);
+			if (nni_msgq_tryput(mq, msg) == 0) {
+				nni_thr_fini(&thr);
+				if (t.rv == 0) {
+					So(t.val == i + 1);
+				} else {
+					So(t.rv == NNG_ETIMEDOUT);
+					So(leftover(mq) == i + 1);
+				}
+			} else {
+				nni_msg_free(msg);
+				nni_thr_fini(&thr);
+				So(t.rv == NNG_ETIMEDOUT);
+			}
+			So(nni_msgq_len(mq) == 0);
+		}
+		nni_msgq_fini(mq);
+	})
+
+	Convey("A signal or close during a handoff loses nothing", {
+		static nni_thr thr[2];
+		static taker t;
+		nni_msgq *mq;
+		nni_msg *msg;
+		int closing;
+		int i;
+		int prv;
+
+		for (i = 0; i < 40; i++) {
+			closing = i & 1;
+			So(nni_msgq_init(&mq, 0) == 0);
+			t.mq = mq;
+			t.expire = nni_clock() + 1000000;
+			t.sig = 0;
+			So(nni_thr_init(&thr[0], take, &t) == 0);
+			So(nni_thr_init(&thr[1], closing ? takeclose : takesig,
+			    &t) == 0);
+			nni_thr_run(&thr[0]);
+			waitreaders(mq, 1);
+
+			// The signal or close waits on the lock, and the put
+			// races it for the lock when we let go.
+			nni_mtx_lock(&mq->mq_lock);
+			nni_thr_run(&thr[1]);
+			nni_usleep(5000);
+			nni_mtx_unlock(&mq->mq_lock);
+			msg = mkmsg(i + 1);
+			if ((prv = nni_msgq_tryput(mq, msg)) != 0) {
+				nni_msg_free(msg);
+			}
+			nni_thr_fini(&thr[0]);
+			nni_thr_fini(&thr[1]);
+
+			if (t.rv == 0) {
+				So(prv == 0);
+				So(t.val == i + 1);
+			} else if (closing) {
+				// Anything put was freed by the close.
+				So(t.rv == NNG_ECLOSED);
+			} else {
+				So(t.rv == NNG_EINTR);
+				So(leftover(mq) == (prv == 0 ? i + 1 : 0));
+			}
+			nni_msgq_fini(mq);
+		}
+	})
+
+	Convey("Wrapped queues keep their order", {
+		nni_msgq *mq;
+		nni_msg *msg;
+
+		// With a capacity of 2 there are 4 slots.  Two puts and
+		// gets, then two more puts, leave the contents straddling
+		// the end of the array.
+		So(nni_msgq_init(&mq, 2) == 0);
+		So(nni_msgq_tryput(mq, mkmsg(1)) == 0);
+		So(nni_msgq_tryput(mq, mkmsg(2)) == 0);
+		So(nni_msgq_get(mq, &msg) == 0);
+		So(msgval(msg) == 1);
+		So(nni_msgq_get(mq, &msg) == 0);
+		So(msgval(msg) == 2);
+		So(nni_msgq_tryput(mq, mkmsg(3)) == 0);
+		So(nni_msgq_tryput(mq, mkmsg(4)) == 0);
+		So(nni_msgq_get(mq, &msg) == 0);
+		So(msgval(msg) == 3);
+		So(nni_msgq_tryput(mq, mkmsg(5)) == 0);
+
+		Reset({
+			nni_msgq_fini(mq);
+		})
+
+		Convey("Across a resize", {
+			So(nni_msgq_resize(mq, 4) == 0);
+			So(nni_msgq_get(mq, &msg) == 0);
+			So(msgval(msg) == 4);
+			So(nni_msgq_get(mq, &msg) == 0);
+			So(msgval(msg) == 5);
+		})
+
+		Convey("Across a putback at the start", {
+			// The get index is now back at the first slot.
+			So(nni_msgq_get(mq, &msg) == 0);
+			So(msgval(msg) == 4);
+			So(nni_msgq_putback(mq, mkmsg(6)) == 0);
+			So(nni_msgq_get(mq, &msg) == 0);
+			So(msgval(msg) == 6);
+			So(nni_msgq_get(mq, &msg) == 0);
+			So(msgval(msg) == 5);
+		})
+
+		Convey("Across a close", {
+			nni_msgq_close(mq);
+			So(nni_msgq_len(mq) == 0);
+		})
+
+		Convey("Across a drain", {
+			nni_msgq_drain(mq, nni_clock() + 1000);
+			So(nni_msgq_len(mq) == 0);
+		})
+	})
+})
@@ -9,6 +9,7 @@
 
 #include "convey.h"
 #include "nng.h"
+#include "core/nng_impl.h"
 
 #include <string.h>
 
@@ -16,6 +17,25 @@
 #define CHECKSTR(m, s)	So(nng_msg_len(m) == strlen(s));\
 			So(memcmp(nng_msg_body(m), s, strlen(s)) == 0)
 
+typedef struct {
+	nng_socket *	sock;
+	int		want;
+	int		got;
+} drainer;
+
+static void
+drain(void *arg)
+{
+	drainer *d = arg;
+	nng_msg *msg;
+
+	while ((d->got < d->want) && (nng_recvmsg(d->sock, &msg, 0) == 0)) {
+		nng_msg_free(msg);
+		d->got++;
+	}
+}
+
+
 Main({
 	int rv;
 	const char *addr = "inproc://test";
@@ -158,5 +178,207 @@ Main({
 			So(nng_recvmsg(pull1, &abc, 0) == NNG_ETIMEDOUT);
 			So(nng_recvmsg(pull2, &abc, 0) == NNG_ETIMEDOUT);
 		})
+
+		Convey("Queued messages are not left behind", {
+			static nni_thr thr;
+			static drainer d;
+			uint64_t usecs;
+			nng_socket *push;
+			nng_socket *pull;
+			nng_msg *msg;
+			int bufsz;
+			int i;
+
+			So(nng_open(&push, NNG_PROTO_PUSH) == 0);
+			So(nng_open(&pull, NNG_PROTO_PULL) == 0);
+
+			Reset({
+				nng_close(push);
+				nng_close(pull);
+			})
+
+			usecs = 1000000;
+			So(nng_setopt(push, NNG_OPT_SNDTIMEO, &usecs,
+			    sizeof (usecs)) == 0);
+			So(nng_setopt(pull, NNG_OPT_RCVTIMEO, &usecs,
+			    sizeof (usecs)) == 0);
+			bufsz = 1;
+			So(nng_setopt(pull, NNG_OPT_RCVBUF, &bufsz,
+			    sizeof (bufsz)) == 0);
+			So(nng_listen(push, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(pull, addr, NULL, NNG_FLAG_SYNCH) == 0);
+
+			// The sender outpaces the reader, so messages go
+			// through the socket's sender while the pipe is
+			// busy.  Each must be handed on when the pipe frees
+			// up, without waiting for a later send.
+			for (bufsz = 0; bufsz <= 16; bufsz += 16) {
+				So(nng_setopt(push, NNG_OPT_SNDBUF, &bufsz,
+				    sizeof (bufsz)) == 0);
+				d.sock = pull;
+				d.want = 200;
+				d.got = 0;
+				So(nni_thr_init(&thr, drain, &d) == 0);
+				nni_thr_run(&thr);
+				for (i = 0; i < 200; i++) {
+					So(nng_msg_alloc(&msg, 0) == 0);
+					APPENDSTR(msg, "job");
+					So(nng_sendmsg(push, msg, 0) == 0);
+				}
+				nni_thr_fini(&thr);
+				So(d.got == 200);
+			}
+		})
+
+		Convey("Load aware policies deliver everything", {
+			uint64_t usecs;
+			nng_socket *push;
+			nng_socket *pull1;
+			nng_socket *pull2;
+			nng_msg *msg;
+			int policy;
+			int check;
+			int bufsz;
+			int count;
+			int i;
+			size_t sz;
+
+			So(nng_open(&push, NNG_PROTO_PUSH) == 0);
+			So(nng_open(&pull1, NNG_PROTO_PULL) == 0);
+			So(nng_open(&pull2, NNG_PROTO_PULL) == 0);
+
+			Reset({
+				nng_close(push);
+				nng_close(pull1);
+				nng_close(pull2);
+			})
+
+			policy = NNG_LB_WEIGHTED + 1;
+			So(nng_setopt(push, NNG_OPT_LBPOLICY, &policy,
+			    sizeof (policy)) == NNG_EINVAL);
+
+			bufsz = 4;
+			So(nng_setopt(push, NNG_OPT_SNDBUF, &bufsz,
+			    sizeof (bufsz)) == 0);
+			sz = sizeof (check);
+			So(nng_getopt(push, NNG_OPT_SNDBUF, &check, &sz) == 0);
+			So(check == bufsz);
+
+			usecs = 100000;
+			So(nng_setopt(pull1, NNG_OPT_RCVTIMEO, &usecs, sizeof (usecs)) == 0);
+			So(nng_setopt(pull2, NNG_OPT_RCVTIMEO, &usecs, sizeof (usecs)) == 0);
+			So(nng_listen(push, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(pull1, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(pull2, addr, NULL, NNG_FLAG_SYNCH) == 0);
+
+			for (policy = NNG_LB_ROUNDROBIN;
+			    policy <= NNG_LB_WEIGHTED; policy++) {
+				So(nng_setopt(push, NNG_OPT_LBPOLICY, &policy,
+				    sizeof (policy)) == 0);
+				sz = sizeof (check);
+				So(nng_getopt(push, NNG_OPT_LBPOLICY, &check,
+				    &sz) == 0);
+				So(check == policy);
+
+				for (i = 0; i < 8; i++) {
+					So(nng_msg_alloc(&msg, 0) == 0);
+					APPENDSTR(msg, "job");
+					So(nng_sendmsg(push, msg, 0) == 0);
+				}
+				count = 0;
+				while (nng_recvmsg(pull1, &msg, 0) == 0) {
+					nng_msg_free(msg);
+					count++;
+				}
+				while (nng_recvmsg(pull2, &msg, 0) == 0) {
+					nng_msg_free(msg);
+					count++;
+				}
+				So(count == 8);
+			}
+		})
+
+		Convey("Load aware policies avoid a stalled consumer", {
+			uint64_t usecs;
+			nng_socket *push;
+			nng_socket *busy;
+			nng_socket *stall;
+			nng_msg *msg;
+			int policy;
+			int bufsz;
+			int nbusy;
+			int nstall;
+			int i;
+			int j;
+
+			So(nng_open(&push, NNG_PROTO_PUSH) == 0);
+			So(nng_open(&busy, NNG_PROTO_PULL) == 0);
+			So(nng_open(&stall, NNG_PROTO_PULL) == 0);
+
+			Reset({
+				nng_close(push);
+				nng_close(busy);
+				nng_close(stall);
+			})
+
+			bufsz = 2;
+			So(nng_setopt(push, NNG_OPT_SNDBUF, &bufsz,
+			    sizeof (bufsz)) == 0);
+			bufsz = 1;
+			So(nng_setopt(stall, NNG_OPT_RCVBUF, &bufsz,
+			    sizeof (bufsz)) == 0);
+			usecs = 1000000;
+			So(nng_setopt(push, NNG_OPT_SNDTIMEO, &usecs,
+			    sizeof (usecs)) == 0);
+			So(nng_setopt(stall, NNG_OPT_RCVTIMEO, &usecs,
+			    sizeof (usecs)) == 0);
+			usecs = 20000;
+			So(nng_setopt(busy, NNG_OPT_RCVTIMEO, &usecs,
+			    sizeof (usecs)) == 0);
+
+			// The stalled peer connects first, so that it wins
+			// any ties.
+			So(nng_listen(push, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(stall, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(busy, addr, NULL, NNG_FLAG_SYNCH) == 0);
+
+			for (policy = NNG_LB_LEASTBUSY;
+			    policy <= NNG_LB_WEIGHTED; policy++) {
+				So(nng_setopt(push, NNG_OPT_LBPOLICY, &policy,
+				    sizeof (policy)) == 0);
+
+				// Send in small batches, draining only the
+				// busy peer in between.
+				nbusy = 0;
+				for (i = 0; i < 16; i++) {
+					for (j = 0; j < 4; j++) {
+						So(nng_msg_alloc(&msg, 0) == 0);
+						APPENDSTR(msg, "job");
+						So(nng_sendmsg(push, msg, 0) == 0);
+					}
+					while (nng_recvmsg(busy, &msg, 0) == 0) {
+						nng_msg_free(msg);
+						nbusy++;
+					}
+				}
+
+				// Now catch up on what the stalled one has,
+				// and anything the busy one had in flight.
+				nstall = 0;
+				while (nbusy + nstall < 64) {
+					if (nng_recvmsg(stall, &msg, 0) == 0) {
+						nstall++;
+					} else if (nng_recvmsg(busy, &msg, 0) == 0) {
+						nbusy++;
+					} else {
+						break;
+					}
+					nng_msg_free(msg);
+				}
+				So(nbusy + nstall == 64);
+				So(nstall < 16);
+				So(nstall < nbusy);
+			}
+		})
 	})
 })
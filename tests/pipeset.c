@@ -0,0 +1,96 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "core/nng_impl.h"
+
+static nni_pipeset *relset;
+static nni_pipeset_snap *relsnap;
+
+static void
+slowrele(void *arg)
+{
+	NNI_ARG_UNUSED(arg);
+	nni_usleep(100000);
+	nni_pipeset_rele(relset, relsnap);
+}
+
+
+TestMain("Pipe sets", {
+	Convey("Init worked", {
+		So(nni_init() == 0);
+	})
+
+	Convey("Given a pipe set", {
+		nni_pipeset *ps;
+		nni_pipeset_snap *snap;
+		int a;
+		int b;
+		int c;
+
+		So(nni_pipeset_create(&ps) == 0);
+		So(ps != NULL);
+
+		Reset({
+			nni_pipeset_destroy(ps);
+		})
+
+		Convey("It starts empty", {
+			snap = nni_pipeset_hold(ps);
+			So(snap->ps_npipes == 0);
+			nni_pipeset_rele(ps, snap);
+		})
+
+		Convey("We can add and remove members", {
+			So(nni_pipeset_add(ps, &a) == 0);
+			So(nni_pipeset_add(ps, &b) == 0);
+			So(nni_pipeset_add(ps, &c) == 0);
+			snap = nni_pipeset_hold(ps);
+			So(snap->ps_npipes == 3);
+			So(snap->ps_pipes[0] == &a);
+			So(snap->ps_pipes[2] == &c);
+			nni_pipeset_rele(ps, snap);
+
+			nni_pipeset_remove(ps, &b);
+			nni_pipeset_remove(ps, &b);
+			snap = nni_pipeset_hold(ps);
+			So(snap->ps_npipes == 2);
+			So(snap->ps_pipes[0] == &a);
+			So(snap->ps_pipes[1] == &c);
+			nni_pipeset_rele(ps, snap);
+		})
+
+		Convey("Snapshots are immutable", {
+			So(nni_pipeset_add(ps, &a) == 0);
+			snap = nni_pipeset_hold(ps);
+			So(nni_pipeset_add(ps, &b) == 0);
+			nni_pipeset_remove(ps, &a);
+			So(snap->ps_npipes == 1);
+			So(snap->ps_pipes[0] == &a);
+			nni_pipeset_rele(ps, snap);
+		})
+
+		Convey("Sync waits for old snapshots", {
+			nni_thr thr;
+			nni_time start;
+
+			So(nni_pipeset_add(ps, &a) == 0);
+			relset = ps;
+			relsnap = nni_pipeset_hold(ps);
+			nni_pipeset_remove(ps, &a);
+
+			So(nni_thr_init(&thr, slowrele, NULL) == 0);
+			start = nni_clock();
+			nni_thr_run(&thr);
+			nni_pipeset_sync(ps);
+			So((nni_clock() - start) >= 50000);
+			nni_thr_fini(&thr);
+		})
+	})
+})
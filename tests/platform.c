@@ -99,6 +99,19 @@ TestMain("Platform Operations", {
 			So(usdelta < 220);
 			So(abs(msdelta - usdelta) < 20);
 		})
+		Convey("The coarse clock is never behind", {
+			nni_time precise;
+			nni_time coarse;
+			int i;
+
+			for (i = 0; i < 1000; i++) {
+				precise = nni_clock();
+				coarse = nni_clock_coarse();
+				So(coarse >= precise);
+				So(coarse < (precise + 20000));
+				nni_usleep(i % 10);
+			}
+		})
 	})
 	Convey("Mutexes work", {
 		static nni_mtx mx;
@@ -146,6 +159,13 @@ TestMain("Platform Operations", {
 			Convey("We can reap it", {
 				nni_thr_fini(&thr);
 			})
+			Convey("Reaping it at once still runs it", {
+				// fini may get there before the thread is
+				// scheduled; a thread that was run must
+				// still do its work.
+				nni_thr_fini(&thr);
+				So(val == 1);
+			})
 			Reset({
 				nni_thr_fini(&thr);
 			})
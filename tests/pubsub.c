@@ -10,6 +10,7 @@
 #include "convey.h"
 #include "nng.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #define	APPENDSTR(m, s)	nng_msg_append(m, s, strlen(s))
@@ -64,6 +65,78 @@ Main({
 			})
 		})
 
+		Convey("Fan-out workers serve many subscribers", {
+			nng_socket *pub;
+			nng_socket *subs[9];
+			char url[32];
+			uint64_t rtimeo = 500000; // 500ms
+			int depth = 64;
+			int nfan = 3;
+			nng_msg *msg;
+			uint32_t i;
+			int j;
+
+			// More subscribers than workers, so that some worker
+			// has several, and several workers have some.
+			So(nng_open(&pub, NNG_PROTO_PUB) == 0);
+			for (j = 0; j < 9; j++) {
+				So(nng_open(&subs[j], NNG_PROTO_SUB) == 0);
+			}
+
+			Reset({
+				nng_close(pub);
+				for (j = 0; j < 9; j++) {
+					nng_close(subs[j]);
+				}
+			})
+
+			So(nng_setopt(pub, NNG_OPT_SNDBUF, &depth, sizeof (depth)) == 0);
+			So(nng_setopt(pub, NNG_OPT_FANOUT, &nfan, sizeof (nfan)) == 0);
+			for (j = 0; j < 8; j++) {
+				(void) snprintf(url, sizeof (url), "inproc://fan%d", j);
+				So(nng_setopt(subs[j], NNG_OPT_SUBSCRIBE, "", 0) == 0);
+				So(nng_setopt(subs[j], NNG_OPT_RCVTIMEO, &rtimeo, sizeof (rtimeo)) == 0);
+				So(nng_listen(subs[j], url, NULL, NNG_FLAG_SYNCH) == 0);
+				So(nng_dial(pub, url, NULL, NNG_FLAG_SYNCH) == 0);
+			}
+
+			for (i = 0; i < 32; i++) {
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_msg_append(msg, &i, sizeof (i)) == 0);
+				So(nng_sendmsg(pub, msg, 0) == 0);
+			}
+			for (j = 0; j < 8; j++) {
+				for (i = 0; i < 32; i++) {
+					So(nng_recvmsg(subs[j], &msg, 0) == 0);
+					So(nng_msg_len(msg) == sizeof (i));
+					So(memcmp(nng_msg_body(msg), &i, sizeof (i)) == 0);
+					nng_msg_free(msg);
+				}
+			}
+
+			// A new subscriber, and a different number of workers,
+			// both change how the subscribers are sharded.
+			nfan = 5;
+			So(nng_setopt(pub, NNG_OPT_FANOUT, &nfan, sizeof (nfan)) == 0);
+			So(nng_setopt(subs[8], NNG_OPT_SUBSCRIBE, "", 0) == 0);
+			So(nng_setopt(subs[8], NNG_OPT_RCVTIMEO, &rtimeo, sizeof (rtimeo)) == 0);
+			So(nng_listen(subs[8], "inproc://fan8", NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(pub, "inproc://fan8", NULL, NNG_FLAG_SYNCH) == 0);
+			for (i = 32; i < 64; i++) {
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_msg_append(msg, &i, sizeof (i)) == 0);
+				So(nng_sendmsg(pub, msg, 0) == 0);
+			}
+			for (j = 0; j < 9; j++) {
+				for (i = 32; i < 64; i++) {
+					So(nng_recvmsg(subs[j], &msg, 0) == 0);
+					So(nng_msg_len(msg) == sizeof (i));
+					So(memcmp(nng_msg_body(msg), &i, sizeof (i)) == 0);
+					nng_msg_free(msg);
+				}
+			}
+		})
+
 		Convey("We can create a linked PUB/SUB pair", {
 			nng_socket *pub;
 			nng_socket *sub;
@@ -149,6 +222,103 @@ Main({
 				So(nng_recvmsg(sub, &msg, 0) == NNG_ETIMEDOUT);
 			})
 
+			Convey("Per-pipe send buffering is tunable", {
+				uint64_t rtimeo = 50000; // 50ms
+				int depth = 64;
+				int hwm = 4096;
+				int val;
+				size_t sz;
+				nng_msg *msg;
+				uint32_t i;
+				uint32_t n;
+				int64_t last;
+
+				So(nng_setopt(pub, NNG_OPT_SNDHWM, &hwm, sizeof (hwm)) == 0);
+				sz = sizeof (val);
+				So(nng_getopt(pub, NNG_OPT_SNDHWM, &val, &sz) == 0);
+				So(val == hwm);
+				hwm = -1;
+				So(nng_setopt(pub, NNG_OPT_SNDHWM, &hwm, sizeof (hwm)) == NNG_EINVAL);
+
+				// An unbuffered pipe queue is refused.
+				depth = 0;
+				So(nng_setopt(pub, NNG_OPT_SNDBUF, &depth, sizeof (depth)) == NNG_EINVAL);
+
+				So(nng_setopt(sub, NNG_OPT_SUBSCRIBE, "", 0) == 0);
+				So(nng_setopt(sub, NNG_OPT_RCVTIMEO, &rtimeo, sizeof (rtimeo)) == 0);
+
+				Convey("A deep queue absorbs a burst", {
+					depth = 64;
+					So(nng_setopt(pub, NNG_OPT_SNDBUF, &depth, sizeof (depth)) == 0);
+					for (i = 0; i < 32; i++) {
+						So(nng_msg_alloc(&msg, 0) == 0);
+						So(nng_msg_append(msg, &i, sizeof (i)) == 0);
+						So(nng_sendmsg(pub, msg, 0) == 0);
+					}
+					for (i = 0; i < 32; i++) {
+						So(nng_recvmsg(sub, &msg, 0) == 0);
+						So(memcmp(nng_msg_body(msg), &i, sizeof (i)) == 0);
+						nng_msg_free(msg);
+					}
+				})
+
+				Convey("A shallow queue drops the excess", {
+					depth = 1;
+					So(nng_setopt(pub, NNG_OPT_SNDBUF, &depth, sizeof (depth)) == 0);
+					for (i = 0; i < 32; i++) {
+						So(nng_msg_alloc(&msg, 0) == 0);
+						So(nng_msg_append(msg, &i, sizeof (i)) == 0);
+						So(nng_sendmsg(pub, msg, 0) == 0);
+					}
+
+					// What does arrive is in order, and there
+					// is less of it than was sent.
+					n = 0;
+					last = -1;
+					while (nng_recvmsg(sub, &msg, 0) == 0) {
+						memcpy(&i, nng_msg_body(msg), sizeof (i));
+						So((int64_t) i > last);
+						last = i;
+						n++;
+						nng_msg_free(msg);
+					}
+					So(n > 0);
+					So(n < 32);
+				})
+			})
+
+			Convey("Fan-out workers preserve order", {
+				uint64_t rtimeo = 500000; // 500ms
+				int depth = 64;
+				int nfan = 4;
+				int val;
+				size_t sz;
+				nng_msg *msg;
+				uint32_t i;
+
+				So(nng_setopt(pub, NNG_OPT_SNDBUF, &depth, sizeof (depth)) == 0);
+				So(nng_setopt(pub, NNG_OPT_FANOUT, &nfan, sizeof (nfan)) == 0);
+				sz = sizeof (val);
+				So(nng_getopt(pub, NNG_OPT_FANOUT, &val, &sz) == 0);
+				So(val == nfan);
+				nfan = 0;
+				So(nng_setopt(pub, NNG_OPT_FANOUT, &nfan, sizeof (nfan)) == NNG_EINVAL);
+
+				So(nng_setopt(sub, NNG_OPT_SUBSCRIBE, "", 0) == 0);
+				So(nng_setopt(sub, NNG_OPT_RCVTIMEO, &rtimeo, sizeof (rtimeo)) == 0);
+				for (i = 0; i < 32; i++) {
+					So(nng_msg_alloc(&msg, 0) == 0);
+					So(nng_msg_append(msg, &i, sizeof (i)) == 0);
+					So(nng_sendmsg(pub, msg, 0) == 0);
+				}
+				for (i = 0; i < 32; i++) {
+					So(nng_recvmsg(sub, &msg, 0) == 0);
+					So(nng_msg_len(msg) == sizeof (i));
+					So(memcmp(nng_msg_body(msg), &i, sizeof (i)) == 0);
+					nng_msg_free(msg);
+				}
+			})
+
 			Convey("Subs in raw receive", {
 
 				uint64_t rtimeo = 50000; // 500ms
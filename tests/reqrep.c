@@ -9,6 +9,7 @@
 
 #include "convey.h"
 #include "nng.h"
+#include "core/nng_impl.h"
 
 #include <string.h>
 
@@ -63,6 +64,19 @@ Main({
 				So(rv == NNG_ESTATE);
 				nng_msg_free(msg);
 			})
+
+			Convey("Leaving raw mode restores the send state", {
+				nng_msg *msg;
+				int raw;
+
+				raw = 1;
+				So(nng_setopt(rep, NNG_OPT_RAW, &raw, sizeof (raw)) == 0);
+				raw = 0;
+				So(nng_setopt(rep, NNG_OPT_RAW, &raw, sizeof (raw)) == 0);
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_sendmsg(rep, msg, 0) == NNG_ESTATE);
+				nng_msg_free(msg);
+			})
 		})
 
 		Convey("We can create a linked REQ/REP pair", {
@@ -114,6 +128,89 @@ Main({
 			})
 		})
 
+		Convey("A raw REP serves several REQ peers", {
+			nng_socket *rep;
+			nng_socket *req1;
+			nng_socket *req2;
+			nng_msg *msg;
+			uint64_t tmo = 1000000;	// 1 sec
+			int raw = 1;
+
+			So(nng_open(&rep, NNG_PROTO_REP) == 0);
+			So(nng_open(&req1, NNG_PROTO_REQ) == 0);
+			So(nng_open(&req2, NNG_PROTO_REQ) == 0);
+
+			Reset({
+				nng_close(rep);
+				nng_close(req1);
+				nng_close(req2);
+			})
+
+			So(nng_setopt(rep, NNG_OPT_RAW, &raw, sizeof (raw)) == 0);
+			So(nng_setopt(rep, NNG_OPT_RCVTIMEO, &tmo, sizeof (tmo)) == 0);
+			So(nng_setopt(req1, NNG_OPT_RCVTIMEO, &tmo, sizeof (tmo)) == 0);
+			So(nng_setopt(req2, NNG_OPT_RCVTIMEO, &tmo, sizeof (tmo)) == 0);
+			So(nng_listen(rep, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(req1, addr, NULL, NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(req2, addr, NULL, NNG_FLAG_SYNCH) == 0);
+
+			// Both requests are queued behind the unbuffered
+			// read queue before the server asks for either.
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_msg_append(msg, "one", 4) == 0);
+			So(nng_sendmsg(req1, msg, 0) == 0);
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_msg_append(msg, "two", 4) == 0);
+			So(nng_sendmsg(req2, msg, 0) == 0);
+			nni_usleep(20000);
+
+			So(nng_recvmsg(rep, &msg, 0) == 0);
+			So(nng_sendmsg(rep, msg, 0) == 0);
+			So(nng_recvmsg(rep, &msg, 0) == 0);
+			So(nng_sendmsg(rep, msg, 0) == 0);
+
+			So(nng_recvmsg(req1, &msg, 0) == 0);
+			So(memcmp(nng_msg_body(msg), "one", 4) == 0);
+			nng_msg_free(msg);
+			So(nng_recvmsg(req2, &msg, 0) == 0);
+			So(memcmp(nng_msg_body(msg), "two", 4) == 0);
+			nng_msg_free(msg);
+		})
+
+		Convey("Backtraces move to the header in one piece", {
+			nni_msg *msg;
+			uint8_t bt[12];
+
+			// Two hops, then the request id.
+			NNI_PUT32(bt, 1);
+			NNI_PUT32(bt + 4, 2);
+			NNI_PUT32(bt + 8, 0x80000003u);
+			So(nni_msg_alloc(&msg, 0) == 0);
+			So(nni_msg_append(msg, bt, sizeof (bt)) == 0);
+			So(nni_msg_append(msg, "data", 5) == 0);
+
+			Reset({
+				nni_msg_free(msg);
+			})
+
+			Convey("Within the hop limit", {
+				So(nni_msg_backtrace(msg, 3) == 0);
+				So(nni_msg_header_len(msg) == sizeof (bt));
+				So(memcmp(nni_msg_header(msg), bt, sizeof (bt)) == 0);
+				So(nni_msg_len(msg) == 5);
+				So(memcmp(nni_msg_body(msg), "data", 5) == 0);
+			})
+			Convey("Beyond the hop limit", {
+				So(nni_msg_backtrace(msg, 2) == NNG_EINVAL);
+				So(nni_msg_header_len(msg) == 0);
+				So(nni_msg_len(msg) == sizeof (bt) + 5);
+			})
+			Convey("Without a terminator", {
+				So(nni_msg_trunc(msg, 9) == 0);
+				So(nni_msg_backtrace(msg, 8) == NNG_EINVAL);
+			})
+		})
+
 		Convey("Request cancellation works", {
 			nng_msg *abc;
 			nng_msg *def;
@@ -0,0 +1,120 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "nng.h"
+#include "core/nng_impl.h"
+
+#include <string.h>
+
+// A fake lookup function, so that we can tell when the cache is consulted
+// rather than the "network".
+static int lookups;
+
+static int
+fakelookup(const char *host, nni_sockaddr *sa, int flags)
+{
+	NNI_ARG_UNUSED(flags);
+	lookups++;
+	if ((host != NULL) && (strcmp(host, "slow.example") == 0)) {
+		nni_usleep(100000);
+	}
+	if ((host == NULL) || (strcmp(host, "bad.example") == 0)) {
+		return (NNG_EADDRINVAL);
+	}
+	memset(sa, 0, sizeof (*sa));
+	sa->s_un.s_in.sa_family = NNG_AF_INET;
+	sa->s_un.s_in.sa_addr = (uint32_t) strlen(host);
+	return (0);
+}
+
+
+static void
+slowlookup(void *arg)
+{
+	nni_sockaddr sa;
+
+	*(int *) arg = nni_resolv_lookup("slow.example", &sa, 0);
+}
+
+
+TestMain("Resolver cache", {
+	int rv = nni_init();
+
+	Convey("Init worked", {
+		So(rv == 0);
+	})
+
+	Convey("Given a fake resolver", {
+		nni_resolv_set_lookup(fakelookup);
+		lookups = 0;
+
+		Reset({
+			nni_resolv_set_lookup(NULL);
+		})
+
+		Convey("Positive results are cached", {
+			nni_sockaddr sa;
+
+			So(nni_resolv_lookup("good.example", &sa, 0) == 0);
+			So(sa.s_un.s_in.sa_addr == strlen("good.example"));
+			So(lookups == 1);
+			memset(&sa, 0, sizeof (sa));
+			So(nni_resolv_lookup("good.example", &sa, 0) == 0);
+			So(sa.s_un.s_in.sa_addr == strlen("good.example"));
+			So(lookups == 1);
+
+			Convey("Flags are part of the key", {
+				So(nni_resolv_lookup("good.example", &sa,
+				    NNI_FLAG_IPV4ONLY) == 0);
+				So(lookups == 2);
+			})
+
+			Convey("Flushing forces a new lookup", {
+				nni_resolv_flush();
+				So(nni_resolv_lookup("good.example", &sa,
+				    0) == 0);
+				So(lookups == 2);
+			})
+		})
+
+		Convey("Negative results are cached", {
+			nni_sockaddr sa;
+
+			rv = nni_resolv_lookup("bad.example", &sa, 0);
+			So(rv == NNG_EADDRINVAL);
+			So(lookups == 1);
+			rv = nni_resolv_lookup("bad.example", &sa, 0);
+			So(rv == NNG_EADDRINVAL);
+			So(lookups == 1);
+		})
+
+		Convey("Concurrent lookups are coalesced", {
+			nni_thr thr;
+			int rv1 = -1;
+			int rv2 = -1;
+
+			So(nni_thr_init(&thr, slowlookup, &rv1) == 0);
+			nni_thr_run(&thr);
+			slowlookup(&rv2);
+			nni_thr_fini(&thr);
+			So(rv1 == 0);
+			So(rv2 == 0);
+			So(lookups == 1);
+		})
+	})
+
+	Convey("The platform resolver handles literals", {
+		nni_sockaddr sa;
+
+		rv = nni_resolv_lookup("127.0.0.1", &sa, NNI_FLAG_IPV4ONLY);
+		So(rv == 0);
+		So(sa.s_un.s_in.sa_family == NNG_AF_INET);
+	})
+})
@@ -9,6 +9,7 @@
 
 #include "convey.h"
 #include "nng.h"
+#include "core/nng_impl.h"
 
 #include <string.h>
 
@@ -109,6 +110,69 @@ TestMain("Socket Operations", {
 			})
 		})
 
+		Convey("We can bind the socket to CPUs", {
+			uint8_t mask[4];
+			uint8_t check[8];
+			uint8_t big[1024];
+			size_t sz;
+
+			memset(mask, 0xff, sizeof (mask));
+			rv = nng_setopt(sock, NNG_OPT_AFFINITY, mask,
+				sizeof (mask));
+			if (rv == NNG_ENOTSUP) {
+				ConveySkip("CPU affinity not supported");
+			}
+			So(rv == 0);
+			sz = sizeof (check);
+			rv = nng_getopt(sock, NNG_OPT_AFFINITY, check, &sz);
+			So(rv == 0);
+			So(sz == sizeof (mask));
+			So(memcmp(check, mask, sz) == 0);
+
+			Convey("An empty mask allows any CPU", {
+				rv = nng_setopt(sock, NNG_OPT_AFFINITY, mask, 0);
+				So(rv == 0);
+				sz = sizeof (check);
+				rv = nng_getopt(sock, NNG_OPT_AFFINITY, check,
+					&sz);
+				So(rv == 0);
+				So(sz == 0);
+			})
+			Convey("An oversized mask is rejected", {
+				memset(big, 0xff, sizeof (big));
+				rv = nng_setopt(sock, NNG_OPT_AFFINITY, big,
+					sizeof (big));
+				So(rv == NNG_EINVAL);
+			})
+		})
+
+		Convey("Busy-polling still honors timeouts", {
+			nng_msg *msg = NULL;
+			int64_t spin = 2000;
+			int64_t when = 100000;
+			int64_t check = 0;
+			size_t sz = sizeof (check);
+			uint64_t now;
+
+			extern uint64_t nni_clock(void);
+
+			rv = nng_setopt(sock, NNG_OPT_BUSYPOLL, &spin,
+				sizeof (spin));
+			So(rv == 0);
+			rv = nng_getopt(sock, NNG_OPT_BUSYPOLL, &check, &sz);
+			So(rv == 0);
+			So(check == spin);
+
+			rv = nng_setopt(sock, NNG_OPT_RCVTIMEO, &when,
+				sizeof (when));
+			So(rv == 0);
+			now = nni_clock();
+			rv = nng_recvmsg(sock, &msg, 0);
+			So(rv == NNG_ETIMEDOUT);
+			So(nni_clock() >= (now + when));
+			So(nni_clock() < (now + (when * 2)));
+		})
+
 		Convey("Bogus URLs not supported", {
 			Convey("Dialing fails properly", {
 				rv = nng_dial(sock, "bogus://somewhere", NULL, 0);
@@ -123,6 +187,10 @@ TestMain("Socket Operations", {
 		Convey("Dialing synch can get refused", {
 			rv = nng_dial(sock, "inproc://notthere", NULL, NNG_FLAG_SYNCH);
 			So(rv == NNG_ECONNREFUSED);
+
+			// The failed endpoint is gone, not kept for the app.
+			So(nni_list_first(&sock->s_eps) == NULL);
+			So(nni_list_first(&sock->s_eps_closed) == NULL);
 		})
 
 		Convey("Listening works", {
@@ -132,6 +200,7 @@ TestMain("Socket Operations", {
 			Convey("Second listen fails ADDRINUSE", {
 				rv = nng_listen(sock, "inproc://here", NULL, NNG_FLAG_SYNCH);
 				So(rv == NNG_EADDRINUSE);
+				So(nni_list_first(&sock->s_eps_closed) == NULL);
 			})
 
 			Convey("We can connect to it", {
@@ -195,5 +264,60 @@ TestMain("Socket Operations", {
 			nng_msg_free(msg);
 			nng_close(sock2);
 		})
+
+		Convey("Sends time out when the peer stops reading", {
+			nng_socket *sock2 = NULL;
+			nng_msg *msg;
+			uint64_t when = 100000;
+			int i;
+
+			So(nng_open(&sock2, NNG_PROTO_PAIR) == 0);
+			So(nng_setopt(sock, NNG_OPT_SNDTIMEO, &when,
+				sizeof (when)) == 0);
+			So(nng_listen(sock, "inproc://full", NULL,
+				NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(sock2, "inproc://full", NULL,
+				NNG_FLAG_SYNCH) == 0);
+
+			// Sends go straight to an idle pipe, until it
+			// fills up; then they must queue, and time out.
+			rv = 0;
+			for (i = 0; (i < 100) && (rv == 0); i++) {
+				So(nng_msg_alloc(&msg, 0) == 0);
+				if ((rv = nng_sendmsg(sock, msg, 0)) != 0) {
+					nng_msg_free(msg);
+				}
+			}
+			So(rv == NNG_ETIMEDOUT);
+			So(i > 1);
+
+			// And what was sent arrives.
+			So(nng_recvmsg(sock2, &msg, 0) == 0);
+			nng_msg_free(msg);
+			nng_close(sock2);
+		})
+
+		Convey("We can close a socket in the background", {
+			nng_socket *sock2 = NULL;
+			int i;
+
+			So(nng_open(&sock2, NNG_PROTO_PAIR) == 0);
+			So(nng_listen(sock2, "inproc://bg", NULL,
+				NNG_FLAG_SYNCH) == 0);
+			So(nng_dial(sock, "inproc://bg", NULL,
+				NNG_FLAG_SYNCH) == 0);
+			nng_close_async(sock2);
+
+			// Once it is really gone, the address is free.
+			for (i = 0; i < 100; i++) {
+				rv = nng_listen(sock, "inproc://bg", NULL,
+					NNG_FLAG_SYNCH);
+				if (rv != NNG_EADDRINUSE) {
+					break;
+				}
+				nni_usleep(10000);
+			}
+			So(rv == 0);
+		})
 	})
 })
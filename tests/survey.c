@@ -72,6 +72,19 @@ Main({
 				So(nng_sendmsg(resp, msg, 0) == NNG_ESTATE);
 				nng_msg_free(msg);
 			})
+
+			Convey("Leaving raw mode restores the send state", {
+				nng_msg *msg;
+				int raw;
+
+				raw = 1;
+				So(nng_setopt(resp, NNG_OPT_RAW, &raw, sizeof (raw)) == 0);
+				raw = 0;
+				So(nng_setopt(resp, NNG_OPT_RAW, &raw, sizeof (raw)) == 0);
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_sendmsg(resp, msg, 0) == NNG_ESTATE);
+				nng_msg_free(msg);
+			})
 		})
 
 		Convey("We can create a linked survey pair", {
@@ -106,6 +119,75 @@ Main({
 			So(nng_dial(sock, addr, NULL, NNG_FLAG_SYNCH) == 0);
 			nng_close(sock);
 
+			Convey("Concurrent surveys are tagged", {
+				nng_msg *msg;
+				uint32_t id1;
+				uint32_t id2;
+				uint32_t id;
+				size_t sz;
+				int max = 2;
+
+				expire = 500000;
+				So(nng_setopt(surv, NNG_OPT_SURVEYTIME, &expire, sizeof (expire)) == 0);
+				So(nng_setopt(surv, NNG_OPT_MAXSURVEYS, &max, sizeof (max)) == 0);
+				sz = sizeof (id1);
+				So(nng_getopt(surv, NNG_OPT_SURVEYID, &id1, &sz) == NNG_ESTATE);
+
+				So(nng_msg_alloc(&msg, 0) == 0);
+				APPENDSTR(msg, "one");
+				So(nng_sendmsg(surv, msg, 0) == 0);
+				sz = sizeof (id1);
+				So(nng_getopt(surv, NNG_OPT_SURVEYID, &id1, &sz) == 0);
+
+				So(nng_msg_alloc(&msg, 0) == 0);
+				APPENDSTR(msg, "two");
+				So(nng_sendmsg(surv, msg, 0) == 0);
+				sz = sizeof (id2);
+				So(nng_getopt(surv, NNG_OPT_SURVEYID, &id2, &sz) == 0);
+				So(id1 != id2);
+
+				So(nng_recvmsg(resp, &msg, 0) == 0);
+				CHECKSTR(msg, "one");
+				So(nng_sendmsg(resp, msg, 0) == 0);
+				So(nng_recvmsg(resp, &msg, 0) == 0);
+				CHECKSTR(msg, "two");
+				So(nng_sendmsg(resp, msg, 0) == 0);
+
+				So(nng_recvmsg(surv, &msg, 0) == 0);
+				CHECKSTR(msg, "one");
+				sz = sizeof (id);
+				So(nng_msg_getopt(msg, NNG_OPT_SURVEYID, &id, &sz) == 0);
+				So(sz == sizeof (id));
+				So(id == id1);
+				nng_msg_free(msg);
+
+				So(nng_recvmsg(surv, &msg, 0) == 0);
+				CHECKSTR(msg, "two");
+				sz = sizeof (id);
+				So(nng_msg_getopt(msg, NNG_OPT_SURVEYID, &id, &sz) == 0);
+				So(id == id2);
+				nng_msg_free(msg);
+			})
+
+			Convey("A raw respondent can reply", {
+				nng_msg *msg;
+				int raw = 1;
+
+				expire = 500000;
+				So(nng_setopt(surv, NNG_OPT_SURVEYTIME, &expire, sizeof (expire)) == 0);
+				So(nng_setopt(resp, NNG_OPT_RAW, &raw, sizeof (raw)) == 0);
+
+				So(nng_msg_alloc(&msg, 0) == 0);
+				APPENDSTR(msg, "abc");
+				So(nng_sendmsg(surv, msg, 0) == 0);
+				So(nng_recvmsg(resp, &msg, 0) == 0);
+				CHECKSTR(msg, "abc");
+				So(nng_sendmsg(resp, msg, 0) == 0);
+				So(nng_recvmsg(surv, &msg, 0) == 0);
+				CHECKSTR(msg, "abc");
+				nng_msg_free(msg);
+			})
+
 			Convey("Survey works", {
 				nng_msg *msg;
 				uint64_t rtimeo;
@@ -10,9 +10,229 @@
 #include "convey.h"
 #include "trantest.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// Opens a raw connection that never sends the SP header.
+static int
+stall_connect(int port)
+{
+	struct sockaddr_in sin;
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		return (-1);
+	}
+	memset(&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *) &sin, sizeof (sin)) != 0) {
+		(void) close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+// Listens for raw connections, with a small receive buffer.
+static int
+stall_listen(int port)
+{
+	struct sockaddr_in sin;
+	int fd;
+	int val;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		return (-1);
+	}
+	val = 1;
+	(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof (val));
+	val = 4096;
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof (val));
+	memset(&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(fd, (struct sockaddr *) &sin, sizeof (sin)) != 0) ||
+	    (listen(fd, 1) != 0)) {
+		(void) close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+// Accepts a raw connection and exchanges SP headers on it, as the given
+// protocol.  Nothing more is read from it.
+static int
+stall_accept(int lfd, uint16_t proto)
+{
+	uint8_t hdr[8] = { 0, 'S', 'P', 0, 0, 0, 0, 0 };
+	uint8_t peer[8];
+	int fd;
+
+	if ((fd = accept(lfd, NULL, NULL)) < 0) {
+		return (-1);
+	}
+	hdr[4] = (uint8_t) (proto >> 8);
+	hdr[5] = (uint8_t) (proto & 0xff);
+	if ((write(fd, hdr, sizeof (hdr)) != sizeof (hdr)) ||
+	    (read(fd, peer, sizeof (peer)) != sizeof (peer))) {
+		(void) close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+// Senders, and the protocols their stalled peers claim to be.
+static const uint16_t stall_protos[2][2] = {
+	{ NNG_PROTO_PAIR, NNG_PROTO_PAIR },
+	{ NNG_PROTO_PUSH, NNG_PROTO_PULL },
+};
 
 // Inproc tests.
 
 TestMain("TCP Transport", {
 	trantest_test_all("tcp://127.0.0.1:4450");
+
+	Convey("A large send to a peer that is not reading times out", {
+		nng_socket *tx;
+		nng_msg *msg;
+		int64_t tmo = 100000;
+		int lfd;
+		int fd;
+		int rv;
+		int i;
+		int j;
+
+		// The messages are much bigger than the kernel buffers, so
+		// they must not be written on the caller's thread, where the
+		// write would wait on the peer with no regard for the
+		// timeout.
+		for (i = 0; i < 2; i++) {
+			So((lfd = stall_listen(4452 + i)) >= 0);
+			So(nng_open(&tx, stall_protos[i][0]) == 0);
+			So(nng_setopt(tx, NNG_OPT_SNDTIMEO, &tmo,
+			    sizeof (tmo)) == 0);
+			So(nng_dial(tx, i == 0 ? "tcp://127.0.0.1:4452" :
+			    "tcp://127.0.0.1:4453", NULL, 0) == 0);
+			So((fd = stall_accept(lfd, stall_protos[i][1])) >= 0);
+			nni_usleep(50000);
+
+			rv = 0;
+			for (j = 0; (rv == 0) && (j < 64); j++) {
+				So(nng_msg_alloc(&msg, 4 * 1024 * 1024) == 0);
+				if ((rv = nng_sendmsg(tx, msg, 0)) != 0) {
+					nng_msg_free(msg);
+				}
+			}
+			So(rv == NNG_ETIMEDOUT);
+			nng_close(tx);
+			(void) close(fd);
+			(void) close(lfd);
+		}
+	})
+
+	Convey("Given a listening endpoint with options", {
+		nng_socket *rep;
+		nng_socket *req;
+		nng_endpoint *ep;
+		int val;
+
+		So(nng_open(&rep, NNG_PROTO_REP) == 0);
+		So(nng_open(&req, NNG_PROTO_REQ) == 0);
+		So(nng_endpoint_create(&ep, rep, "tcp://127.0.0.1:4451") == 0);
+
+		Reset({
+			nng_close(req);
+			nng_close(rep);
+		})
+
+		Convey("Sharded accepters work", {
+			nng_msg *msg;
+			size_t sz;
+
+			val = 3;
+			So(nng_endpoint_setopt(ep, NNG_OPT_ACCEPTERS, &val,
+			    sizeof (val)) == 0);
+			val = 1;
+			So(nng_endpoint_setopt(ep, NNG_OPT_REUSEPORT, &val,
+			    sizeof (val)) == 0);
+			val = 16;
+			So(nng_endpoint_setopt(ep, NNG_OPT_BACKLOG, &val,
+			    sizeof (val)) == 0);
+			So(nng_endpoint_listen(ep, NNG_FLAG_SYNCH) == 0);
+
+			sz = sizeof (val);
+			So(nng_endpoint_getopt(ep, NNG_OPT_ACCEPTERS, &val,
+			    &sz) == 0);
+			So(val == 3);
+			So(nng_endpoint_setopt(ep, NNG_OPT_ACCEPTERS, &val,
+			    sizeof (val)) == NNG_EBUSY);
+
+			So(nng_dial(req, "tcp://127.0.0.1:4451", NULL,
+			    NNG_FLAG_SYNCH) == 0);
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_msg_append(msg, "ping", 5) == 0);
+			So(nng_sendmsg(req, msg, 0) == 0);
+			So(nng_recvmsg(rep, &msg, 0) == 0);
+			So(strcmp(nng_msg_body(msg), "ping") == 0);
+			nng_msg_free(msg);
+		})
+
+		Convey("A stalled handshake does not block accepts", {
+			int64_t tmo = 100000;
+			int fd;
+
+			val = 1;
+			So(nng_endpoint_setopt(ep, NNG_OPT_ACCEPTERS, &val,
+			    sizeof (val)) == 0);
+			So(nng_endpoint_setopt(ep, NNG_OPT_HANDSHAKETIME, &tmo,
+			    sizeof (tmo)) == 0);
+			So(nng_endpoint_listen(ep, NNG_FLAG_SYNCH) == 0);
+
+			fd = stall_connect(4451);
+			So(fd >= 0);
+			So(nng_dial(req, "tcp://127.0.0.1:4451", NULL,
+			    NNG_FLAG_SYNCH) == 0);
+			(void) close(fd);
+		})
+
+		Convey("A small backlog still admits every peer", {
+			nng_socket *reqs[4];
+			int i;
+
+			val = 2;
+			So(nng_endpoint_setopt(ep, NNG_OPT_ACCEPTERS, &val,
+			    sizeof (val)) == 0);
+			val = 1;
+			So(nng_endpoint_setopt(ep, NNG_OPT_BACKLOG, &val,
+			    sizeof (val)) == 0);
+			So(nng_endpoint_listen(ep, NNG_FLAG_SYNCH) == 0);
+
+			for (i = 0; i < 4; i++) {
+				So(nng_open(&reqs[i], NNG_PROTO_REQ) == 0);
+				So(nng_dial(reqs[i], "tcp://127.0.0.1:4451",
+				    NULL, NNG_FLAG_SYNCH) == 0);
+			}
+			for (i = 0; i < 4; i++) {
+				nng_close(reqs[i]);
+			}
+		})
+
+		Convey("A closed endpoint can still be asked about", {
+			size_t sz = sizeof (val);
+
+			So(nng_endpoint_close(ep) == 0);
+			val = 1;
+			So(nng_endpoint_setopt(ep, NNG_OPT_BACKLOG, &val,
+			    sizeof (val)) == NNG_ECLOSED);
+			So(nng_endpoint_getopt(ep, NNG_OPT_BACKLOG, &val,
+			    &sz) == NNG_ECLOSED);
+			So(nng_endpoint_listen(ep, NNG_FLAG_SYNCH) ==
+			    NNG_ECLOSED);
+		})
+	})
 })
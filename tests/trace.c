@@ -0,0 +1,146 @@
+//
+// Copyright 2017 Garrett D'Amore <garrett@damore.org>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "convey.h"
+#include "nng.h"
+#include "core/nng_impl.h"
+
+#include <string.h>
+
+static nng_trace recs[4 * NNI_TRACE_RINGSIZE];
+
+static size_t
+drain(void)
+{
+	size_t n = sizeof (recs) / sizeof (recs[0]);
+
+	So(nng_trace_drain(recs, &n) == 0);
+	return (n);
+}
+
+
+TestMain("Message tracing", {
+	const char *addr = "inproc://trace";
+
+	Convey("Init worked", {
+		So(nni_init() == 0);
+	})
+
+	Convey("Given a connected PUSH/PULL pair", {
+		nng_socket *push;
+		nng_socket *pull;
+		nng_msg *msg;
+
+		So(nng_open(&push, NNG_PROTO_PUSH) == 0);
+		So(nng_open(&pull, NNG_PROTO_PULL) == 0);
+
+		Reset({
+			nng_trace_sample(0);
+			(void) drain();
+			nng_close(push);
+			nng_close(pull);
+		})
+
+		So(nng_listen(pull, addr, NULL, NNG_FLAG_SYNCH) == 0);
+		So(nng_dial(push, addr, NULL, NNG_FLAG_SYNCH) == 0);
+		(void) drain();
+
+		Convey("Nothing is traced by default", {
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_sendmsg(push, msg, 0) == 0);
+			So(nng_recvmsg(pull, &msg, 0) == 0);
+			nng_msg_free(msg);
+			So(drain() == 0);
+		})
+
+		Convey("A sampled message records every hop", {
+			size_t n;
+			size_t i;
+			uint64_t id;
+			uint64_t last;
+			int point;
+
+			So(nng_trace_sample(1) == 0);
+			So(nng_msg_alloc(&msg, 0) == 0);
+			So(nng_sendmsg(push, msg, 0) == 0);
+			So(nng_recvmsg(pull, &msg, 0) == 0);
+			nng_msg_free(msg);
+			So(nng_trace_sample(0) == 0);
+
+			// Records come from several threads, but inproc
+			// carries the id through, so there is just one.
+			n = drain();
+			So(n == 6);
+			id = recs[0].tr_id;
+			So(id != 0);
+			for (i = 0; i < n; i++) {
+				So(recs[i].tr_id == id);
+			}
+			last = 0;
+			for (point = NNG_TRACE_SEND; point <= NNG_TRACE_RECV;
+			    point++) {
+				for (i = 0; i < n; i++) {
+					if (recs[i].tr_point == point) {
+						break;
+					}
+				}
+				So(i < n);
+				So(recs[i].tr_time >= last);
+				last = recs[i].tr_time;
+			}
+			So(drain() == 0);
+		})
+
+		Convey("Sampling skips messages", {
+			size_t n;
+			int sends;
+			int i;
+
+			So(nng_trace_sample(4) == 0);
+			for (i = 0; i < 8; i++) {
+				So(nng_msg_alloc(&msg, 0) == 0);
+				So(nng_sendmsg(push, msg, 0) == 0);
+				So(nng_recvmsg(pull, &msg, 0) == 0);
+				nng_msg_free(msg);
+			}
+			So(nng_trace_sample(0) == 0);
+			n = drain();
+			sends = 0;
+			while (n > 0) {
+				n--;
+				if (recs[n].tr_point == NNG_TRACE_SEND) {
+					sends++;
+				}
+			}
+			So(sends == 2);
+		})
+	})
+
+	Convey("A full ring keeps the newest records", {
+		nni_msg *msg;
+		size_t n;
+		int i;
+
+		So(nni_msg_alloc(&msg, 0) == 0);
+		nni_trace_sample(1);
+		nni_trace_start(msg, NNG_TRACE_SEND);
+		for (i = 0; i < (2 * NNI_TRACE_RINGSIZE); i++) {
+			nni_trace_point(msg, NNG_TRACE_UWQ);
+		}
+		nni_trace_point(msg, NNG_TRACE_RECV);
+		nni_trace_sample(0);
+		nni_msg_free(msg);
+
+		n = drain();
+		So(n == NNI_TRACE_RINGSIZE);
+		So(recs[n - 1].tr_point == NNG_TRACE_RECV);
+		So(recs[0].tr_point == NNG_TRACE_UWQ);
+		So(drain() == 0);
+	})
+})